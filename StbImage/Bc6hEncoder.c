@@ -0,0 +1,194 @@
+#include <math.h>
+#include <string.h>
+#include "Bc6hEncoder.h"
+#include "BlockEncoder.h"
+
+typedef struct
+{
+  unsigned modeBits; // the 5-bit mode field
+  int endpointBits;
+  int deltaBits; // bits of the second endpoint's difference from the first, 0 when it is stored whole
+} Bc6hMode;
+
+// the one-region modes, numbered 11 to 14 in the BC6H specification
+static Bc6hMode const modes[4] =
+{
+  { 0x03, 10, 0 },
+  { 0x07, 11, 9 },
+  { 0x0B, 12, 8 },
+  { 0x0F, 16, 4 },
+};
+
+#define MODE_COUNT ((int)(sizeof(modes) / sizeof(modes[0])))
+
+// least-squares refits of the endpoints to the indices of the best mode so far
+#define REFINEMENTS 2
+
+/** @brief Converts a float to the bits of the nearest unsigned half float. */
+static int FloatToHalf(float value)
+{
+  if (!(value > 0))
+    return 0;
+  if (value >= 65504.0f)
+    return 0x7BFF;
+
+  unsigned bits;
+  memcpy(&bits, &value, sizeof(bits));
+  int exponent = (int)(bits >> 23) - 127 + 15;
+  if (exponent <= 0)
+    return (int)(value * 16777216.0f + 0.5f); // subnormal: a multiple of 2^-24
+
+  unsigned mantissa = bits & 0x7FFFFF;
+  int half = (exponent << 10) | (int)(mantissa >> 13);
+  return half + (int)((mantissa >> 12) & 1);
+}
+
+/** @brief Expands a quantized endpoint to the 16-bit value the palette is interpolated from. */
+static int Unquantize(int value, int bits)
+{
+  if (bits >= 15)
+    return value;
+  if (value == 0)
+    return 0;
+  if (value == (1 << bits) - 1)
+    return 0xFFFF;
+  return ((value << 16) + 0x8000) >> bits;
+}
+
+static int Quantize(float value, int bits)
+{
+  int maximum = (1 << bits) - 1;
+  int guess = (int)(value * (1 << bits) / 65536.0f);
+  int best = 0;
+  float bestDifference = 1e30f;
+  for (int q = guess - 1; q <= guess + 1; q++)
+  {
+    if (q < 0 || q > maximum)
+      continue;
+    float difference = fabsf(Unquantize(q, bits) - value);
+    if (difference < bestDifference)
+    {
+      bestDifference = difference;
+      best = q;
+    }
+  }
+  return best;
+}
+
+/** @brief Quantizes the endpoints for a mode and picks the palette entry of every pixel.
+ *
+ *  @return the squared error of the block, measured on the 16-bit interpolation scale
+ */
+static float EncodeMode(
+  float const (*pixels)[4], Bc6hMode const* mode, float const* endpoint0, float const* endpoint1,
+  int (*quantized)[3], int* indices)
+{
+  int palette[16][3];
+  for (int c = 0; c < 3; c++)
+  {
+    quantized[0][c] = Quantize(endpoint0[c], mode->endpointBits);
+    quantized[1][c] = Quantize(endpoint1[c], mode->endpointBits);
+    if (mode->deltaBits)
+    {
+      // symmetric, so the difference still fits once the endpoints are swapped for the anchor
+      int limit = (1 << (mode->deltaBits - 1)) - 1;
+      int delta = quantized[1][c] - quantized[0][c];
+      delta = delta < -limit ? -limit : delta > limit ? limit : delta;
+      quantized[1][c] = quantized[0][c] + delta;
+    }
+
+    int value0 = Unquantize(quantized[0][c], mode->endpointBits);
+    int value1 = Unquantize(quantized[1][c], mode->endpointBits);
+    for (int i = 0; i < 16; i++)
+      palette[i][c] = ((64 - blockWeights4[i]) * value0 + blockWeights4[i] * value1 + 32) >> 6;
+  }
+
+  float error = 0;
+  for (int pixel = 0; pixel < 16; pixel++)
+  {
+    float bestError = 1e30f;
+    for (int i = 0; i < 16; i++)
+    {
+      float dr = pixels[pixel][0] - palette[i][0];
+      float dg = pixels[pixel][1] - palette[i][1];
+      float db = pixels[pixel][2] - palette[i][2];
+      float candidate = dr * dr + dg * dg + db * db;
+      if (candidate < bestError)
+      {
+        bestError = candidate;
+        indices[pixel] = i;
+      }
+    }
+    error += bestError;
+  }
+  return error;
+}
+
+void CompressBC6HBlock(unsigned char* dest, float const* rgb)
+{
+  // the palette is interpolated between 16-bit values, which end up as (value * 31) >> 6 in the
+  // bits of a half float, so pixels are matched on that scale
+  float pixels[16][4];
+  for (int i = 0; i < 16; i++)
+  {
+    for (int c = 0; c < 3; c++)
+      pixels[i][c] = FloatToHalf(rgb[i * 3 + c]) * (64.0f / 31.0f);
+  }
+
+  float endpoint0[3], endpoint1[3];
+  FitBlockEndpoints(pixels, 0xFFFF, 3, endpoint0, endpoint1);
+  for (int c = 0; c < 3; c++)
+  {
+    endpoint0[c] = endpoint0[c] < 0 ? 0 : endpoint0[c] > 65535 ? 65535 : endpoint0[c];
+    endpoint1[c] = endpoint1[c] < 0 ? 0 : endpoint1[c] > 65535 ? 65535 : endpoint1[c];
+  }
+
+  float bestError = 1e30f;
+  int bestMode = 0;
+  int bestQuantized[2][3];
+  int bestIndices[16];
+  for (int iteration = 0; iteration <= REFINEMENTS; iteration++)
+  {
+    for (int m = 0; m < MODE_COUNT; m++)
+    {
+      int quantized[2][3];
+      int indices[16];
+      float error = EncodeMode(pixels, &modes[m], endpoint0, endpoint1, quantized, indices);
+      if (error < bestError)
+      {
+        bestError = error;
+        bestMode = m;
+        memcpy(bestQuantized, quantized, sizeof(quantized));
+        memcpy(bestIndices, indices, sizeof(indices));
+      }
+    }
+    if (bestError == 0
+      || !RefitBlockEndpoints(pixels, 0xFFFF, 3, bestIndices, blockWeights4, 65535, endpoint0, endpoint1))
+      break;
+  }
+
+  // the top index bit of pixel 0 is implied to be 0
+  int swap = bestIndices[0] >= 8;
+  int first = swap ? 1 : 0;
+  Bc6hMode const* mode = &modes[bestMode];
+  BlockWriter writer = { { 0, 0 }, 0 };
+  WriteBlockBits(&writer, mode->modeBits, 5);
+  for (int c = 0; c < 3; c++)
+    WriteBlockBits(&writer, bestQuantized[first][c] & 0x3FF, 10);
+  for (int c = 0; c < 3; c++)
+  {
+    if (!mode->deltaBits)
+    {
+      WriteBlockBits(&writer, bestQuantized[1 - first][c], 10);
+      continue;
+    }
+    WriteBlockBits(&writer, (unsigned)(bestQuantized[1 - first][c] - bestQuantized[first][c]), mode->deltaBits);
+    // the first endpoint's bits past the tenth follow, highest first
+    for (int bit = mode->endpointBits - 1; bit >= 10; bit--)
+      WriteBlockBits(&writer, bestQuantized[first][c] >> bit & 1, 1);
+  }
+  for (int i = 0; i < 16; i++)
+    WriteBlockBits(&writer, swap ? 15 - bestIndices[i] : bestIndices[i], i == 0 ? 3 : 4);
+
+  StoreBlock(&writer, dest);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+/** @brief Compresses a 4x4 block of linear RGB float pixels to a 16-byte unsigned BC6H block.
+ *
+ *  Negative values and NaNs are stored as 0, and values beyond the largest half float as 65504.
+ *  Every block uses one region, in whichever of the one-region modes reproduces it best: 10-bit
+ *  endpoints stored whole, or an 11-, 12- or 16-bit first endpoint with the second stored as a
+ *  difference from it.
+ *
+ *  @param dest receives the 16-byte block
+ *  @param rgb 16 pixels, 3 floats each, in row-major order
+ */
+void CompressBC6HBlock(unsigned char* dest, float const* rgb);
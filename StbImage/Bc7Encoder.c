@@ -0,0 +1,433 @@
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include "Bc7Encoder.h"
+#include "BlockEncoder.h"
+
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define BC7_SSE2
+#include <emmintrin.h>
+#endif
+
+// two-subset partitions, as in the BC7 specification: bit i is set when pixel i is in subset 1
+static unsigned short const partitionMasks[64] =
+{
+  0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+  0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+  0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE,
+  0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+  0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A,
+  0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+  0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C,
+  0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22,
+};
+
+// pixel whose index in subset 1 has its top bit implied to be 0
+static unsigned char const partitionAnchors[64] =
+{
+  15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+  15, 2, 8, 2, 2, 8, 8, 15, 2, 8, 2, 2, 8, 8, 2, 2,
+  15, 15, 6, 8, 2, 8, 15, 15, 2, 8, 2, 2, 2, 15, 15, 6,
+  6, 2, 6, 8, 15, 15, 2, 2, 15, 15, 15, 15, 15, 2, 2, 15,
+};
+
+typedef struct
+{
+  short rg[32]; // red and green of each pixel, interleaved
+  short ba[32]; // blue and alpha of each pixel, interleaved
+} BlockPixels;
+
+/** @brief Finds the nearest palette entry to every pixel by squared RGBA distance. */
+static void FindIndices(BlockPixels const* pixels, short const (*palette)[4], int paletteSize, int* indices, int* errors)
+{
+#ifdef BC7_SSE2
+  // four pixels per register; madd squares and sums each channel pair in one step
+  for (int group = 0; group < 4; group++)
+  {
+    __m128i rg = _mm_loadu_si128((__m128i const*)(pixels->rg + group * 8));
+    __m128i ba = _mm_loadu_si128((__m128i const*)(pixels->ba + group * 8));
+    __m128i bestError = _mm_set1_epi32(INT_MAX);
+    __m128i bestIndex = _mm_setzero_si128();
+    for (int i = 0; i < paletteSize; i++)
+    {
+      __m128i entryRG = _mm_set1_epi32((unsigned short)palette[i][0] | ((unsigned)(unsigned short)palette[i][1] << 16));
+      __m128i entryBA = _mm_set1_epi32((unsigned short)palette[i][2] | ((unsigned)(unsigned short)palette[i][3] << 16));
+      __m128i differenceRG = _mm_sub_epi16(rg, entryRG);
+      __m128i differenceBA = _mm_sub_epi16(ba, entryBA);
+      __m128i error = _mm_add_epi32(
+        _mm_madd_epi16(differenceRG, differenceRG), _mm_madd_epi16(differenceBA, differenceBA));
+      __m128i better = _mm_cmplt_epi32(error, bestError);
+      bestError = _mm_or_si128(_mm_and_si128(better, error), _mm_andnot_si128(better, bestError));
+      bestIndex = _mm_or_si128(_mm_and_si128(better, _mm_set1_epi32(i)), _mm_andnot_si128(better, bestIndex));
+    }
+    _mm_storeu_si128((__m128i*)(indices + group * 4), bestIndex);
+    _mm_storeu_si128((__m128i*)(errors + group * 4), bestError);
+  }
+#else
+  for (int pixel = 0; pixel < 16; pixel++)
+  {
+    int bestError = INT_MAX;
+    int bestIndex = 0;
+    for (int i = 0; i < paletteSize; i++)
+    {
+      int dr = pixels->rg[pixel * 2] - palette[i][0];
+      int dg = pixels->rg[pixel * 2 + 1] - palette[i][1];
+      int db = pixels->ba[pixel * 2] - palette[i][2];
+      int da = pixels->ba[pixel * 2 + 1] - palette[i][3];
+      int error = dr * dr + dg * dg + db * db + da * da;
+      if (error < bestError)
+      {
+        bestError = error;
+        bestIndex = i;
+      }
+    }
+    indices[pixel] = bestIndex;
+    errors[pixel] = bestError;
+  }
+#endif
+}
+
+static int Clamp(int value, int maximum)
+{
+  return value < 0 ? 0 : value > maximum ? maximum : value;
+}
+
+/** @brief Quantizes a mode 6 endpoint to 7 bits per channel plus a shared p-bit. */
+static void QuantizeMode6Endpoint(float const* endpoint, int* quantized, int* pBit, int* expanded)
+{
+  int bestError = INT_MAX;
+  for (int p = 0; p < 2; p++)
+  {
+    int candidate[4];
+    int error = 0;
+    for (int c = 0; c < 4; c++)
+    {
+      candidate[c] = Clamp((int)floorf((endpoint[c] - p) * 0.5f + 0.5f), 127);
+      int difference = candidate[c] * 2 + p - (int)(endpoint[c] + 0.5f);
+      error += difference * difference;
+    }
+    if (error < bestError)
+    {
+      bestError = error;
+      *pBit = p;
+      memcpy(quantized, candidate, sizeof(candidate));
+    }
+  }
+  for (int c = 0; c < 4; c++)
+    expanded[c] = quantized[c] * 2 + *pBit;
+}
+
+static int ExpandMode1(int quantized, int pBit)
+{
+  int value = quantized * 2 + pBit;
+  return (value << 1) | (value >> 6);
+}
+
+/** @brief Quantizes the RGB endpoints of a mode 1 subset to 6 bits plus a p-bit shared by both. */
+static int QuantizeMode1Subset(
+  float const* endpoint0, float const* endpoint1, int* quantized0, int* quantized1, int* pBit, int* expanded0,
+  int* expanded1)
+{
+  int bestError = INT_MAX;
+  for (int p = 0; p < 2; p++)
+  {
+    int candidate[2][3];
+    int error = 0;
+    for (int e = 0; e < 2; e++)
+    {
+      float const* endpoint = e ? endpoint1 : endpoint0;
+      for (int c = 0; c < 3; c++)
+      {
+        int target = (int)(endpoint[c] + 0.5f);
+        int guess = Clamp((int)floorf((endpoint[c] * 127 / 255 - p) * 0.5f + 0.5f), 63);
+        int best = guess;
+        int bestDifference = INT_MAX;
+        for (int q = guess > 0 ? guess - 1 : 0; q <= (guess < 63 ? guess + 1 : 63); q++)
+        {
+          int difference = ExpandMode1(q, p) - target;
+          difference = difference < 0 ? -difference : difference;
+          if (difference < bestDifference)
+          {
+            bestDifference = difference;
+            best = q;
+          }
+        }
+        candidate[e][c] = best;
+        error += bestDifference * bestDifference;
+      }
+    }
+    if (error < bestError)
+    {
+      bestError = error;
+      *pBit = p;
+      memcpy(quantized0, candidate[0], sizeof(candidate[0]));
+      memcpy(quantized1, candidate[1], sizeof(candidate[1]));
+    }
+  }
+  for (int c = 0; c < 3; c++)
+  {
+    expanded0[c] = ExpandMode1(quantized0[c], *pBit);
+    expanded1[c] = ExpandMode1(quantized1[c], *pBit);
+  }
+  expanded0[3] = 255;
+  expanded1[3] = 255;
+  return bestError;
+}
+
+static void BuildPalette(int const* expanded0, int const* expanded1, int const* weights, int size, short (*palette)[4])
+{
+  for (int i = 0; i < size; i++)
+  {
+    for (int c = 0; c < 4; c++)
+      palette[i][c] = (short)(((64 - weights[i]) * expanded0[c] + weights[i] * expanded1[c] + 32) >> 6);
+  }
+}
+
+static int EncodeMode6(BlockPixels const* pixels, float const (*values)[4], int refinements, BlockWriter* writer)
+{
+  float endpoint0[4], endpoint1[4];
+  FitBlockEndpoints(values, 0xFFFF, 4, endpoint0, endpoint1);
+
+  int bestError = INT_MAX;
+  int bestQuantized[2][4], bestPBits[2], bestIndices[16];
+  for (int iteration = 0; iteration <= refinements; iteration++)
+  {
+    int quantized[2][4], pBits[2], expanded[2][4];
+    QuantizeMode6Endpoint(endpoint0, quantized[0], &pBits[0], expanded[0]);
+    QuantizeMode6Endpoint(endpoint1, quantized[1], &pBits[1], expanded[1]);
+
+    short palette[16][4];
+    int indices[16], errors[16];
+    BuildPalette(expanded[0], expanded[1], blockWeights4, 16, palette);
+    FindIndices(pixels, palette, 16, indices, errors);
+
+    int error = 0;
+    for (int i = 0; i < 16; i++)
+      error += errors[i];
+    if (error < bestError)
+    {
+      bestError = error;
+      memcpy(bestQuantized, quantized, sizeof(quantized));
+      memcpy(bestPBits, pBits, sizeof(pBits));
+      memcpy(bestIndices, indices, sizeof(indices));
+    }
+    if (error == 0 || !RefitBlockEndpoints(values, 0xFFFF, 4, indices, blockWeights4, 255, endpoint0, endpoint1))
+      break;
+  }
+
+  // the top index bit of pixel 0 is implied to be 0
+  int swap = bestIndices[0] >= 8;
+  int first = swap ? 1 : 0;
+  WriteBlockBits(writer, 1 << 6, 7);
+  for (int c = 0; c < 4; c++)
+  {
+    WriteBlockBits(writer, bestQuantized[first][c], 7);
+    WriteBlockBits(writer, bestQuantized[1 - first][c], 7);
+  }
+  WriteBlockBits(writer, bestPBits[first], 1);
+  WriteBlockBits(writer, bestPBits[1 - first], 1);
+  for (int i = 0; i < 16; i++)
+    WriteBlockBits(writer, swap ? 15 - bestIndices[i] : bestIndices[i], i == 0 ? 3 : 4);
+  return bestError;
+}
+
+static int EncodeMode1(
+  BlockPixels const* pixels, float const (*values)[4], int partition, int refinements, BlockWriter* writer)
+{
+  unsigned masks[2] = { ~partitionMasks[partition] & 0xFFFFu, partitionMasks[partition] };
+  float endpoints[2][2][3];
+  for (int s = 0; s < 2; s++)
+    FitBlockEndpoints(values, masks[s], 3, endpoints[s][0], endpoints[s][1]);
+
+  int bestError = INT_MAX;
+  int bestQuantized[2][2][3], bestPBits[2], bestIndices[16];
+  for (int iteration = 0; iteration <= refinements; iteration++)
+  {
+    int quantized[2][2][3], pBits[2];
+    int indices[16];
+    int error = 0;
+    for (int s = 0; s < 2; s++)
+    {
+      int expanded[2][4];
+      QuantizeMode1Subset(
+        endpoints[s][0], endpoints[s][1], quantized[s][0], quantized[s][1], &pBits[s], expanded[0], expanded[1]);
+
+      short palette[8][4];
+      int subsetIndices[16], errors[16];
+      BuildPalette(expanded[0], expanded[1], blockWeights3, 8, palette);
+      FindIndices(pixels, palette, 8, subsetIndices, errors);
+      for (int i = 0; i < 16; i++)
+      {
+        if (masks[s] >> i & 1)
+        {
+          indices[i] = subsetIndices[i];
+          error += errors[i];
+        }
+      }
+    }
+
+    if (error < bestError)
+    {
+      bestError = error;
+      memcpy(bestQuantized, quantized, sizeof(quantized));
+      memcpy(bestPBits, pBits, sizeof(pBits));
+      memcpy(bestIndices, indices, sizeof(indices));
+    }
+    if (error == 0)
+      break;
+    int refitted = 0;
+    for (int s = 0; s < 2; s++)
+    {
+      refitted |=
+        RefitBlockEndpoints(values, masks[s], 3, indices, blockWeights3, 255, endpoints[s][0], endpoints[s][1]);
+    }
+    if (!refitted)
+      break;
+  }
+
+  // the top index bit of each subset's anchor pixel is implied to be 0
+  int anchors[2] = { 0, partitionAnchors[partition] };
+  int swap[2];
+  for (int s = 0; s < 2; s++)
+    swap[s] = bestIndices[anchors[s]] >= 4;
+
+  WriteBlockBits(writer, 1 << 1, 2);
+  WriteBlockBits(writer, partition, 6);
+  for (int c = 0; c < 3; c++)
+  {
+    for (int s = 0; s < 2; s++)
+    {
+      WriteBlockBits(writer, bestQuantized[s][swap[s]][c], 6);
+      WriteBlockBits(writer, bestQuantized[s][1 - swap[s]][c], 6);
+    }
+  }
+  WriteBlockBits(writer, bestPBits[0], 1);
+  WriteBlockBits(writer, bestPBits[1], 1);
+  for (int i = 0; i < 16; i++)
+  {
+    int s = masks[1] >> i & 1;
+    WriteBlockBits(writer, swap[s] ? 7 - bestIndices[i] : bestIndices[i], i == anchors[s] ? 2 : 3);
+  }
+  return bestError;
+}
+
+/** @brief Orders the two-subset partitions by an estimate of their RGB error and returns the best count. */
+static void RankPartitions(unsigned char const* rgba, int* partitions, int count)
+{
+  // pixel count, sums and products of every subset of every block row, so a subset of the block
+  // sums four table entries rather than up to sixteen pixels
+  int rowMoments[4][16][10];
+  for (int row = 0; row < 4; row++)
+  {
+    memset(rowMoments[row][0], 0, sizeof(rowMoments[row][0]));
+    for (int subset = 1; subset < 16; subset++)
+    {
+      int bit = subset & 1 ? 0 : subset & 2 ? 1 : subset & 4 ? 2 : 3;
+      unsigned char const* pixel = rgba + (row * 4 + bit) * 4;
+      int r = pixel[0], g = pixel[1], b = pixel[2];
+      int values[10] = { 1, r, g, b, r * r, g * g, b * b, r * g, r * b, g * b };
+      for (int k = 0; k < 10; k++)
+        rowMoments[row][subset][k] = rowMoments[row][subset & (subset - 1)][k] + values[k];
+    }
+  }
+
+  float estimates[64];
+  for (int partition = 0; partition < 64; partition++)
+  {
+    float estimate = 0;
+    for (int s = 0; s < 2; s++)
+    {
+      unsigned mask = s ? partitionMasks[partition] : ~partitionMasks[partition] & 0xFFFFu;
+      int sums[10];
+      for (int k = 0; k < 10; k++)
+      {
+        sums[k] = rowMoments[0][mask & 15][k] + rowMoments[1][mask >> 4 & 15][k]
+          + rowMoments[2][mask >> 8 & 15][k] + rowMoments[3][mask >> 12][k];
+      }
+
+      // covariance times the pixel count, which is exact in integers
+      int n = sums[0];
+      float cov[6] =
+      {
+        (float)(n * sums[4] - sums[1] * sums[1]), (float)(n * sums[5] - sums[2] * sums[2]),
+        (float)(n * sums[6] - sums[3] * sums[3]), (float)(n * sums[7] - sums[1] * sums[2]),
+        (float)(n * sums[8] - sums[1] * sums[3]), (float)(n * sums[9] - sums[2] * sums[3]),
+      };
+
+      // variance left after projecting onto one power iteration step from the row of the
+      // largest variance, which is close to the principal axis for the blocks that matter
+      int start = cov[0] >= cov[1] && cov[0] >= cov[2] ? 0 : cov[1] >= cov[2] ? 1 : 2;
+      float axis[3] =
+      {
+        start == 0 ? cov[0] : start == 1 ? cov[3] : cov[4],
+        start == 0 ? cov[3] : start == 1 ? cov[1] : cov[5],
+        start == 0 ? cov[4] : start == 1 ? cov[5] : cov[2],
+      };
+      float length = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+      float variance = cov[0] + cov[1] + cov[2];
+      if (length > 0)
+      {
+        float projected = axis[0] * (cov[0] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2])
+          + axis[1] * (cov[3] * axis[0] + cov[1] * axis[1] + cov[5] * axis[2])
+          + axis[2] * (cov[4] * axis[0] + cov[5] * axis[1] + cov[2] * axis[2]);
+        variance -= projected / length;
+      }
+      estimate += variance / n;
+    }
+    estimates[partition] = estimate;
+  }
+
+  unsigned long long chosen = 0;
+  for (int i = 0; i < count; i++)
+  {
+    int best = -1;
+    for (int partition = 0; partition < 64; partition++)
+    {
+      if (!(chosen >> partition & 1) && (best < 0 || estimates[partition] < estimates[best]))
+        best = partition;
+    }
+    partitions[i] = best;
+    chosen |= 1ULL << best;
+  }
+}
+
+void CompressBC7Block(unsigned char* dest, unsigned char const* rgba, int quality)
+{
+  // the fits work on floats, the index search on interleaved shorts
+  BlockPixels pixels;
+  float values[16][4];
+  int opaque = 1;
+  for (int i = 0; i < 16; i++)
+  {
+    for (int c = 0; c < 4; c++)
+      values[i][c] = rgba[i * 4 + c];
+    pixels.rg[i * 2] = rgba[i * 4];
+    pixels.rg[i * 2 + 1] = rgba[i * 4 + 1];
+    pixels.ba[i * 2] = rgba[i * 4 + 2];
+    pixels.ba[i * 2 + 1] = rgba[i * 4 + 3];
+    opaque &= rgba[i * 4 + 3] == 255;
+  }
+
+  int refinements = quality == BC7_QUALITY_SLOW ? 4 : quality == BC7_QUALITY_NORMAL ? 2 : 1;
+  BlockWriter best = { { 0, 0 }, 0 };
+  int bestError = EncodeMode6(&pixels, values, refinements, &best);
+
+  if (quality != BC7_QUALITY_FAST && opaque && bestError > 0)
+  {
+    int partitions[16];
+    int partitionCount = quality == BC7_QUALITY_SLOW ? 16 : 2;
+    RankPartitions(rgba, partitions, partitionCount);
+    for (int i = 0; i < partitionCount; i++)
+    {
+      BlockWriter candidate = { { 0, 0 }, 0 };
+      int error = EncodeMode1(&pixels, values, partitions[i], refinements, &candidate);
+      if (error < bestError)
+      {
+        bestError = error;
+        best = candidate;
+      }
+    }
+  }
+
+  StoreBlock(&best, dest);
+}
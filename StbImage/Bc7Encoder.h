@@ -0,0 +1,20 @@
+#pragma once
+
+// mode 6 only, with one endpoint refinement
+#define BC7_QUALITY_FAST 0
+// mode 6, plus mode 1 with the two most promising partitions for opaque blocks
+#define BC7_QUALITY_NORMAL 1
+// mode 6, plus mode 1 with the sixteen most promising partitions, both with more refinement
+#define BC7_QUALITY_SLOW 2
+
+/** @brief Compresses a 4x4 block of RGBA pixels to a 16-byte BC7 block.
+ *
+ *  Every block is encoded as mode 6 (one subset, RGBA endpoints, 16 index levels). Opaque
+ *  blocks are also tried as mode 1 (two subsets, RGB endpoints, 8 index levels), and the mode
+ *  with the lower squared error is kept.
+ *
+ *  @param dest receives the 16-byte block
+ *  @param rgba 16 pixels, 4 bytes each, in row-major order
+ *  @param quality one of the BC7_QUALITY_ presets
+ */
+void CompressBC7Block(unsigned char* dest, unsigned char const* rgba, int quality);
@@ -0,0 +1,136 @@
+#include <math.h>
+#include "BlockEncoder.h"
+
+int const blockWeights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+int const blockWeights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+void WriteBlockBits(BlockWriter* writer, unsigned value, int count)
+{
+  for (int i = 0; i < count; i++, writer->position++)
+    writer->bits[writer->position >> 6] |= (unsigned long long)((value >> i) & 1) << (writer->position & 63);
+}
+
+void StoreBlock(BlockWriter const* writer, unsigned char* dest)
+{
+  for (int i = 0; i < 16; i++)
+    dest[i] = (unsigned char)(writer->bits[i >> 3] >> ((i & 7) * 8));
+}
+
+void FitBlockEndpoints(float const (*pixels)[4], unsigned mask, int channels, float* endpoint0, float* endpoint1)
+{
+  float mean[4] = { 0 };
+  int count = 0;
+  for (int i = 0; i < 16; i++)
+  {
+    if (!(mask >> i & 1))
+      continue;
+    for (int c = 0; c < channels; c++)
+      mean[c] += pixels[i][c];
+    count++;
+  }
+  for (int c = 0; c < channels; c++)
+    mean[c] /= count;
+
+  float covariance[4][4] = { { 0 } };
+  for (int i = 0; i < 16; i++)
+  {
+    if (!(mask >> i & 1))
+      continue;
+    for (int c = 0; c < channels; c++)
+    {
+      for (int k = c; k < channels; k++)
+        covariance[c][k] += (pixels[i][c] - mean[c]) * (pixels[i][k] - mean[k]);
+    }
+  }
+
+  // power iteration from the row with the largest variance
+  int start = 0;
+  for (int c = 0; c < channels; c++)
+  {
+    for (int k = 0; k < c; k++)
+      covariance[c][k] = covariance[k][c];
+    if (covariance[c][c] > covariance[start][start])
+      start = c;
+  }
+  float axis[4] = { 0 };
+  for (int c = 0; c < channels; c++)
+    axis[c] = covariance[start][c];
+  for (int iteration = 0; iteration < 8; iteration++)
+  {
+    float next[4] = { 0 };
+    float length = 0;
+    for (int c = 0; c < channels; c++)
+    {
+      for (int k = 0; k < channels; k++)
+        next[c] += covariance[c][k] * axis[k];
+      length += next[c] * next[c];
+    }
+    if (length < 1e-6f)
+      break;
+    length = 1.0f / sqrtf(length);
+    for (int c = 0; c < channels; c++)
+      axis[c] = next[c] * length;
+  }
+
+  float axisLength = 0;
+  for (int c = 0; c < channels; c++)
+    axisLength += axis[c] * axis[c];
+  float minimum = 0;
+  float maximum = 0;
+  if (axisLength > 0.5f)
+  {
+    minimum = 1e30f;
+    maximum = -1e30f;
+    for (int i = 0; i < 16; i++)
+    {
+      if (!(mask >> i & 1))
+        continue;
+      float t = 0;
+      for (int c = 0; c < channels; c++)
+        t += (pixels[i][c] - mean[c]) * axis[c];
+      minimum = t < minimum ? t : minimum;
+      maximum = t > maximum ? t : maximum;
+    }
+  }
+
+  for (int c = 0; c < channels; c++)
+  {
+    endpoint0[c] = mean[c] + minimum * axis[c];
+    endpoint1[c] = mean[c] + maximum * axis[c];
+  }
+}
+
+int RefitBlockEndpoints(
+  float const (*pixels)[4], unsigned mask, int channels, int const* indices, int const* weights, float maximum,
+  float* endpoint0, float* endpoint1)
+{
+  float a = 0, b = 0, c = 0;
+  float x0[4] = { 0 };
+  float x1[4] = { 0 };
+  for (int i = 0; i < 16; i++)
+  {
+    if (!(mask >> i & 1))
+      continue;
+    float t = weights[indices[i]] / 64.0f;
+    a += (1 - t) * (1 - t);
+    b += t * (1 - t);
+    c += t * t;
+    for (int k = 0; k < channels; k++)
+    {
+      x0[k] += (1 - t) * pixels[i][k];
+      x1[k] += t * pixels[i][k];
+    }
+  }
+
+  float determinant = a * c - b * b;
+  if (fabsf(determinant) < 1e-6f)
+    return 0;
+  for (int k = 0; k < channels; k++)
+  {
+    float value0 = (c * x0[k] - b * x1[k]) / determinant;
+    float value1 = (a * x1[k] - b * x0[k]) / determinant;
+    endpoint0[k] = value0 < 0 ? 0 : value0 > maximum ? maximum : value0;
+    endpoint1[k] = value1 < 0 ? 0 : value1 > maximum ? maximum : value1;
+  }
+  return 1;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+// interpolation weights out of 64 for 3- and 4-bit indices, shared by BC6H and BC7
+extern int const blockWeights3[8];
+extern int const blockWeights4[16];
+
+/** @brief Collects the fields of a 16-byte BC6H or BC7 block, least significant bit first. */
+typedef struct
+{
+  unsigned long long bits[2];
+  int position;
+} BlockWriter;
+
+void WriteBlockBits(BlockWriter* writer, unsigned value, int count);
+
+/** @brief Stores the 16 bytes of a finished block. */
+void StoreBlock(BlockWriter const* writer, unsigned char* dest);
+
+/** @brief Fits a line through the pixels in mask and returns its extent as two endpoints.
+ *
+ *  @param pixels 16 pixels of a 4x4 block, of which the first channels values are used
+ *  @param mask bit i is set when pixel i takes part in the fit
+ */
+void FitBlockEndpoints(float const (*pixels)[4], unsigned mask, int channels, float* endpoint0, float* endpoint1);
+
+/** @brief Solves for the endpoints that best reproduce the pixels in mask with the given indices.
+ *
+ *  @param weights interpolation weight of each index, out of 64
+ *  @param maximum largest value an endpoint channel is clamped to
+ *  @return 0 if every pixel uses the same weight, leaving the endpoints unchanged
+ */
+int RefitBlockEndpoints(
+  float const (*pixels)[4], unsigned mask, int channels, int const* indices, int const* weights, float maximum,
+  float* endpoint0, float* endpoint1);
@@ -0,0 +1,163 @@
+#include <stddef.h>
+#include "Downsample.h"
+#include "stb_image_resize.h"
+
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define DOWNSAMPLE_SSE2
+#include <emmintrin.h>
+#endif
+
+static void HalveRGBARow(unsigned char const* row0, unsigned char const* row1, unsigned char* dest, int destWidth)
+{
+  int x = 0;
+
+#ifdef DOWNSAMPLE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i rounding = _mm_set1_epi16(2);
+
+  // 8 source pixels per row -> 4 destination pixels
+  for (; x + 4 <= destWidth; x += 4)
+  {
+    __m128i a0 = _mm_loadu_si128((__m128i const*)(row0 + (size_t)x * 8));
+    __m128i a1 = _mm_loadu_si128((__m128i const*)(row0 + (size_t)x * 8 + 16));
+    __m128i b0 = _mm_loadu_si128((__m128i const*)(row1 + (size_t)x * 8));
+    __m128i b1 = _mm_loadu_si128((__m128i const*)(row1 + (size_t)x * 8 + 16));
+
+    // vertical sums in 16-bit lanes, two pixels per register
+    __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+    __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+    __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+    __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+    // horizontal sums of neighbouring pixels
+    __m128i h0 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+    __m128i h1 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+
+    h0 = _mm_srli_epi16(_mm_add_epi16(h0, rounding), 2);
+    h1 = _mm_srli_epi16(_mm_add_epi16(h1, rounding), 2);
+    _mm_storeu_si128((__m128i*)(dest + (size_t)x * 4), _mm_packus_epi16(h0, h1));
+  }
+#endif
+
+  for (; x < destWidth; x++)
+  {
+    unsigned char const* a = row0 + (size_t)x * 8;
+    unsigned char const* b = row1 + (size_t)x * 8;
+    for (int c = 0; c < 4; c++)
+      dest[(size_t)x * 4 + c] = (unsigned char)((a[c] + a[c + 4] + b[c] + b[c + 4] + 2) >> 2);
+  }
+}
+
+static void HalveGrayRow(unsigned char const* row0, unsigned char const* row1, unsigned char* dest, int destWidth)
+{
+  int x = 0;
+
+#ifdef DOWNSAMPLE_SSE2
+  const __m128i lowBytes = _mm_set1_epi16(0xFF);
+  const __m128i rounding = _mm_set1_epi16(2);
+
+  // 32 source pixels per row -> 16 destination pixels
+  for (; x + 16 <= destWidth; x += 16)
+  {
+    __m128i a0 = _mm_loadu_si128((__m128i const*)(row0 + (size_t)x * 2));
+    __m128i a1 = _mm_loadu_si128((__m128i const*)(row0 + (size_t)x * 2 + 16));
+    __m128i b0 = _mm_loadu_si128((__m128i const*)(row1 + (size_t)x * 2));
+    __m128i b1 = _mm_loadu_si128((__m128i const*)(row1 + (size_t)x * 2 + 16));
+
+    // each 16-bit lane holds a horizontal pair; add its two bytes from both rows
+    __m128i h0 = _mm_add_epi16(
+      _mm_add_epi16(_mm_and_si128(a0, lowBytes), _mm_srli_epi16(a0, 8)),
+      _mm_add_epi16(_mm_and_si128(b0, lowBytes), _mm_srli_epi16(b0, 8)));
+    __m128i h1 = _mm_add_epi16(
+      _mm_add_epi16(_mm_and_si128(a1, lowBytes), _mm_srli_epi16(a1, 8)),
+      _mm_add_epi16(_mm_and_si128(b1, lowBytes), _mm_srli_epi16(b1, 8)));
+
+    h0 = _mm_srli_epi16(_mm_add_epi16(h0, rounding), 2);
+    h1 = _mm_srli_epi16(_mm_add_epi16(h1, rounding), 2);
+    _mm_storeu_si128((__m128i*)(dest + x), _mm_packus_epi16(h0, h1));
+  }
+#endif
+
+  for (; x < destWidth; x++)
+  {
+    unsigned char const* a = row0 + (size_t)x * 2;
+    unsigned char const* b = row1 + (size_t)x * 2;
+    dest[x] = (unsigned char)((a[0] + a[1] + b[0] + b[1] + 2) >> 2);
+  }
+}
+
+void HalveRow(unsigned char const* row0, unsigned char const* row1, unsigned char* dest, int destWidth, int channels)
+{
+  if (channels == 1)
+    HalveGrayRow(row0, row1, dest, destWidth);
+  else
+    HalveRGBARow(row0, row1, dest, destWidth);
+}
+
+void DownsampleImage(
+  unsigned char const* src, int srcWidth, int srcHeight, unsigned char* dest, int destWidth, int destHeight,
+  int channels)
+{
+  int halveX = destWidth * 2 == srcWidth;
+  int halveY = destHeight * 2 == srcHeight;
+  int keepX = srcWidth == 1 && destWidth == 1;
+  int keepY = srcHeight == 1 && destHeight == 1;
+  size_t srcStride = (size_t)srcWidth * channels;
+
+  if (halveX && (halveY || keepY))
+  {
+    for (int y = 0; y < destHeight; y++)
+    {
+      unsigned char const* row0 = src + srcStride * (halveY ? 2 * (size_t)y : 0);
+      unsigned char const* row1 = halveY ? row0 + srcStride : row0;
+      HalveRow(row0, row1, dest + (size_t)destWidth * channels * y, destWidth, channels);
+    }
+  }
+  else if (keepX && halveY)
+  {
+    // single column: average vertical pairs
+    for (int y = 0; y < destHeight; y++)
+    {
+      unsigned char const* a = src + 2 * (size_t)channels * y;
+      for (int c = 0; c < channels; c++)
+        dest[(size_t)channels * y + c] = (unsigned char)((a[c] + a[c + channels] + 1) >> 1);
+    }
+  }
+  else
+  {
+    stbir_resize_uint8(
+      src, srcWidth, srcHeight, 0,
+      dest, destWidth, destHeight, 0, channels);
+  }
+}
+
+void DownsampleFloatImage(float const* src, int srcWidth, int srcHeight, float* dest, int destWidth, int destHeight)
+{
+  int stepX = destWidth * 2 == srcWidth ? 2 : srcWidth == 1 && destWidth == 1 ? 1 : 0;
+  int stepY = destHeight * 2 == srcHeight ? 2 : srcHeight == 1 && destHeight == 1 ? 1 : 0;
+  if (stepX == 0 || stepY == 0)
+  {
+    stbir_resize_float(
+      src, srcWidth, srcHeight, 0,
+      dest, destWidth, destHeight, 0, 3);
+    return;
+  }
+
+  float scale = 1.0f / (stepX * stepY);
+  for (int y = 0; y < destHeight; y++)
+  {
+    for (int x = 0; x < destWidth; x++)
+    {
+      for (int c = 0; c < 3; c++)
+      {
+        float sum = 0;
+        for (int dy = 0; dy < stepY; dy++)
+        {
+          for (int dx = 0; dx < stepX; dx++)
+            sum += src[((size_t)(y * stepY + dy) * srcWidth + x * stepX + dx) * 3 + c];
+        }
+        dest[((size_t)y * destWidth + x) * 3 + c] = sum * scale;
+      }
+    }
+  }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+/** @brief Box-filters an RGBA or single-channel image down to destWidth x destHeight.
+ *
+ *  When every dimension is exactly halved (or is already 1 and stays 1), a dedicated integer
+ *  kernel averages each 2x2 (or 2x1) group of pixels with rounding, which gives the same bytes
+ *  as stb_image_resize's box filter. Any other ratio goes through stbir_resize_uint8.
+ *
+ *  @param src source pixels, rows packed without padding
+ *  @param srcWidth width of src in pixels
+ *  @param srcHeight height of src in pixels
+ *  @param dest destination pixels, rows packed without padding; must not overlap src
+ *  @param destWidth width of dest in pixels
+ *  @param destHeight height of dest in pixels
+ *  @param channels bytes per pixel, 4 or 1
+ */
+void DownsampleImage(
+  unsigned char const* src, int srcWidth, int srcHeight, unsigned char* dest, int destWidth, int destHeight,
+  int channels);
+
+/** @brief Averages 2x2 groups of RGBA or single-channel pixels from two source rows into one destination row.
+ *
+ *  Each destination pixel is (a + b + c + d + 2) / 4 per channel. Pass the same pointer for
+ *  row0 and row1 to halve only horizontally.
+ *
+ *  @param row0 first source row, at least 2 * destWidth pixels
+ *  @param row1 second source row, at least 2 * destWidth pixels
+ *  @param dest destination row, destWidth pixels
+ *  @param destWidth number of pixels to write
+ *  @param channels bytes per pixel, 4 or 1
+ */
+void HalveRow(unsigned char const* row0, unsigned char const* row1, unsigned char* dest, int destWidth, int channels);
+
+/** @brief Box-filters an RGB float image down to destWidth x destHeight.
+ *
+ *  Exactly halved dimensions (or ones that are already 1 and stay 1) average each 2x2 (or 2x1)
+ *  group of pixels; any other ratio goes through stbir_resize_float.
+ *
+ *  @param src source pixels, 3 floats each, rows packed without padding
+ *  @param dest destination pixels, 3 floats each, rows packed without padding; must not overlap src
+ */
+void DownsampleFloatImage(float const* src, int srcWidth, int srcHeight, float* dest, int destWidth, int destHeight);
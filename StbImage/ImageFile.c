@@ -0,0 +1,133 @@
+#include <limits.h>
+#include <stdlib.h>
+#include <windows.h>
+#include "ImageFile.h"
+
+static stbi_uc const* MapImageFile(char const* filename, size_t* size)
+{
+  HANDLE fileHandle = CreateFileA(
+    filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (fileHandle == INVALID_HANDLE_VALUE)
+    return NULL;
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart <= 0 || fileSize.QuadPart > INT_MAX)
+  {
+    CloseHandle(fileHandle);
+    return NULL;
+  }
+
+  // the view keeps the mapping, and the mapping the file, open until it is unmapped
+  HANDLE mapping = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(fileHandle);
+  if (!mapping)
+    return NULL;
+  stbi_uc const* data = (stbi_uc const*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+
+  *size = (size_t)fileSize.QuadPart;
+  return data;
+}
+
+int OpenImageFile(char const* filename, ImageFile* file)
+{
+  file->data = MapImageFile(filename, &file->size);
+  file->mapped = file->data != NULL;
+  file->file = NULL;
+  if (file->data)
+    return 1;
+
+  file->size = 0;
+  return fopen_s(&file->file, filename, "rb") == 0;
+}
+
+int OpenImageMemory(void const* buffer, size_t size, ImageFile* file)
+{
+  file->data = (stbi_uc const*)buffer;
+  file->size = size;
+  file->mapped = 0;
+  file->file = NULL;
+  return buffer && size > 0 && size <= INT_MAX;
+}
+
+void CloseImageFile(ImageFile* file)
+{
+  if (file->mapped)
+    UnmapViewOfFile(file->data);
+  if (file->file)
+    fclose(file->file);
+}
+
+int GetImageFileInfo(ImageFile* file, int* x, int* y, int* comp, int* bitDepth)
+{
+  if (file->data)
+  {
+    if (!stbi_info_from_memory(file->data, (int)file->size, x, y, comp))
+      return 0;
+    if (bitDepth)
+      *bitDepth = stbi_is_16_bit_from_memory(file->data, (int)file->size) ? 16 : 8;
+    return 1;
+  }
+
+  // stb_image restores the file position after reading the header
+  if (!stbi_info_from_file(file->file, x, y, comp))
+    return 0;
+  if (bitDepth)
+    *bitDepth = stbi_is_16_bit_from_file(file->file) ? 16 : 8;
+  return 1;
+}
+
+int LoadImageFileRows(
+  ImageFile* file, int* x, int* y, int* comp, int req_comp, stbi_row_callback callback, void* user)
+{
+  return LoadImageFileRowsScaled(file, x, y, comp, req_comp, 0, callback, user);
+}
+
+int LoadImageFileRowsScaled(
+  ImageFile* file, int* x, int* y, int* comp, int req_comp, int scaleShift, stbi_row_callback callback, void* user)
+{
+  if (file->data)
+  {
+    return stbi_load_rows_scaled_from_memory(
+      file->data, (int)file->size, x, y, comp, req_comp, scaleShift, callback, user);
+  }
+
+  if (fseek(file->file, 0, SEEK_SET) != 0)
+    return 0;
+  return stbi_load_rows_scaled_from_file(file->file, x, y, comp, req_comp, scaleShift, callback, user);
+}
+
+float* LoadImageFileFloat(ImageFile* file, int* x, int* y)
+{
+  int comp;
+  if (file->data)
+  {
+    if (stbi_is_hdr_from_memory(file->data, (int)file->size))
+      return stbi_loadf_from_memory(file->data, (int)file->size, x, y, &comp, 3);
+  }
+  else
+  {
+    if (fseek(file->file, 0, SEEK_SET) != 0)
+      return NULL;
+    // stb_image restores the file position after checking the signature
+    if (stbi_is_hdr_from_file(file->file))
+      return stbi_loadf_from_file(file->file, x, y, &comp, 3);
+  }
+
+  // 8-bit images are widened to 16 bits, so every integer image is scaled the same way
+  stbi_us* wide = file->data
+    ? stbi_load_16_from_memory(file->data, (int)file->size, x, y, &comp, 3)
+    : stbi_load_from_file_16(file->file, x, y, &comp, 3);
+  if (!wide)
+    return NULL;
+
+  size_t count = (size_t)*x * *y * 3;
+  float* pixels = (float*)malloc(count * sizeof(float));
+  if (pixels)
+  {
+    for (size_t i = 0; i < count; i++)
+      pixels[i] = wide[i] / 65535.0f;
+  }
+  stbi_image_free(wide);
+  return pixels;
+}
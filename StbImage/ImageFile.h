@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdio.h>
+#include "stb_image.h"
+
+/** @brief An image file opened for decoding, either mapped into memory or read through stdio.
+ *
+ *  Files are mapped whenever possible, so stb_image decodes straight from the page cache rather
+ *  than through its small FILE* refill buffer. Files that cannot be mapped (empty, larger than
+ *  stb_image's int length, or on a file system without mapping support) are read through stdio.
+ *  An ImageFile can also wrap an image the caller already holds in memory.
+ */
+typedef struct
+{
+  stbi_uc const* data; // file contents, or NULL when reading through file
+  size_t size;
+  int mapped; // data is a view of the file, unmapped on close
+  FILE* file;
+} ImageFile;
+
+/** @brief Opens filename for decoding.
+ *
+ *  @param filename path to the image file
+ *  @param file receives the opened file
+ *  @return 1 on success, 0 if the file could not be opened
+ */
+int OpenImageFile(char const* filename, ImageFile* file);
+
+/** @brief Wraps an encoded image held in memory, which must outlive file.
+ *
+ *  @return 1 on success, 0 if size is beyond what stb_image can decode
+ */
+int OpenImageMemory(void const* buffer, size_t size, ImageFile* file);
+
+/** @brief Releases the mapping or FILE* held by file. */
+void CloseImageFile(ImageFile* file);
+
+/** @brief Reads the image header of file, as stbi_info does.
+ *
+ *  @param bitDepth receives 16 for 16-bit images and 8 otherwise; may be NULL
+ */
+int GetImageFileInfo(ImageFile* file, int* x, int* y, int* comp, int* bitDepth);
+
+/** @brief Decodes file from its start, as stbi_load_rows does.
+ *
+ *  May be called repeatedly on the same file.
+ */
+int LoadImageFileRows(
+  ImageFile* file, int* x, int* y, int* comp, int req_comp, stbi_row_callback callback, void* user);
+
+/** @brief Decodes file from its start as LoadImageFileRows does, with JPEGs reduced in the decoder.
+ *
+ *  JPEGs arrive at 1 / (1 << scaleShift) of their size, rounded up, as stbi_load_rows_scaled_from_memory
+ *  delivers them; other images arrive in full. x and y receive the size delivered.
+ *
+ *  @param scaleShift 0 to 3
+ */
+int LoadImageFileRowsScaled(
+  ImageFile* file, int* x, int* y, int* comp, int req_comp, int scaleShift, stbi_row_callback callback, void* user);
+
+/** @brief Decodes file in full to linear RGB floats, 3 per pixel.
+ *
+ *  Radiance HDR files keep their values; 8- and 16-bit files are scaled to [0, 1] without any
+ *  gamma conversion.
+ *
+ *  @return the pixels, to be freed with stbi_image_free, or NULL on failure
+ */
+float* LoadImageFileFloat(ImageFile* file, int* x, int* y);
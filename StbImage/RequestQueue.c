@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <windows.h>
+#include "RequestQueue.h"
+#include "ThreadPool.h"
+
+struct StbImageRequest
+{
+  volatile LONG refCount; // one reference for the caller's handle, one while queued or running
+  volatile LONG cancelled;
+  int status;
+  int priority;
+  RequestFunction function;
+  void* arguments;
+  StbImageRequestCallback callback;
+  void* userData;
+  StbImageRequest* next; // next pending request, in submission order
+};
+
+// guards the pending list and every request's status and priority
+static SRWLOCK queueLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE requestFinished = CONDITION_VARIABLE_INIT;
+static StbImageRequest* pendingHead;
+static StbImageRequest* pendingTail;
+
+static void ReleaseRequest(StbImageRequest* request)
+{
+  if (InterlockedDecrement(&request->refCount) == 0)
+  {
+    free(request->arguments);
+    free(request);
+  }
+}
+
+/** @brief Unlinks request from the pending list. Must be called with queueLock held. */
+static void RemovePendingRequest(StbImageRequest* request)
+{
+  StbImageRequest* previous = NULL;
+  for (StbImageRequest* current = pendingHead; current; previous = current, current = current->next)
+  {
+    if (current != request)
+      continue;
+
+    if (previous)
+      previous->next = current->next;
+    else
+      pendingHead = current->next;
+    if (pendingTail == current)
+      pendingTail = previous;
+    current->next = NULL;
+    return;
+  }
+}
+
+/** @brief Marks request as finished, runs its callback and wakes any waiters. */
+static void FinishRequest(StbImageRequest* request, int status)
+{
+  // the callback runs before the status is published, so a caller that waits for the request
+  // and then closes it never races with a callback that is still running
+  if (request->callback)
+    request->callback(request, status, request->userData);
+
+  AcquireSRWLockExclusive(&queueLock);
+  request->status = status;
+  ReleaseSRWLockExclusive(&queueLock);
+  WakeAllConditionVariable(&requestFinished);
+}
+
+/** @brief Pool callback: runs the highest-priority pending request, if any remain. */
+static void RunNextRequest(void* context)
+{
+  AcquireSRWLockExclusive(&queueLock);
+  StbImageRequest* request = pendingHead;
+  for (StbImageRequest* current = pendingHead; current; current = current->next)
+  {
+    if (current->priority > request->priority)
+      request = current;
+  }
+  if (request)
+  {
+    RemovePendingRequest(request);
+    request->status = STBIMAGE_REQUEST_RUNNING;
+  }
+  ReleaseSRWLockExclusive(&queueLock);
+
+  // one pool callback is queued per request, so if a request was cancelled while pending there is
+  // nothing left for this callback to do
+  if (!request)
+    return;
+
+  int succeeded = request->function(request->arguments, &request->cancelled);
+  if (request->cancelled)
+    FinishRequest(request, STBIMAGE_REQUEST_CANCELLED);
+  else
+    FinishRequest(request, succeeded ? STBIMAGE_REQUEST_COMPLETED : STBIMAGE_REQUEST_FAILED);
+  ReleaseRequest(request);
+}
+
+StbImageRequest* SubmitRequest(
+  RequestFunction function, void* arguments, int priority, StbImageRequestCallback callback, void* userData)
+{
+  StbImageRequest* request = (StbImageRequest*)calloc(1, sizeof(StbImageRequest));
+  if (!request)
+  {
+    free(arguments);
+    return NULL;
+  }
+
+  request->refCount = 2;
+  request->status = STBIMAGE_REQUEST_PENDING;
+  request->priority = priority;
+  request->function = function;
+  request->arguments = arguments;
+  request->callback = callback;
+  request->userData = userData;
+
+  AcquireSRWLockExclusive(&queueLock);
+  if (pendingTail)
+    pendingTail->next = request;
+  else
+    pendingHead = request;
+  pendingTail = request;
+  ReleaseSRWLockExclusive(&queueLock);
+
+  if (!QueueThreadPoolWork(RunNextRequest, NULL))
+  {
+    AcquireSRWLockExclusive(&queueLock);
+    RemovePendingRequest(request);
+    ReleaseSRWLockExclusive(&queueLock);
+    request->refCount = 1;
+    ReleaseRequest(request);
+    return NULL;
+  }
+
+  return request;
+}
+
+int GetRequestStatus(StbImageRequest* request)
+{
+  AcquireSRWLockShared(&queueLock);
+  int status = request->status;
+  ReleaseSRWLockShared(&queueLock);
+  return status;
+}
+
+int WaitForRequest(StbImageRequest* request)
+{
+  AcquireSRWLockShared(&queueLock);
+  while (request->status == STBIMAGE_REQUEST_PENDING || request->status == STBIMAGE_REQUEST_RUNNING)
+    SleepConditionVariableSRW(&requestFinished, &queueLock, INFINITE, CONDITION_VARIABLE_LOCKMODE_SHARED);
+  int status = request->status;
+  ReleaseSRWLockShared(&queueLock);
+  return status;
+}
+
+void CancelRequest(StbImageRequest* request)
+{
+  AcquireSRWLockExclusive(&queueLock);
+  InterlockedExchange(&request->cancelled, 1);
+  int wasPending = request->status == STBIMAGE_REQUEST_PENDING;
+  if (wasPending)
+  {
+    RemovePendingRequest(request);
+    request->status = STBIMAGE_REQUEST_RUNNING; // keeps waiters blocked until the callback has run
+  }
+  ReleaseSRWLockExclusive(&queueLock);
+
+  // a running request notices the flag and finishes as cancelled on its own thread
+  if (wasPending)
+  {
+    FinishRequest(request, STBIMAGE_REQUEST_CANCELLED);
+    ReleaseRequest(request);
+  }
+}
+
+void SetRequestPriority(StbImageRequest* request, int priority)
+{
+  AcquireSRWLockExclusive(&queueLock);
+  request->priority = priority;
+  ReleaseSRWLockExclusive(&queueLock);
+}
+
+void CloseRequest(StbImageRequest* request)
+{
+  if (request)
+    ReleaseRequest(request);
+}
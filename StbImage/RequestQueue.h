@@ -0,0 +1,24 @@
+#pragma once
+
+#include "StbImage.h"
+
+/** @brief Performs the work of an asynchronous request on a pool thread.
+ *
+ *  @param arguments the arguments block passed to SubmitRequest
+ *  @param cancelled becomes nonzero when the request is cancelled; long-running work should poll it and
+ *                   return early
+ *  @return nonzero on success
+ */
+typedef int (*RequestFunction)(void* arguments, volatile long const* cancelled);
+
+/** @brief Queues function to run on the worker pool once no higher-priority request is pending.
+ *
+ *  @param function the work to perform
+ *  @param arguments malloc'd arguments block, owned and freed by the request
+ *  @param priority requests with higher priority start first; equal priorities start in submission order
+ *  @param callback optional function invoked once the request finishes, fails or is cancelled
+ *  @param userData opaque pointer passed through to callback
+ *  @return the request handle, or NULL if the request could not be queued
+ */
+StbImageRequest* SubmitRequest(
+  RequestFunction function, void* arguments, int priority, StbImageRequestCallback callback, void* userData);
@@ -0,0 +1,89 @@
+#include <string.h>
+#include "SolidColor.h"
+
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define SOLID_COLOR_SSE2
+#include <emmintrin.h>
+#endif
+
+int GetSolidRGBABlock(unsigned char const* block, size_t stride, unsigned int* color)
+{
+  unsigned int first;
+  memcpy(&first, block, sizeof(first));
+
+#ifdef SOLID_COLOR_SSE2
+  __m128i pattern = _mm_set1_epi32((int)first);
+  __m128i equal = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i const*)block), pattern);
+  for (int y = 1; y < 4; y++)
+    equal = _mm_and_si128(equal, _mm_cmpeq_epi32(_mm_loadu_si128((__m128i const*)(block + stride * y)), pattern));
+  if (_mm_movemask_epi8(equal) != 0xFFFF)
+    return 0;
+#else
+  for (int y = 0; y < 4; y++)
+  {
+    unsigned int row[4];
+    memcpy(row, block + stride * y, sizeof(row));
+    if (row[0] != first || row[1] != first || row[2] != first || row[3] != first)
+      return 0;
+  }
+#endif
+
+  *color = first;
+  return 1;
+}
+
+int GetSolidGrayBlock(unsigned char const* block, size_t stride, unsigned int* color)
+{
+  unsigned int pattern = block[0] * 0x01010101u;
+  for (int y = 0; y < 4; y++)
+  {
+    unsigned int row;
+    memcpy(&row, block + stride * y, sizeof(row));
+    if (row != pattern)
+      return 0;
+  }
+
+  *color = block[0];
+  return 1;
+}
+
+int IsSolidImage(unsigned char const* pixels, size_t pixelCount, int channels)
+{
+  size_t size = pixelCount * channels;
+  if (size == 0)
+    return 0;
+
+  // the image repeats its first pixel, so byte i must equal byte i % channels of it
+  unsigned int first = channels == 1 ? pixels[0] * 0x01010101u : 0;
+  if (channels != 1)
+    memcpy(&first, pixels, sizeof(first));
+
+  size_t i = 0;
+#ifdef SOLID_COLOR_SSE2
+  __m128i pattern = _mm_set1_epi32((int)first);
+  for (; i + 64 <= size; i += 64)
+  {
+    __m128i equal = _mm_cmpeq_epi8(_mm_loadu_si128((__m128i const*)(pixels + i)), pattern);
+    equal = _mm_and_si128(equal, _mm_cmpeq_epi8(_mm_loadu_si128((__m128i const*)(pixels + i + 16)), pattern));
+    equal = _mm_and_si128(equal, _mm_cmpeq_epi8(_mm_loadu_si128((__m128i const*)(pixels + i + 32)), pattern));
+    equal = _mm_and_si128(equal, _mm_cmpeq_epi8(_mm_loadu_si128((__m128i const*)(pixels + i + 48)), pattern));
+    if (_mm_movemask_epi8(equal) != 0xFFFF)
+      return 0;
+  }
+#else
+  for (; i + 4 <= size; i += 4)
+  {
+    unsigned int word;
+    memcpy(&word, pixels + i, sizeof(word));
+    if (word != first)
+      return 0;
+  }
+#endif
+
+  for (; i < size; i++)
+  {
+    if (pixels[i] != pixels[i % channels])
+      return 0;
+  }
+  return 1;
+}
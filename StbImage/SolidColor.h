@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+
+/** @brief Tests whether the 16 pixels of a 4x4 RGBA block are all the same.
+ *
+ *  @param block the block's top-left pixel
+ *  @param stride bytes between rows of the image the block belongs to
+ *  @param color receives the block's pixel, its 4 bytes read as one unsigned int, if the block is solid
+ */
+int GetSolidRGBABlock(unsigned char const* block, size_t stride, unsigned int* color);
+
+/** @brief Tests whether the 16 pixels of a 4x4 single-channel block are all the same.
+ *
+ *  @param color receives the block's pixel if the block is solid
+ */
+int GetSolidGrayBlock(unsigned char const* block, size_t stride, unsigned int* color);
+
+/** @brief Tests whether every pixel of an image with rows packed without padding equals the first.
+ *
+ *  Stops at the first pixel that differs, so images with any detail are rejected almost at once.
+ *
+ *  @param channels bytes per pixel, 4 or 1
+ */
+int IsSolidImage(unsigned char const* pixels, size_t pixelCount, int channels);
@@ -1,12 +1,30 @@
 #include <memory.h>
+#include <string.h>
 #include "stb_dxt.h"
 #include "stb_image.h"
-#include "stb_image_resize.h"
+#include "Bc6hEncoder.h"
+#include "Bc7Encoder.h"
+#include "Downsample.h"
+#include "ImageFile.h"
+#include "RequestQueue.h"
+#include "SolidColor.h"
 #include "StbImage.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+
+void SetWorkerThreadCount(int threadCount)
+{
+  SetThreadPoolSize(threadCount);
+}
 
 int GetImageInfo(char const* filename, int* width, int* height, int* numComponents)
 {
-  return stbi_info(filename, width, height, numComponents);
+  ImageFile file;
+  if (!OpenImageFile(filename, &file))
+    return 0;
+  int result = GetImageFileInfo(&file, width, height, numComponents, NULL);
+  CloseImageFile(&file);
+  return result;
 }
 
 size_t GetBytesPerCompressedBlock(int format)
@@ -14,20 +32,30 @@ size_t GetBytesPerCompressedBlock(int format)
   switch (format)
   {
     case STBIMAGE_FORMAT_BC1:
+    case STBIMAGE_FORMAT_BC4:
       return 8;
     case STBIMAGE_FORMAT_BC3:
     case STBIMAGE_FORMAT_BC5:
+    case STBIMAGE_FORMAT_BC6H:
+    case STBIMAGE_FORMAT_BC7:
+    case STBIMAGE_FORMAT_BC7_FAST:
+    case STBIMAGE_FORMAT_BC7_SLOW:
       return 16;
     default:
       return 0;
   }
 }
 
-void GetRGBABlock(stbi_uc* img, int imgWidth, int imgHeight, unsigned char* dest, int blockX, int blockY)
+// bytes per pixel of the images a format is compressed from: BC4 is decoded to a single channel
+int GetBytesPerPixel(int format)
+{
+  return format == STBIMAGE_FORMAT_BC4 ? 1 : 4;
+}
+
+void GetRGBABlock(stbi_uc const* img, size_t stride, int imgWidth, int imgHeight, unsigned char* dest, int blockX, int blockY)
 {
   size_t pixelX = (size_t)blockX * 4;
   size_t pixelY = (size_t)blockY * 4;
-  size_t stride = (size_t)imgWidth * 4;
   size_t rowSize = pixelX + 4 <= imgWidth ? 16 : (imgWidth - pixelX) * 4;
   size_t rowCount = pixelY + 4 <= imgHeight ? 4 : imgHeight - pixelY;
 
@@ -38,224 +66,1079 @@ void GetRGBABlock(stbi_uc* img, int imgWidth, int imgHeight, unsigned char* dest
     memcpy_s(dest + i * 16, 16, img + stride * (pixelY + i) + pixelX * 4, rowSize);
 }
 
-/** @brief Extracts the red and green channels of a 4x4 block of pixels.
+void GetGrayBlock(stbi_uc const* img, size_t stride, int imgWidth, int imgHeight, unsigned char* dest, int blockX, int blockY)
+{
+  size_t pixelX = (size_t)blockX * 4;
+  size_t pixelY = (size_t)blockY * 4;
+  size_t rowSize = pixelX + 4 <= imgWidth ? 4 : imgWidth - pixelX;
+  size_t rowCount = pixelY + 4 <= imgHeight ? 4 : imgHeight - pixelY;
+
+  if (rowSize < 4 || rowCount < 4)
+    memset(dest, 0, 16);
+
+  for (size_t i = 0; i < rowCount; i++)
+    memcpy_s(dest + i * 4, 4, img + stride * (pixelY + i) + pixelX, rowSize);
+}
+
+// the compressed form of the last solid block a block loop produced, reused while its color repeats
+typedef struct
+{
+  int valid;
+  unsigned int color;
+  unsigned char block[16];
+} SolidBlockCache;
+
+/** @brief Tests whether the block at (blockX, blockY) is one color, without copying it.
  *
- *  @param img raw RGBA image data
- *  @param imgWidth width of img in pixels
- *  @param imgHeight height of img in pixels
- *  @param dest pointer to destination memory block of at least 32 bytes
- *  @param blockX the X coordinate of the block to read, where 0 is the left-most edge
- *  @param blockY the Y coordinate of the block to read, where 0 is the top-most edge
+ *  Blocks reaching past the image edge are padded with zeroes, so only whole blocks qualify.
  */
-void GetRGBlock(stbi_uc* img, int imgWidth, int imgHeight, unsigned char* dest, int blockX, int blockY)
+int GetSolidBlockColor(
+  stbi_uc const* img, size_t stride, int imgWidth, int imgHeight, int bytesPerPixel, int blockX, int blockY,
+  unsigned int* color)
 {
-  size_t pixelX = (size_t)blockX * 4; // left edge of block in pixel coordinates
-  size_t pixelY = (size_t)blockY * 4; // top edge of block in pixel coordinates
-  size_t stride = (size_t)imgWidth * 4; // bytes between rows of img
-  size_t rowLength = pixelX + 4 <= imgWidth ? 4 : imgWidth - pixelX;
-  size_t rowCount = pixelY + 4 <= imgHeight ? 4 : imgHeight - pixelY;
+  if (blockX * 4 + 4 > imgWidth || blockY * 4 + 4 > imgHeight)
+    return 0;
 
-  if (rowLength < 4 || rowCount < 4)
-    memset(dest, 0, 32);
+  stbi_uc const* block = img + stride * blockY * 4 + (size_t)blockX * 4 * bytesPerPixel;
+  return bytesPerPixel == 1 ? GetSolidGrayBlock(block, stride, color) : GetSolidRGBABlock(block, stride, color);
+}
 
-  for (size_t y = 0; y < rowCount; y++)
+/** @brief Compresses one 4x4 block, RGBA or, for BC4, single-channel. */
+void CompressBlock(unsigned char* dest, unsigned char const* pixels, int format)
+{
+  switch (format)
   {
-    unsigned char* rowDest = dest + 8 * y;
-    for (size_t x = 0; x < rowLength; x++)
-    {
-      *rowDest++ = *(img + stride * (pixelY + y) + 4 * (pixelX + x)    ); // red
-      *rowDest++ = *(img + stride * (pixelY + y) + 4 * (pixelX + x) + 1); // green
-    }
+    case STBIMAGE_FORMAT_BC1:
+      stb_compress_dxt_block(dest, pixels, /* alpha */ 0, STB_DXT_HIGHQUAL);
+      break;
+    case STBIMAGE_FORMAT_BC3:
+      stb_compress_dxt_block(dest, pixels, /* alpha */ 1, STB_DXT_HIGHQUAL);
+      break;
+    case STBIMAGE_FORMAT_BC4:
+      stb_compress_bc4_block(dest, pixels);
+      break;
+    case STBIMAGE_FORMAT_BC5:
+      stb_compress_bc5_block_rgba(dest, pixels);
+      break;
+    case STBIMAGE_FORMAT_BC7_FAST:
+      CompressBC7Block(dest, pixels, BC7_QUALITY_FAST);
+      break;
+    case STBIMAGE_FORMAT_BC7:
+      CompressBC7Block(dest, pixels, BC7_QUALITY_NORMAL);
+      break;
+    case STBIMAGE_FORMAT_BC7_SLOW:
+      CompressBC7Block(dest, pixels, BC7_QUALITY_SLOW);
+      break;
   }
 }
 
-void CompressToBC1(stbi_uc* img, int imgWidth, int imgHeight, unsigned char* dest)
+/** @brief Compresses block rows [firstBlockRow, endBlockRow) of an image or image region.
+ *
+ *  @param img the top-left pixel of the region, RGBA or, for BC4, single-channel
+ *  @param stride bytes between rows of img
+ *  @param imgWidth width of the region in pixels; blocks past the right edge are padded with zeroes
+ *  @param imgHeight height of the region in pixels; blocks past the bottom edge are padded with zeroes
+ *  @param dest where to write the region's first block
+ *  @param destBlockWidth blocks per row of the level dest belongs to
+ */
+void CompressBlockRowsToBCx(
+  stbi_uc const* img, size_t stride, int imgWidth, int imgHeight, int format,
+  unsigned char* dest, int destBlockWidth, int firstBlockRow, int endBlockRow)
 {
   int blockWidth = (imgWidth + 3) / 4;
-  int blockHeight = (imgHeight + 3) / 4;
-  unsigned char rgbaBlock[64];
+  int bytesPerPixel = GetBytesPerPixel(format);
+  size_t blockSize = GetBytesPerCompressedBlock(format);
+  unsigned char pixels[64];
+  SolidBlockCache solid = { 0 };
 
-  for (int blockY = 0; blockY < blockHeight; blockY++)
+  for (int blockY = firstBlockRow; blockY < endBlockRow; blockY++)
   {
     for (int blockX = 0; blockX < blockWidth; blockX++)
     {
-      GetRGBABlock(img, imgWidth, imgHeight, rgbaBlock, blockX, blockY);
-      int offset = ((blockWidth * blockY) + blockX) * 8;
-      stb_compress_dxt_block(dest + offset, rgbaBlock, /* alpha */ 0, STB_DXT_HIGHQUAL);
+      unsigned char* block = dest + (((size_t)destBlockWidth * blockY) + blockX) * blockSize;
+      unsigned int color;
+      int isSolid = GetSolidBlockColor(img, stride, imgWidth, imgHeight, bytesPerPixel, blockX, blockY, &color);
+      if (isSolid && solid.valid && solid.color == color)
+      {
+        memcpy(block, solid.block, blockSize);
+        continue;
+      }
+
+      if (bytesPerPixel == 1)
+        GetGrayBlock(img, stride, imgWidth, imgHeight, pixels, blockX, blockY);
+      else
+        GetRGBABlock(img, stride, imgWidth, imgHeight, pixels, blockX, blockY);
+      CompressBlock(block, pixels, format);
+      if (isSolid)
+      {
+        solid.valid = 1;
+        solid.color = color;
+        memcpy(solid.block, block, blockSize);
+      }
     }
   }
 }
 
-void CompressToBC3(stbi_uc* img, int imgWidth, int imgHeight, unsigned char* dest)
+// smallest number of blocks handed to a worker at once; below this, scheduling costs more than it saves
+#define MIN_BLOCKS_PER_TASK 256
+
+typedef struct
+{
+  stbi_uc* img;
+  int imgWidth;
+  int imgHeight;
+  int format;
+  unsigned char* dest;
+  int blockRowsPerTask;
+  int blockHeight;
+  volatile long const* cancelled;
+} CompressTask;
+
+void CompressTaskCallback(void* context, int index)
+{
+  CompressTask* task = (CompressTask*)context;
+  if (task->cancelled && *task->cancelled)
+    return;
+
+  int firstBlockRow = index * task->blockRowsPerTask;
+  int endBlockRow = min(firstBlockRow + task->blockRowsPerTask, task->blockHeight);
+  CompressBlockRowsToBCx(
+    task->img, (size_t)task->imgWidth * GetBytesPerPixel(task->format), task->imgWidth, task->imgHeight, task->format,
+    task->dest, (task->imgWidth + 3) / 4, firstBlockRow, endBlockRow);
+}
+
+/** @brief Compresses an image whose pixels are all the same by replicating one compressed block.
+ *
+ *  Only the partial blocks along the right and bottom edges, which are padded with zeroes, are
+ *  compressed individually.
+ *
+ *  @return 0, having written nothing, if the image is not one color
+ */
+int CompressSolidImage(stbi_uc const* img, int imgWidth, int imgHeight, int format, unsigned char* dest)
 {
+  int bytesPerPixel = GetBytesPerPixel(format);
+  if (!IsSolidImage(img, (size_t)imgWidth * imgHeight, bytesPerPixel))
+    return 0;
+
+  size_t stride = (size_t)imgWidth * bytesPerPixel;
+  size_t blockSize = GetBytesPerCompressedBlock(format);
+  int destBlockWidth = (imgWidth + 3) / 4;
+  int wholeBlockWidth = imgWidth / 4;
+  int wholeBlockHeight = imgHeight / 4;
+
+  if (wholeBlockWidth > 0 && wholeBlockHeight > 0)
+  {
+    // the top-left block stands for every whole block; fill its row, then copy the row down
+    CompressBlockRowsToBCx(img, stride, 4, 4, format, dest, destBlockWidth, 0, 1);
+    for (int blockX = 1; blockX < wholeBlockWidth; blockX++)
+      memcpy(dest + blockX * blockSize, dest, blockSize);
+    for (int blockY = 1; blockY < wholeBlockHeight; blockY++)
+      memcpy(dest + (size_t)blockY * destBlockWidth * blockSize, dest, wholeBlockWidth * blockSize);
+  }
+
+  if (wholeBlockWidth < destBlockWidth)
+  {
+    CompressBlockRowsToBCx(
+      img + wholeBlockWidth * 4 * bytesPerPixel, stride, imgWidth - wholeBlockWidth * 4, imgHeight, format,
+      dest + wholeBlockWidth * blockSize, destBlockWidth, 0, wholeBlockHeight);
+  }
+  if (wholeBlockHeight < (imgHeight + 3) / 4)
+  {
+    CompressBlockRowsToBCx(
+      img, stride, imgWidth, imgHeight, format, dest, destBlockWidth, wholeBlockHeight, wholeBlockHeight + 1);
+  }
+  return 1;
+}
+
+/** @brief Compresses an image, splitting its block rows across the worker pool.
+ *
+ *  Every block is compressed independently, so the output is identical regardless of how
+ *  many threads take part. If cancelled is not NULL and becomes nonzero, the remaining block rows are
+ *  skipped. Images of a single color skip the pool and are filled by CompressSolidImage.
+ */
+void CompressToBCx(
+  stbi_uc* img, int imgWidth, int imgHeight, int format, unsigned char* dest, volatile long const* cancelled)
+{
+  if (CompressSolidImage(img, imgWidth, imgHeight, format, dest))
+    return;
+
   int blockWidth = (imgWidth + 3) / 4;
   int blockHeight = (imgHeight + 3) / 4;
-  unsigned char rgbaBlock[64];
+  int blockRowsPerTask = max(1, MIN_BLOCKS_PER_TASK / blockWidth);
+  int taskCount = (blockHeight + blockRowsPerTask - 1) / blockRowsPerTask;
+
+  CompressTask task = { img, imgWidth, imgHeight, format, dest, blockRowsPerTask, blockHeight, cancelled };
+  ParallelFor(taskCount, CompressTaskCallback, &task);
+}
+
+typedef struct
+{
+  int width;
+  int height;
+  int blockWidth;
+  unsigned char* dest; // first compressed block of the level
+} MipmapLevel;
+
+#define MAX_MIPMAP_LEVELS STBIMAGE_MAX_MIPMAP_LEVELS
+
+size_t GetMipmapLayout(
+  int width, int height, int format, int maxLevels, StbImageMipmapLevel* levels, int* levelCount)
+{
+  size_t bytesPerBlock = GetBytesPerCompressedBlock(format);
+  if (format != STBIMAGE_FORMAT_RGBA && bytesPerBlock == 0)
+    return 0;
+  if (maxLevels <= 0 || maxLevels > MAX_MIPMAP_LEVELS)
+    maxLevels = MAX_MIPMAP_LEVELS;
 
-  for (int blockY = 0; blockY < blockHeight; blockY++)
+  size_t totalSize = 0;
+  int count = 0;
+  int mipmapWidth = width;
+  int mipmapHeight = height;
+  while (count < maxLevels && mipmapWidth > 0 && mipmapHeight > 0)
   {
-    for (int blockX = 0; blockX < blockWidth; blockX++)
+    size_t mipmapSize = format == STBIMAGE_FORMAT_RGBA
+      ? (size_t)mipmapWidth * mipmapHeight * 4
+      : (size_t)((mipmapWidth + 3) / 4) * ((mipmapHeight + 3) / 4) * bytesPerBlock;
+    if (levels)
     {
-      GetRGBABlock(img, imgWidth, imgHeight, rgbaBlock, blockX, blockY);
-      int offset = ((blockWidth * blockY) + blockX) * 16;
-      stb_compress_dxt_block(dest + offset, rgbaBlock, /* alpha */ 1, STB_DXT_HIGHQUAL);
+      StbImageMipmapLevel level = { mipmapWidth, mipmapHeight, totalSize, mipmapSize };
+      levels[count] = level;
+    }
+    totalSize += mipmapSize;
+    count++;
+
+    if (format == STBIMAGE_FORMAT_RGBA)
+    {
+      if (mipmapWidth == 1 && mipmapHeight == 1)
+        break;
+      mipmapWidth = (mipmapWidth > 1) ? mipmapWidth >> 1 : 1;
+      mipmapHeight = (mipmapHeight > 1) ? mipmapHeight >> 1 : 1;
+    }
+    else
+    {
+      mipmapWidth >>= 1;
+      mipmapHeight >>= 1;
     }
   }
+
+  if (levelCount)
+    *levelCount = count;
+  return totalSize;
 }
 
-void CompressToBC5(stbi_uc* img, int imgWidth, int imgHeight, unsigned char* dest)
+/** @brief Lays out the compressed mipmap chain of an image in dest.
+ *
+ *  Follows GetMipmapLayout, stopping at the first level that would not fit in destSize.
+ *
+ *  @return the number of levels filled in
+ */
+int GetMipmapLevels(
+  int imgWidth, int imgHeight, int format, unsigned char* dest, size_t destSize, MipmapLevel* levels)
 {
-  int blockWidth = (imgWidth + 3) / 4;
-  int blockHeight = (imgHeight + 3) / 4;
-  unsigned char rgBlock[32];
+  StbImageMipmapLevel layout[MAX_MIPMAP_LEVELS];
+  int layoutCount;
+  GetMipmapLayout(imgWidth, imgHeight, format, 0, layout, &layoutCount);
 
-  for (int blockY = 0; blockY < blockHeight; blockY++)
+  int levelCount = 0;
+  while (levelCount < layoutCount && layout[levelCount].offset + layout[levelCount].size <= destSize)
   {
-    for (int blockX = 0; blockX < blockWidth; blockX++)
+    MipmapLevel level =
+      { layout[levelCount].width, layout[levelCount].height, (layout[levelCount].width + 3) / 4, dest + layout[levelCount].offset };
+    levels[levelCount++] = level;
+  }
+  return levelCount;
+}
+
+// edge of a square tile, in pixels of the first level of a fused pass; a tile at 64x64 RGBA
+// is 16KB, so it and its smaller levels stay in L1/L2 from downsampling through compression
+#define FUSED_TILE_SIZE 64
+// levels produced per fused pass; the last level's tile must still be a whole number of blocks
+#define MAX_FUSED_LEVELS 5
+
+/** @brief Returns how many levels, starting at levels[0], can be produced tile by tile.
+ *
+ *  Tiling only reproduces the whole-level result when every level but the last is exactly
+ *  halved into the next, so the run stops at the first level with an odd dimension.
+ */
+int GetFusedLevelCount(MipmapLevel const* levels, int levelCount)
+{
+  int fusedCount = 1;
+  while (fusedCount < MAX_FUSED_LEVELS && fusedCount < levelCount
+    && levels[fusedCount - 1].width % 2 == 0 && levels[fusedCount - 1].height % 2 == 0)
+  {
+    fusedCount++;
+  }
+  return fusedCount;
+}
+
+typedef struct
+{
+  stbi_uc const* source; // first level, full size
+  stbi_uc* lastLevel; // receives the last level, full size
+  MipmapLevel const* levels;
+  int levelCount;
+  int format;
+  int tileColumns;
+  volatile long const* cancelled;
+} FusedTask;
+
+void FusedTaskCallback(void* context, int index)
+{
+  FusedTask* task = (FusedTask*)context;
+  if (task->cancelled && *task->cancelled)
+    return;
+
+  MipmapLevel const* levels = task->levels;
+  size_t bytesPerBlock = GetBytesPerCompressedBlock(task->format);
+  int bytesPerPixel = GetBytesPerPixel(task->format);
+  int tileX = (index % task->tileColumns) * FUSED_TILE_SIZE;
+  int tileY = (index / task->tileColumns) * FUSED_TILE_SIZE;
+  int tileWidth = min(FUSED_TILE_SIZE, levels[0].width - tileX);
+  int tileHeight = min(FUSED_TILE_SIZE, levels[0].height - tileY);
+
+  // intermediate levels of the tile, alternating between two buffers
+  unsigned char tileBuffers[2][(FUSED_TILE_SIZE / 2) * (FUSED_TILE_SIZE / 2) * 4];
+
+  size_t stride = (size_t)levels[0].width * bytesPerPixel;
+  stbi_uc const* region = task->source + stride * tileY + (size_t)tileX * bytesPerPixel;
+  for (int i = 0; i < task->levelCount; i++)
+  {
+    int x = tileX >> i;
+    int y = tileY >> i;
+    int width = tileWidth >> i;
+    int height = tileHeight >> i;
+
+    unsigned char* dest = levels[i].dest + ((size_t)levels[i].blockWidth * (y / 4) + x / 4) * bytesPerBlock;
+    CompressBlockRowsToBCx(region, stride, width, height, task->format, dest, levels[i].blockWidth, 0, (height + 3) / 4);
+
+    if (i + 1 == task->levelCount)
+      break;
+
+    unsigned char* next;
+    size_t nextStride;
+    if (i + 2 == task->levelCount)
     {
-      GetRGBlock(img, imgWidth, imgHeight, rgBlock, blockX, blockY);
-      int offset = ((blockWidth * blockY) + blockX) * 16;
-      stb_compress_bc5_block(dest + offset, rgBlock);
+      nextStride = (size_t)levels[i + 1].width * bytesPerPixel;
+      next = task->lastLevel + nextStride * (y / 2) + (size_t)(x / 2) * bytesPerPixel;
     }
+    else
+    {
+      nextStride = (size_t)(width / 2) * bytesPerPixel;
+      next = tileBuffers[i % 2];
+    }
+
+    for (int row = 0; row < height / 2; row++)
+      HalveRow(region + stride * 2 * row, region + stride * (2 * row + 1), next + nextStride * row, width / 2, bytesPerPixel);
+
+    region = next;
+    stride = nextStride;
   }
 }
 
-void CompressToBCx(stbi_uc* img, int imgWidth, int imgHeight, int format, unsigned char* dest)
+/** @brief Downsamples and compresses levelCount levels in one pass over the first level.
+ *
+ *  The first level is split into tiles that are independently halved and compressed down to
+ *  the last level, which is also stored in full in lastLevel so the chain can continue from it.
+ *  Requires every level but the last to have even dimensions (see GetFusedLevelCount).
+ */
+void CompressFusedLevels(
+  stbi_uc const* source, stbi_uc* lastLevel, MipmapLevel const* levels, int levelCount, int format,
+  volatile long const* cancelled)
 {
-  switch (format)
+  int tileColumns = (levels[0].width + FUSED_TILE_SIZE - 1) / FUSED_TILE_SIZE;
+  int tileRows = (levels[0].height + FUSED_TILE_SIZE - 1) / FUSED_TILE_SIZE;
+
+  FusedTask task = { source, lastLevel, levels, levelCount, format, tileColumns, cancelled };
+  ParallelFor(tileColumns * tileRows, FusedTaskCallback, &task);
+}
+
+/** @brief Compresses levels[0] from source, then builds and compresses the rest of the chain.
+ *
+ *  source and spare are overwritten as levels are produced; spare must hold at least a quarter
+ *  of source. If cancelled is not NULL and becomes nonzero, the remaining levels are skipped.
+ */
+void CompressMipmapChain(
+  stbi_uc* source, stbi_uc* spare, MipmapLevel const* levels, int levelCount, int format,
+  volatile long const* cancelled)
+{
+  // source always holds the full-size level about to be compressed; spare receives the next one
+  int level = 0;
+  while (level < levelCount && !(cancelled && *cancelled))
   {
-    case STBIMAGE_FORMAT_BC1:
-      CompressToBC1(img, imgWidth, imgHeight, dest);
-      break;
-    case STBIMAGE_FORMAT_BC3:
-      CompressToBC3(img, imgWidth, imgHeight, dest);
-      break;
-    case STBIMAGE_FORMAT_BC5:
-      CompressToBC5(img, imgWidth, imgHeight, dest);
-      break;
+    int fusedCount = GetFusedLevelCount(levels + level, levelCount - level);
+    if (fusedCount == 1)
+    {
+      CompressToBCx(source, levels[level].width, levels[level].height, format, levels[level].dest, cancelled);
+    }
+    else
+    {
+      CompressFusedLevels(source, spare, levels + level, fusedCount, format, cancelled);
+      stbi_uc* swap = source;
+      source = spare;
+      spare = swap;
+    }
+    level += fusedCount;
+
+    if (level < levelCount)
+    {
+      DownsampleImage(
+        source, levels[level - 1].width, levels[level - 1].height,
+        spare, levels[level].width, levels[level].height, GetBytesPerPixel(format));
+      stbi_uc* swap = source;
+      source = spare;
+      spare = swap;
+    }
   }
 }
 
-size_t CompressMipmapFullScale(
-  stbi_uc* img, int imgWidth, int imgHeight, int format,
-  unsigned char* scaleBuf, unsigned char* dest, size_t destSize, int mipmapLevel)
+// rows of each level gathered before they are compressed; a multiple of the block height
+#define STREAM_BAND_ROWS 32
+
+typedef struct
+{
+  int format;
+  int flipVertically; // rows arrive bottom to top
+  unsigned char* dest;
+  size_t destSize;
+  MipmapLevel levels[MAX_MIPMAP_LEVELS];
+  int levelCount;
+  int streamedCount; // levels built row by row as the image is decoded
+  stbi_uc* rows[MAX_MIPMAP_LEVELS]; // STREAM_BAND_ROWS rows of each streamed level
+  stbi_uc* lastLevel; // the last streamed level in full, when the chain continues past it
+  volatile long const* cancelled;
+} RowStream;
+
+stbi_uc* GetStreamRow(RowStream* stream, int level, int row)
+{
+  size_t stride = (size_t)stream->levels[level].width * GetBytesPerPixel(stream->format);
+  if (stream->lastLevel && level == stream->streamedCount - 1)
+    return stream->lastLevel + stride * row;
+  return stream->rows[level] + stride * (row % STREAM_BAND_ROWS);
+}
+
+/** @brief Passes a newly stored row of a streamed level down the chain.
+ *
+ *  Every second row completes a row of the next level, and the last row of a band to arrive
+ *  completes the band, which is then compressed. Rows arrive in order (bottom to top when
+ *  flipping), so a band is never needed again once it has been compressed.
+ */
+void StreamRowStored(RowStream* stream, int level, int row)
 {
-  int mipmapWidth = imgWidth >> mipmapLevel;
-  int mipmapHeight = imgHeight >> mipmapLevel;
-  if (mipmapWidth == 0 || mipmapHeight == 0)
-    return 0;
+  MipmapLevel const* mipmap = &stream->levels[level];
 
-  int mipmapBlockWidth = (mipmapWidth + 3) / 4;
-  int mipmapBlockHeight = (mipmapHeight + 3) / 4;
-  size_t mipmapCompressedSize = mipmapBlockHeight * mipmapBlockWidth * GetBytesPerCompressedBlock(format);
-  if (mipmapCompressedSize > destSize)
-    return 0;
+  if (level + 1 < stream->streamedCount && row % 2 == (stream->flipVertically ? 0 : 1))
+  {
+    int pairRow = row & ~1;
+    HalveRow(
+      GetStreamRow(stream, level, pairRow), GetStreamRow(stream, level, pairRow + 1),
+      GetStreamRow(stream, level + 1, pairRow / 2), stream->levels[level + 1].width,
+      GetBytesPerPixel(stream->format));
+    StreamRowStored(stream, level + 1, pairRow / 2);
+  }
 
-  if (mipmapLevel == 0)
-    scaleBuf = img;
-  else
+  int firstRow = row - row % STREAM_BAND_ROWS;
+  int endRow = min(firstRow + STREAM_BAND_ROWS, mipmap->height);
+  if (row == (stream->flipVertically ? firstRow : endRow - 1))
   {
-    stbir_resize_uint8(
-      img, imgWidth, imgHeight, 0,
-      scaleBuf, mipmapWidth, mipmapHeight, 0, 4);
+    unsigned char* dest = mipmap->dest + (size_t)mipmap->blockWidth * (firstRow / 4) * GetBytesPerCompressedBlock(stream->format);
+    CompressToBCx(
+      GetStreamRow(stream, level, firstRow), mipmap->width, endRow - firstRow, stream->format, dest, stream->cancelled);
   }
+}
 
-  CompressToBCx(scaleBuf, mipmapWidth, mipmapHeight, format, dest);
+/** @brief Sets up the levels and row buffers of a stream once the image size is known.
+ *
+ *  Levels are streamed for as long as each is exactly half the size of the one before it; the
+ *  last streamed level is kept in full if the chain continues past it, so the remaining levels
+ *  can be built from it with the whole-level path.
+ */
+int BeginRowStream(RowStream* stream, int imgWidth, int imgHeight)
+{
+  stream->levelCount =
+    GetMipmapLevels(imgWidth, imgHeight, stream->format, stream->dest, stream->destSize, stream->levels);
+  stream->streamedCount = stream->levelCount > 0 ? 1 : 0;
+  while (stream->streamedCount < stream->levelCount
+    && stream->levels[stream->streamedCount - 1].width % 2 == 0
+    && stream->levels[stream->streamedCount - 1].height % 2 == 0)
+  {
+    stream->streamedCount++;
+  }
 
-  return mipmapCompressedSize;
+  int bytesPerPixel = GetBytesPerPixel(stream->format);
+  for (int i = 0; i < stream->streamedCount; i++)
+  {
+    MipmapLevel const* mipmap = &stream->levels[i];
+    if (i == stream->streamedCount - 1 && stream->streamedCount < stream->levelCount)
+    {
+      stream->lastLevel = (stbi_uc*)malloc((size_t)mipmap->width * mipmap->height * bytesPerPixel);
+      if (!stream->lastLevel)
+        return 0;
+    }
+    else
+    {
+      stream->rows[i] = (stbi_uc*)malloc((size_t)mipmap->width * min(mipmap->height, STREAM_BAND_ROWS) * bytesPerPixel);
+      if (!stream->rows[i])
+        return 0;
+    }
+  }
+  return 1;
 }
 
-size_t CompressMipmapRepeated(
-  stbi_uc* img, int imgWidth, int imgHeight, int format,
-  unsigned char* scaleBuf, unsigned char* dest, size_t destSize, int mipmapLevel)
+int StreamRowCallback(void* user, stbi_uc const* row, int y, int width, int height)
 {
-  int sourceMipmapLevel = mipmapLevel - 1;
-  int sourceWidth = imgWidth >> sourceMipmapLevel;
-  int sourceHeight = imgHeight >> sourceMipmapLevel;
-  int mipmapWidth = imgWidth >> mipmapLevel;
-  int mipmapHeight = imgHeight >> mipmapLevel;
-  if (mipmapWidth == 0 || mipmapHeight == 0)
+  RowStream* stream = (RowStream*)user;
+  if (stream->cancelled && *stream->cancelled)
+    return 0;
+  if (y == 0 && !BeginRowStream(stream, width, height))
     return 0;
+  if (stream->streamedCount == 0)
+    return 1;
+
+  int destRow = stream->flipVertically ? height - 1 - y : y;
+  memcpy(GetStreamRow(stream, 0, destRow), row, (size_t)width * GetBytesPerPixel(stream->format));
+  StreamRowStored(stream, 0, destRow);
+  return 1;
+}
+
+void GetFloatBlock(float const* img, int imgWidth, int imgHeight, float* dest, int blockX, int blockY)
+{
+  size_t pixelX = (size_t)blockX * 4;
+  size_t pixelY = (size_t)blockY * 4;
+  size_t rowSize = (pixelX + 4 <= imgWidth ? 4 : imgWidth - pixelX) * 3 * sizeof(float);
+  size_t rowCount = pixelY + 4 <= imgHeight ? 4 : imgHeight - pixelY;
+
+  if (rowSize < 12 * sizeof(float) || rowCount < 4)
+    memset(dest, 0, 48 * sizeof(float));
+
+  for (size_t i = 0; i < rowCount; i++)
+    memcpy_s(dest + i * 12, 12 * sizeof(float), img + ((pixelY + i) * imgWidth + pixelX) * 3, rowSize);
+}
 
-  int mipmapBlockWidth = (mipmapWidth + 3) / 4;
-  int mipmapBlockHeight = (mipmapHeight + 3) / 4;
-  size_t mipmapCompressedSize = mipmapBlockHeight * mipmapBlockWidth * GetBytesPerCompressedBlock(format);
-  if (mipmapCompressedSize > destSize)
+typedef struct
+{
+  float const* img;
+  int imgWidth;
+  int imgHeight;
+  unsigned char* dest;
+  int blockRowsPerTask;
+  int blockHeight;
+  volatile long const* cancelled;
+} CompressFloatTask;
+
+void CompressFloatTaskCallback(void* context, int index)
+{
+  CompressFloatTask* task = (CompressFloatTask*)context;
+  if (task->cancelled && *task->cancelled)
+    return;
+
+  int blockWidth = (task->imgWidth + 3) / 4;
+  int firstBlockRow = index * task->blockRowsPerTask;
+  int endBlockRow = min(firstBlockRow + task->blockRowsPerTask, task->blockHeight);
+  float block[48];
+
+  for (int blockY = firstBlockRow; blockY < endBlockRow; blockY++)
+  {
+    for (int blockX = 0; blockX < blockWidth; blockX++)
+    {
+      GetFloatBlock(task->img, task->imgWidth, task->imgHeight, block, blockX, blockY);
+      size_t offset = (((size_t)blockWidth * blockY) + blockX) * 16;
+      CompressBC6HBlock(task->dest + offset, block);
+    }
+  }
+}
+
+/** @brief Compresses an RGB float image to BC6H, splitting its block rows across the worker pool. */
+void CompressToBC6H(
+  float const* img, int imgWidth, int imgHeight, unsigned char* dest, volatile long const* cancelled)
+{
+  int blockWidth = (imgWidth + 3) / 4;
+  int blockHeight = (imgHeight + 3) / 4;
+  int blockRowsPerTask = max(1, MIN_BLOCKS_PER_TASK / blockWidth);
+  int taskCount = (blockHeight + blockRowsPerTask - 1) / blockRowsPerTask;
+
+  CompressFloatTask task = { img, imgWidth, imgHeight, dest, blockRowsPerTask, blockHeight, cancelled };
+  ParallelFor(taskCount, CompressFloatTaskCallback, &task);
+}
+
+/** @brief Loads an image as linear floats and writes its BC6H mipmap chain to dest.
+ *
+ *  Unlike the 8-bit formats, the image is decoded in full before the chain is built, and every
+ *  level is downsampled from the one before it in float. The chain starts scaleLevel levels below
+ *  the full image. Other arguments and the result are those of LoadImageFileAsBCx.
+ */
+int LoadImageFileAsBC6H(
+  ImageFile* file, int flipVertically, int scaleLevel, unsigned char* dest, size_t destSize,
+  volatile long const* cancelled, size_t* compressedSize)
+{
+  int imgWidth, imgHeight;
+  float* loaded = LoadImageFileFloat(file, &imgWidth, &imgHeight);
+  if (!loaded)
     return 0;
 
-  stbi_uc* scaleSource = mipmapLevel % 2 == 1 ? img : scaleBuf;
-  stbi_uc* scaleDest = mipmapLevel % 2 == 1 ? scaleBuf : img;
-  if (mipmapLevel == 0)
+  if (scaleLevel > 0)
+  {
+    int scaledWidth = max(1, imgWidth >> scaleLevel);
+    int scaledHeight = max(1, imgHeight >> scaleLevel);
+    float* scaled = (float*)malloc((size_t)scaledWidth * scaledHeight * 3 * sizeof(float));
+    if (scaled)
+      DownsampleFloatImage(loaded, imgWidth, imgHeight, scaled, scaledWidth, scaledHeight);
+    stbi_image_free(loaded);
+    if (!scaled)
+      return 0;
+    // scaled is released with stbi_image_free below, which is free
+    loaded = scaled;
+    imgWidth = scaledWidth;
+    imgHeight = scaledHeight;
+  }
+
+  if (flipVertically)
   {
-    // skip scaling, just use img directly as the compression source
-    scaleDest = img;
+    size_t rowLength = (size_t)imgWidth * 3;
+    for (int y = 0; y < imgHeight / 2; y++)
+    {
+      float* top = loaded + rowLength * y;
+      float* bottom = loaded + rowLength * (imgHeight - 1 - y);
+      for (size_t i = 0; i < rowLength; i++)
+      {
+        float swap = top[i];
+        top[i] = bottom[i];
+        bottom[i] = swap;
+      }
+    }
   }
-  else
+
+  MipmapLevel levels[MAX_MIPMAP_LEVELS];
+  int levelCount = GetMipmapLevels(imgWidth, imgHeight, STBIMAGE_FORMAT_BC6H, dest, destSize, levels);
+
+  // the levels alternate between the loaded image and a buffer the size of the second level
+  float* spare = levelCount > 1 ? (float*)malloc((size_t)levels[1].width * levels[1].height * 3 * sizeof(float)) : NULL;
+  int result = levelCount <= 1 || spare;
+  float* source = loaded;
+  float* next = spare;
+  for (int level = 0; result && level < levelCount && !(cancelled && *cancelled); level++)
   {
-    stbir_resize_uint8(
-      scaleSource, sourceWidth, sourceHeight, 0,
-      scaleDest, mipmapWidth, mipmapHeight, 0, 4);
+    if (level > 0)
+    {
+      DownsampleFloatImage(
+        source, levels[level - 1].width, levels[level - 1].height, next, levels[level].width, levels[level].height);
+      float* swap = source;
+      source = next;
+      next = swap;
+    }
+    CompressToBC6H(source, levels[level].width, levels[level].height, levels[level].dest, cancelled);
   }
 
-  CompressToBCx(scaleDest, mipmapWidth, mipmapHeight, format, dest);
+  free(spare);
+  stbi_image_free(loaded);
 
-  return mipmapCompressedSize;
+  if (compressedSize)
+    *compressedSize =
+      levelCount > 0 ? GetMipmapLayout(imgWidth, imgHeight, STBIMAGE_FORMAT_BC6H, levelCount, NULL, NULL) : 0;
+  return result && !(cancelled && *cancelled);
 }
 
-int ReadImageAsBCx(char const* filename, int flipVertically, int format, unsigned char* dest, size_t destSize)
+/** @brief Loads an image and writes its compressed mipmap chain to dest.
+ *
+ *  The image is handed over by stb_image a row at a time: each level that is exactly half the one
+ *  above it is built and compressed in bands as the rows arrive, so a sequential JPEG never
+ *  exists in memory as a whole. Flipping only changes where each incoming row is stored. If
+ *  cancelled is not NULL and becomes nonzero, stops early and returns 0. If compressedSize is not
+ *  NULL, it receives the number of bytes of dest filled with levels.
+ */
+int LoadImageFileAsBCx(
+  ImageFile* file, int flipVertically, int format, unsigned char* dest, size_t destSize,
+  volatile long const* cancelled, size_t* compressedSize)
 {
+  if (format == STBIMAGE_FORMAT_BC6H)
+    return LoadImageFileAsBC6H(file, flipVertically, 0, dest, destSize, cancelled, compressedSize);
+
   switch (format)
   {
     case STBIMAGE_FORMAT_BC1:
     case STBIMAGE_FORMAT_BC3:
+    case STBIMAGE_FORMAT_BC4:
     case STBIMAGE_FORMAT_BC5:
+    case STBIMAGE_FORMAT_BC7:
+    case STBIMAGE_FORMAT_BC7_FAST:
+    case STBIMAGE_FORMAT_BC7_SLOW:
       break;
     default:
       return 0;
   }
 
+  RowStream stream = { 0 };
+  stream.format = format;
+  stream.flipVertically = flipVertically;
+  stream.dest = dest;
+  stream.destSize = destSize;
+  stream.cancelled = cancelled;
+
   int imgWidth, imgHeight, channels_in_file;
-  stbi_set_flip_vertically_on_load(flipVertically);
-  stbi_uc* img = stbi_load(filename, &imgWidth, &imgHeight, &channels_in_file, 4);
-  if (!img)
-    return 0;
+  int bytesPerPixel = GetBytesPerPixel(format);
+  int loaded =
+    LoadImageFileRows(file, &imgWidth, &imgHeight, &channels_in_file, bytesPerPixel, StreamRowCallback, &stream);
 
-  stbi_uc* scaleBuf =
-    (stbi_uc*)malloc((size_t)imgWidth * (size_t)imgHeight / 2 /* 50% width */ / 2 /* 50% height */ * 4 /* channels */);
-  if (!scaleBuf)
+  if (loaded && stream.streamedCount < stream.levelCount && !(cancelled && *cancelled))
   {
-    stbi_image_free(img);
+    // continue the chain from the last streamed level with the whole-level path
+    MipmapLevel const* last = &stream.levels[stream.streamedCount - 1];
+    MipmapLevel const* next = &stream.levels[stream.streamedCount];
+    stbi_uc* source = (stbi_uc*)malloc((size_t)next->width * next->height * bytesPerPixel);
+    if (source)
+    {
+      DownsampleImage(stream.lastLevel, last->width, last->height, source, next->width, next->height, bytesPerPixel);
+      CompressMipmapChain(
+        source, stream.lastLevel, next, stream.levelCount - stream.streamedCount, format, cancelled);
+      free(source);
+    }
+    else
+    {
+      loaded = 0;
+    }
+  }
+
+  for (int i = 0; i < MAX_MIPMAP_LEVELS; i++)
+    free(stream.rows[i]);
+  free(stream.lastLevel);
+
+  if (compressedSize)
+    *compressedSize =
+      stream.levelCount > 0 ? GetMipmapLayout(imgWidth, imgHeight, format, stream.levelCount, NULL, NULL) : 0;
+  return loaded && !(cancelled && *cancelled);
+}
+
+int LoadImageAsBCx(
+  char const* filename, int flipVertically, int format, unsigned char* dest, size_t destSize,
+  volatile long const* cancelled)
+{
+  TextureCacheKey cacheKey;
+  int cached = GetTextureCacheKey(filename, flipVertically, format, destSize, &cacheKey);
+  if (cached && ReadCachedTexture(&cacheKey, dest, destSize))
+    return 1;
+
+  ImageFile file;
+  if (!OpenImageFile(filename, &file))
     return 0;
+  size_t compressedSize;
+  int result = LoadImageFileAsBCx(&file, flipVertically, format, dest, destSize, cancelled, &compressedSize);
+  CloseImageFile(&file);
+
+  if (result && cached)
+    WriteCachedTexture(&cacheKey, dest, compressedSize);
+  return result;
+}
+
+int ReadImageAsBCx(char const* filename, int flipVertically, int format, unsigned char* dest, size_t destSize)
+{
+  return LoadImageAsBCx(filename, flipVertically, format, dest, destSize, NULL);
+}
+
+/** @brief Builds and compresses the mipmap chain of an image held whole in memory.
+ *
+ *  pixels is overwritten while the levels are built. If compressedSize is not NULL, it receives the
+ *  number of bytes of dest filled with levels.
+ */
+int CompressImageToBCx(
+  stbi_uc* pixels, int imgWidth, int imgHeight, int format, unsigned char* dest, size_t destSize,
+  size_t* compressedSize)
+{
+  MipmapLevel levels[MAX_MIPMAP_LEVELS];
+  int levelCount = GetMipmapLevels(imgWidth, imgHeight, format, dest, destSize, levels);
+  int result = 1;
+  if (levelCount > 0)
+  {
+    // a 1-pixel-wide image keeps half its pixels in the next level, not a quarter
+    size_t spareSize = levelCount > 1 ? (size_t)levels[1].width * levels[1].height : 1;
+    stbi_uc* spare = (stbi_uc*)malloc(spareSize * GetBytesPerPixel(format));
+    if (spare)
+      CompressMipmapChain(pixels, spare, levels, levelCount, format, NULL);
+    else
+      result = 0;
+    free(spare);
   }
 
-  size_t bytesWritten = 0;
-  int mipmapLevel = 0;
-  do
+  if (compressedSize)
+    *compressedSize = levelCount > 0 ? GetMipmapLayout(imgWidth, imgHeight, format, levelCount, NULL, NULL) : 0;
+  return result;
+}
+
+typedef struct
+{
+  int flipVertically;
+  stbi_uc* pixels; // RGBA, allocated once the size is known
+  int opaque; // every alpha seen so far is 255
+  int gray; // every pixel seen so far has red, green and blue equal
+} AnalyzedImage;
+
+int StoreAnalyzedRow(void* user, stbi_uc const* row, int y, int width, int height)
+{
+  AnalyzedImage* image = (AnalyzedImage*)user;
+  size_t stride = (size_t)width * 4;
+  if (y == 0)
   {
-    bytesWritten = CompressMipmapRepeated(img, imgWidth, imgHeight, format, scaleBuf, dest, destSize, mipmapLevel);
-    dest += bytesWritten;
-    destSize -= bytesWritten;
-    mipmapLevel++;
+    image->pixels = (stbi_uc*)malloc(stride * height);
+    if (!image->pixels)
+      return 0;
   }
-  while (bytesWritten > 0);
 
-  free(scaleBuf);
-  stbi_image_free(img);
+  int destRow = image->flipVertically ? height - 1 - y : y;
+  memcpy(image->pixels + stride * destRow, row, stride);
 
+  // each property stops being tested at the first pixel that breaks it
+  for (int x = 0; x < width && (image->opaque || image->gray); x++)
+  {
+    stbi_uc const* pixel = row + (size_t)x * 4;
+    image->opaque &= pixel[3] == 255;
+    image->gray &= pixel[0] == pixel[1] && pixel[1] == pixel[2];
+  }
   return 1;
 }
 
-int ReadImageAsRGBA(char const* filename, int flipVertically, unsigned char* dest, size_t destSize)
+/** @brief Loads an image, picks the smallest format that holds it, and writes its mipmap chain to dest.
+ *
+ *  The pixels are checked for alpha and color as stb_image hands them over, so the choice costs no
+ *  extra pass. Gray, opaque images become BC4, other opaque images BC1 and the rest BC3. The image
+ *  is kept whole until the format is known, then the chain is built with the whole-level path.
+ */
+int LoadImageFileAsAutoBCx(
+  ImageFile* file, int flipVertically, unsigned char* dest, size_t destSize, int* format, size_t* compressedSize)
 {
+  AnalyzedImage image = { flipVertically, NULL, 1, 1 };
   int imgWidth, imgHeight, channels_in_file;
-  stbi_set_flip_vertically_on_load(flipVertically);
-  stbi_uc* img = stbi_load(filename, &imgWidth, &imgHeight, &channels_in_file, 4);
-  if (!img)
+  if (!LoadImageFileRows(file, &imgWidth, &imgHeight, &channels_in_file, 4, StoreAnalyzedRow, &image))
+  {
+    free(image.pixels);
     return 0;
+  }
 
-  size_t imgSize = imgWidth * imgHeight * 4;
-  memcpy_s(dest, destSize, img, imgSize);
-  stbi_image_free(img);
+  int chosenFormat = image.opaque ? (image.gray ? STBIMAGE_FORMAT_BC4 : STBIMAGE_FORMAT_BC1) : STBIMAGE_FORMAT_BC3;
+  size_t pixelCount = (size_t)imgWidth * imgHeight;
+  if (chosenFormat == STBIMAGE_FORMAT_BC4)
+  {
+    // red equals the luminance of a gray pixel, so this matches decoding to one channel
+    for (size_t i = 0; i < pixelCount; i++)
+      image.pixels[i] = image.pixels[i * 4];
+  }
+
+  int result = CompressImageToBCx(image.pixels, imgWidth, imgHeight, chosenFormat, dest, destSize, compressedSize);
+  free(image.pixels);
+
+  if (format)
+    *format = chosenFormat;
+  return result;
+}
+
+int ReadImageAsBCxAuto(
+  char const* filename, int flipVertically, unsigned char* dest, size_t destSize, int* format, size_t* size)
+{
+  ImageFile file;
+  if (!OpenImageFile(filename, &file))
+    return 0;
+  int result = LoadImageFileAsAutoBCx(&file, flipVertically, dest, destSize, format, size);
+  CloseImageFile(&file);
+  return result;
+}
+
+// the number of times a width x height image is halved before neither dimension exceeds maxDimension
+int GetScaleLevel(int width, int height, int maxDimension)
+{
+  int level = 0;
+  while (maxDimension > 0 && level < MAX_MIPMAP_LEVELS - 1 && max(width >> level, height >> level) > maxDimension)
+    level++;
+  return level;
+}
+
+void GetScaledImageSize(int width, int height, int maxDimension, int* scaledWidth, int* scaledHeight)
+{
+  int level = GetScaleLevel(width, height, maxDimension);
+  *scaledWidth = max(1, width >> level);
+  *scaledHeight = max(1, height >> level);
+}
+
+// JPEG decodes can be reduced by up to 1/8 in the decoder itself
+#define MAX_DECODER_SCALE_SHIFT 3
+
+typedef struct
+{
+  int flipVertically;
+  int bytesPerPixel;
+  int imgWidth; // full size of the image
+  int imgHeight;
+  int scaleLevel;
+  int scaleShift; // reduction requested from the decoder, which only JPEGs honor
+  int targetWidth; // size of the level scaleLevel below the full image
+  int targetHeight;
+  int keptWidth; // part of the decoded image kept, set at the first row
+  int keptHeight;
+  stbi_uc* pixels;
+} ScaledImage;
+
+int StoreScaledRow(void* user, stbi_uc const* row, int y, int width, int height)
+{
+  ScaledImage* image = (ScaledImage*)user;
+  if (y == 0)
+  {
+    // a reduced decode rounds partial blocks up where the mipmap levels round down, so the extra
+    // column and row it may deliver are dropped
+    int reduced = width != image->imgWidth || height != image->imgHeight;
+    int appliedShift = reduced ? image->scaleShift : 0;
+    image->keptWidth = min(width, max(1, image->imgWidth >> appliedShift));
+    image->keptHeight = min(height, max(1, image->imgHeight >> appliedShift));
+    image->pixels = (stbi_uc*)malloc((size_t)image->keptWidth * image->keptHeight * image->bytesPerPixel);
+    if (!image->pixels)
+      return 0;
+  }
+
+  if (y < image->keptHeight)
+  {
+    size_t stride = (size_t)image->keptWidth * image->bytesPerPixel;
+    int destRow = image->flipVertically ? image->keptHeight - 1 - y : y;
+    memcpy(image->pixels + stride * destRow, row, stride);
+  }
+  return 1;
+}
+
+/** @brief Loads an image at the size GetScaledImageSize gives for scaleLevel.
+ *
+ *  JPEGs are reduced by up to 1/8 while they are decoded, so only a fraction of the full image is
+ *  ever decoded, converted or held; any further reduction, and that of other formats, is done by
+ *  halving the decoded image.
+ *
+ *  @return the pixels, bytesPerPixel each, to be freed with free, or NULL on failure
+ */
+stbi_uc* LoadImageFileScaled(
+  ImageFile* file, int flipVertically, int bytesPerPixel, int imgWidth, int imgHeight, int scaleLevel)
+{
+  ScaledImage image = {
+    flipVertically, bytesPerPixel, imgWidth, imgHeight, scaleLevel, min(scaleLevel, MAX_DECODER_SCALE_SHIFT),
+    max(1, imgWidth >> scaleLevel), max(1, imgHeight >> scaleLevel), 0, 0, NULL };
+
+  int decodedWidth, decodedHeight, channels_in_file;
+  if (!LoadImageFileRowsScaled(
+    file, &decodedWidth, &decodedHeight, &channels_in_file, bytesPerPixel, image.scaleShift, StoreScaledRow, &image))
+  {
+    free(image.pixels);
+    return NULL;
+  }
+
+  stbi_uc* pixels = image.pixels;
+  int width = image.keptWidth;
+  int height = image.keptHeight;
+  while (pixels && (width != image.targetWidth || height != image.targetHeight))
+  {
+    int nextWidth = max(image.targetWidth, width >> 1);
+    int nextHeight = max(image.targetHeight, height >> 1);
+    stbi_uc* next = (stbi_uc*)malloc((size_t)nextWidth * nextHeight * bytesPerPixel);
+    if (next)
+      DownsampleImage(pixels, width, height, next, nextWidth, nextHeight, bytesPerPixel);
+    free(pixels);
+    pixels = next;
+    width = nextWidth;
+    height = nextHeight;
+  }
+  return pixels;
+}
+
+/** @brief Loads an image reduced to fit maxDimension and writes its compressed mipmap chain to dest.
+ *
+ *  Images that already fit take the streaming path of LoadImageFileAsBCx.
+ */
+int LoadImageFileAsBCxScaled(
+  ImageFile* file, int flipVertically, int format, int maxDimension, unsigned char* dest, size_t destSize)
+{
+  int imgWidth, imgHeight, numComponents;
+  if (!GetImageFileInfo(file, &imgWidth, &imgHeight, &numComponents, NULL))
+    return 0;
+
+  int scaleLevel = GetScaleLevel(imgWidth, imgHeight, maxDimension);
+  if (format == STBIMAGE_FORMAT_BC6H)
+    return LoadImageFileAsBC6H(file, flipVertically, scaleLevel, dest, destSize, NULL, NULL);
+  if (scaleLevel == 0)
+    return LoadImageFileAsBCx(file, flipVertically, format, dest, destSize, NULL, NULL);
+  if (GetBytesPerCompressedBlock(format) == 0)
+    return 0;
+
+  stbi_uc* pixels = LoadImageFileScaled(file, flipVertically, GetBytesPerPixel(format), imgWidth, imgHeight, scaleLevel);
+  if (!pixels)
+    return 0;
+  int width, height;
+  GetScaledImageSize(imgWidth, imgHeight, maxDimension, &width, &height);
+  int result = CompressImageToBCx(pixels, width, height, format, dest, destSize, NULL);
+  free(pixels);
+  return result;
+}
+
+int ReadImageAsBCxScaled(
+  char const* filename, int flipVertically, int format, int maxDimension, unsigned char* dest, size_t destSize)
+{
+  ImageFile file;
+  if (!OpenImageFile(filename, &file))
+    return 0;
+  int result = LoadImageFileAsBCxScaled(&file, flipVertically, format, maxDimension, dest, destSize);
+  CloseImageFile(&file);
+  return result;
+}
+
+typedef struct
+{
+  char const* const* filenames;
+  int flipVertically;
+  int const* formats;
+  unsigned char* const* dests;
+  size_t const* destSizes;
+  int* results;
+} BatchLoadTask;
+
+void BatchLoadTaskCallback(void* context, int index)
+{
+  BatchLoadTask* task = (BatchLoadTask*)context;
+  task->results[index] = LoadImageAsBCx(
+    task->filenames[index], task->flipVertically, task->formats[index], task->dests[index], task->destSizes[index], NULL);
+}
+
+int ReadImagesAsBCx(
+  int count, char const* const* filenames, int flipVertically, int const* formats,
+  unsigned char* const* dests, size_t const* destSizes, int* results)
+{
+  // files are claimed one at a time by whichever pool thread is free; each file's block rows are
+  // in turn spread over the same pool, so threads left idle near the end of the batch help finish
+  // the remaining large images
+  BatchLoadTask task = { filenames, flipVertically, formats, dests, destSizes, results };
+  ParallelFor(count, BatchLoadTaskCallback, &task);
+
+  int loadedCount = 0;
+  for (int i = 0; i < count; i++)
+    loadedCount += results[i] != 0;
+  return loadedCount;
+}
+
+typedef struct
+{
+  int flipVertically;
+  unsigned char* dest;
+  size_t destSize;
+  volatile long const* cancelled;
+} RGBARowTarget;
+
+int StoreRGBARow(void* user, stbi_uc const* row, int y, int width, int height)
+{
+  RGBARowTarget* target = (RGBARowTarget*)user;
+  if (target->cancelled && *target->cancelled)
+    return 0;
+
+  size_t stride = (size_t)width * 4;
+  if (y == 0 && target->destSize < stride * height)
+    return 0;
+
+  int destRow = target->flipVertically ? height - 1 - y : y;
+  memcpy(target->dest + stride * destRow, row, stride);
+  return 1;
+}
+
+// fills the rest of dest with the mipmap chain of the RGBA image at its start
+void DownsampleRGBAChain(unsigned char* dest, int imgWidth, int imgHeight, size_t destSize)
+{
+  size_t imgSize = (size_t)imgWidth * imgHeight * 4;
 
   stbi_uc* source = dest;
   int sourceWidth = imgWidth;
@@ -270,9 +1153,9 @@ int ReadImageAsRGBA(char const* filename, int flipVertically, unsigned char* des
 
   while (destSize >= mipmapSize)
   {
-    stbir_resize_uint8(
-      source, sourceWidth, sourceHeight, 0,
-      dest, mipmapWidth, mipmapHeight, 0, 4);
+    DownsampleImage(
+      source, sourceWidth, sourceHeight,
+      dest, mipmapWidth, mipmapHeight, 4);
 
     // use dest as next source
     source = dest;
@@ -288,6 +1171,200 @@ int ReadImageAsRGBA(char const* filename, int flipVertically, unsigned char* des
     mipmapHeight = (mipmapHeight > 1) ? mipmapHeight >> 1 : 1;
     mipmapSize = mipmapWidth * mipmapHeight * 4;
   }
+}
 
+/** @brief Loads an image and writes it, followed by its mipmap chain, to dest.
+ *
+ *  Decoded rows are stored straight into dest, in reverse order when flipping. If cancelled is not
+ *  NULL and becomes nonzero, decoding stops at the next row, the mipmap chain is skipped and 0 is
+ *  returned.
+ */
+int LoadImageFileAsRGBA(
+  ImageFile* file, int flipVertically, unsigned char* dest, size_t destSize, volatile long const* cancelled)
+{
+  int imgWidth, imgHeight, channels_in_file;
+  RGBARowTarget target = { flipVertically, dest, destSize, cancelled };
+  if (!LoadImageFileRows(file, &imgWidth, &imgHeight, &channels_in_file, 4, StoreRGBARow, &target))
+    return 0;
+  if (cancelled && *cancelled)
+    return 0;
+
+  DownsampleRGBAChain(dest, imgWidth, imgHeight, destSize);
   return 1;
-}
\ No newline at end of file
+}
+
+int LoadImageAsRGBA(char const* filename, int flipVertically, unsigned char* dest, size_t destSize, volatile long const* cancelled)
+{
+  ImageFile file;
+  if (!OpenImageFile(filename, &file))
+    return 0;
+  int result = LoadImageFileAsRGBA(&file, flipVertically, dest, destSize, cancelled);
+  CloseImageFile(&file);
+  return result;
+}
+
+int ReadImageAsRGBA(char const* filename, int flipVertically, unsigned char* dest, size_t destSize)
+{
+  return LoadImageAsRGBA(filename, flipVertically, dest, destSize, NULL);
+}
+
+int ReadImageAsRGBAScaled(
+  char const* filename, int flipVertically, int maxDimension, unsigned char* dest, size_t destSize)
+{
+  ImageFile file;
+  if (!OpenImageFile(filename, &file))
+    return 0;
+
+  int imgWidth, imgHeight, numComponents;
+  int result = GetImageFileInfo(&file, &imgWidth, &imgHeight, &numComponents, NULL);
+  int scaleLevel = result ? GetScaleLevel(imgWidth, imgHeight, maxDimension) : 0;
+  if (result && scaleLevel == 0)
+    result = LoadImageFileAsRGBA(&file, flipVertically, dest, destSize, NULL);
+  else if (result)
+  {
+    int width = max(1, imgWidth >> scaleLevel);
+    int height = max(1, imgHeight >> scaleLevel);
+    size_t imgSize = (size_t)width * height * 4;
+    stbi_uc* pixels = destSize >= imgSize ? LoadImageFileScaled(&file, flipVertically, 4, imgWidth, imgHeight, scaleLevel) : NULL;
+    result = pixels != NULL;
+    if (pixels)
+    {
+      memcpy(dest, pixels, imgSize);
+      free(pixels);
+      DownsampleRGBAChain(dest, width, height, destSize);
+    }
+  }
+  CloseImageFile(&file);
+  return result;
+}
+
+int GetImageInfoFromMemory(void const* buffer, size_t bufferSize, int* width, int* height, int* numComponents)
+{
+  ImageFile file;
+  if (!OpenImageMemory(buffer, bufferSize, &file))
+    return 0;
+  int result = GetImageFileInfo(&file, width, height, numComponents, NULL);
+  CloseImageFile(&file);
+  return result;
+}
+
+int ReadImageAsBCxFromMemory(
+  void const* buffer, size_t bufferSize, int flipVertically, int format, unsigned char* dest, size_t destSize)
+{
+  ImageFile file;
+  if (!OpenImageMemory(buffer, bufferSize, &file))
+    return 0;
+  int result = LoadImageFileAsBCx(&file, flipVertically, format, dest, destSize, NULL, NULL);
+  CloseImageFile(&file);
+  return result;
+}
+
+int ReadImageAsRGBAFromMemory(
+  void const* buffer, size_t bufferSize, int flipVertically, unsigned char* dest, size_t destSize)
+{
+  ImageFile file;
+  if (!OpenImageMemory(buffer, bufferSize, &file))
+    return 0;
+  int result = LoadImageFileAsRGBA(&file, flipVertically, dest, destSize, NULL);
+  CloseImageFile(&file);
+  return result;
+}
+
+struct StbImageHandle
+{
+  ImageFile file;
+};
+
+StbImageHandle* OpenImage(char const* filename, int* width, int* height, int* numComponents, int* bitDepth)
+{
+  StbImageHandle* image = (StbImageHandle*)malloc(sizeof(StbImageHandle));
+  if (!image)
+    return NULL;
+  if (!OpenImageFile(filename, &image->file))
+  {
+    free(image);
+    return NULL;
+  }
+  if (!GetImageFileInfo(&image->file, width, height, numComponents, bitDepth))
+  {
+    CloseImage(image);
+    return NULL;
+  }
+  return image;
+}
+
+int DecodeImageAsBCx(StbImageHandle* image, int flipVertically, int format, unsigned char* dest, size_t destSize)
+{
+  return LoadImageFileAsBCx(&image->file, flipVertically, format, dest, destSize, NULL, NULL);
+}
+
+int DecodeImageAsRGBA(StbImageHandle* image, int flipVertically, unsigned char* dest, size_t destSize)
+{
+  return LoadImageFileAsRGBA(&image->file, flipVertically, dest, destSize, NULL);
+}
+
+void CloseImage(StbImageHandle* image)
+{
+  if (!image)
+    return;
+  CloseImageFile(&image->file);
+  free(image);
+}
+
+typedef struct
+{
+  int flipVertically;
+  int format;
+  unsigned char* dest;
+  size_t destSize;
+  char filename[1]; // variable length, allocated with the rest of the arguments
+} AsyncLoadArguments;
+
+AsyncLoadArguments* CreateAsyncLoadArguments(
+  char const* filename, int flipVertically, int format, unsigned char* dest, size_t destSize)
+{
+  size_t filenameSize = strlen(filename) + 1;
+  AsyncLoadArguments* arguments = (AsyncLoadArguments*)malloc(sizeof(AsyncLoadArguments) + filenameSize);
+  if (!arguments)
+    return NULL;
+
+  arguments->flipVertically = flipVertically;
+  arguments->format = format;
+  arguments->dest = dest;
+  arguments->destSize = destSize;
+  memcpy(arguments->filename, filename, filenameSize);
+  return arguments;
+}
+
+int AsyncLoadAsBCx(void* context, volatile long const* cancelled)
+{
+  AsyncLoadArguments* arguments = (AsyncLoadArguments*)context;
+  return LoadImageAsBCx(
+    arguments->filename, arguments->flipVertically, arguments->format, arguments->dest, arguments->destSize, cancelled);
+}
+
+int AsyncLoadAsRGBA(void* context, volatile long const* cancelled)
+{
+  AsyncLoadArguments* arguments = (AsyncLoadArguments*)context;
+  return LoadImageAsRGBA(arguments->filename, arguments->flipVertically, arguments->dest, arguments->destSize, cancelled);
+}
+
+StbImageRequest* ReadImageAsBCxAsync(
+  char const* filename, int flipVertically, int format, unsigned char* dest, size_t destSize,
+  int priority, StbImageRequestCallback callback, void* userData)
+{
+  AsyncLoadArguments* arguments = CreateAsyncLoadArguments(filename, flipVertically, format, dest, destSize);
+  if (!arguments)
+    return NULL;
+  return SubmitRequest(AsyncLoadAsBCx, arguments, priority, callback, userData);
+}
+
+StbImageRequest* ReadImageAsRGBAAsync(
+  char const* filename, int flipVertically, unsigned char* dest, size_t destSize,
+  int priority, StbImageRequestCallback callback, void* userData)
+{
+  AsyncLoadArguments* arguments = CreateAsyncLoadArguments(filename, flipVertically, 0, dest, destSize);
+  if (!arguments)
+    return NULL;
+  return SubmitRequest(AsyncLoadAsRGBA, arguments, priority, callback, userData);
+}
@@ -1,10 +1,123 @@
 #pragma once
 
+#define STBIMAGE_FORMAT_RGBA 0
 #define STBIMAGE_FORMAT_BC1 1
 #define STBIMAGE_FORMAT_BC3 3
+// single channel: gray images as they are, color images as their luminance
+#define STBIMAGE_FORMAT_BC4 4
 #define STBIMAGE_FORMAT_BC5 5
+// unsigned half floats: Radiance HDR images as they are, 8- and 16-bit images as linear values in [0, 1]
+#define STBIMAGE_FORMAT_BC6H 6
+#define STBIMAGE_FORMAT_BC7 7
+// faster and slower searches than STBIMAGE_FORMAT_BC7; all three produce the same block format
+#define STBIMAGE_FORMAT_BC7_FAST 0x107
+#define STBIMAGE_FORMAT_BC7_SLOW 0x207
+
+// mipmap levels a chain can have: one per bit of an int dimension
+#define STBIMAGE_MAX_MIPMAP_LEVELS 32
+
+#define STBIMAGE_CONTAINER_DDS 1
+#define STBIMAGE_CONTAINER_KTX2 2
+
+#define STBIMAGE_REQUEST_PENDING 0
+#define STBIMAGE_REQUEST_RUNNING 1
+#define STBIMAGE_REQUEST_COMPLETED 2
+#define STBIMAGE_REQUEST_FAILED 3
+#define STBIMAGE_REQUEST_CANCELLED 4
+
+typedef struct StbImageHandle StbImageHandle;
+typedef struct StbImageRequest StbImageRequest;
+// invoked on a worker thread (or on the thread calling CancelRequest for a request that had not started)
+// once the request reaches its final status
+typedef void (*StbImageRequestCallback)(StbImageRequest* request, int status, void* userData);
+
+typedef struct
+{
+  int width;
+  int height;
+  size_t offset; // from the start of dest
+  size_t size;
+} StbImageMipmapLevel;
 
 #define DLLEXPORT __declspec(dllexport)
+// threadCount includes the calling thread; 0 selects one thread per logical processor
+DLLEXPORT void SetWorkerThreadCount(int threadCount);
 DLLEXPORT int GetImageInfo(char const* filename, int* width, int* height, int* numComponents);
+// computes where each mipmap level of a width x height image goes in dest and returns the dest size needed
+// for them, or 0 for an unknown format. levels may be NULL; otherwise it needs room for
+// STBIMAGE_MAX_MIPMAP_LEVELS entries. maxLevels limits the chain, 0 for all levels: BC chains end once a
+// dimension would reach 0, RGBA chains at 1x1. the loaders fill as many levels as fit in destSize, so a
+// dest sized by this function receives exactly the levels described
+DLLEXPORT size_t GetMipmapLayout(
+  int width, int height, int format, int maxLevels, StbImageMipmapLevel* levels, int* levelCount);
+// stores every mipmap chain loaded by filename with ReadImageAsBCx, ReadImagesAsBCx or ReadImageAsBCxAsync in
+// directory, and copies it back on later loads while the source file's size and modification time are
+// unchanged. hashContents also keys entries on a hash of the source file, which costs a read of the file on
+// every load. directory must exist; NULL disables the cache
+DLLEXPORT int SetTextureCacheDirectory(char const* directory, int hashContents);
+
+// writes a BC mipmap chain laid out as ReadImageAsBCx writes it to a DDS (with a DX10 header) or KTX2 file.
+// the file holds the levels that fit in dataSize
+DLLEXPORT int WriteTextureFile(
+  char const* filename, int container, int width, int height, int format, unsigned char const* data, size_t dataSize);
+// reads the header of a DDS or KTX2 file holding a BC1, BC3, BC4, BC5, BC6H or BC7 texture
+DLLEXPORT int GetTextureFileInfo(char const* filename, int* width, int* height, int* format, int* levelCount);
+// copies the levels of a DDS or KTX2 file that fit in destSize to dest, laid out as ReadImageAsBCx writes them
+DLLEXPORT int ReadTextureFile(char const* filename, unsigned char* dest, size_t destSize);
+// except for BC6H, sequential JPEGs and non-interlaced PNGs are decoded and compressed a few rows at a time,
+// so the memory used beyond dest grows with the image width only; other images are decoded whole first
 DLLEXPORT int ReadImageAsBCx(char const* filename, int flipVertically, int format, unsigned char* dest, size_t destSize);
+// loads filename as BC4 if it is gray and opaque, BC1 if it is opaque and BC3 otherwise, judged from the decoded
+// pixels. format receives the format chosen and size the bytes of dest filled; a dest sized by GetMipmapLayout
+// for BC3 holds the full chain of any choice. results are not stored in the texture cache
+DLLEXPORT int ReadImageAsBCxAuto(
+  char const* filename, int flipVertically, unsigned char* dest, size_t destSize, int* format, size_t* size);
+// loads count files concurrently; results[i] receives the ReadImageAsBCx result for filenames[i].
+// returns the number of files loaded successfully
+DLLEXPORT int ReadImagesAsBCx(
+  int count, char const* const* filenames, int flipVertically, int const* formats,
+  unsigned char* const* dests, size_t const* destSizes, int* results);
 DLLEXPORT int ReadImageAsRGBA(char const* filename, int flipVertically, unsigned char* dest, size_t destSize);
+
+// variants of ReadImageAsBCx and ReadImageAsRGBA that load the image halved until neither dimension exceeds
+// maxDimension (0 keeps the full size); GetScaledImageSize gives the size of the first level. JPEGs are reduced
+// by up to 1/8 while they are decoded, other images after. results are not stored in the texture cache
+DLLEXPORT void GetScaledImageSize(int width, int height, int maxDimension, int* scaledWidth, int* scaledHeight);
+DLLEXPORT int ReadImageAsBCxScaled(
+  char const* filename, int flipVertically, int format, int maxDimension, unsigned char* dest, size_t destSize);
+DLLEXPORT int ReadImageAsRGBAScaled(
+  char const* filename, int flipVertically, int maxDimension, unsigned char* dest, size_t destSize);
+
+// variants of GetImageInfo, ReadImageAsBCx and ReadImageAsRGBA that decode an encoded image the caller
+// already holds in memory, such as an entry read from an archive. buffer is only read during the call
+DLLEXPORT int GetImageInfoFromMemory(
+  void const* buffer, size_t bufferSize, int* width, int* height, int* numComponents);
+DLLEXPORT int ReadImageAsBCxFromMemory(
+  void const* buffer, size_t bufferSize, int flipVertically, int format, unsigned char* dest, size_t destSize);
+DLLEXPORT int ReadImageAsRGBAFromMemory(
+  void const* buffer, size_t bufferSize, int flipVertically, unsigned char* dest, size_t destSize);
+
+// opens filename once for any number of decodes, returning NULL if it is missing or not a supported image.
+// bitDepth (8 or 16) may be NULL. a handle must not be used by two threads at the same time
+DLLEXPORT StbImageHandle* OpenImage(char const* filename, int* width, int* height, int* numComponents, int* bitDepth);
+DLLEXPORT int DecodeImageAsBCx(
+  StbImageHandle* image, int flipVertically, int format, unsigned char* dest, size_t destSize);
+DLLEXPORT int DecodeImageAsRGBA(StbImageHandle* image, int flipVertically, unsigned char* dest, size_t destSize);
+DLLEXPORT void CloseImage(StbImageHandle* image);
+
+// asynchronous variants of ReadImageAsBCx and ReadImageAsRGBA. dest must stay valid until the request
+// reaches a final status. the returned handle must be released with CloseRequest, which does not cancel
+// the load. requests with higher priority start first
+DLLEXPORT StbImageRequest* ReadImageAsBCxAsync(
+  char const* filename, int flipVertically, int format, unsigned char* dest, size_t destSize,
+  int priority, StbImageRequestCallback callback, void* userData);
+DLLEXPORT StbImageRequest* ReadImageAsRGBAAsync(
+  char const* filename, int flipVertically, unsigned char* dest, size_t destSize,
+  int priority, StbImageRequestCallback callback, void* userData);
+DLLEXPORT int GetRequestStatus(StbImageRequest* request);
+// blocks until the request reaches a final status and its callback has returned
+DLLEXPORT int WaitForRequest(StbImageRequest* request);
+DLLEXPORT void CancelRequest(StbImageRequest* request);
+// only affects requests that have not started yet
+DLLEXPORT void SetRequestPriority(StbImageRequest* request, int priority);
+DLLEXPORT void CloseRequest(StbImageRequest* request);
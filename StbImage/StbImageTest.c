@@ -0,0 +1,393 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Bc7Encoder.h"
+#include "Downsample.h"
+#include "stb_dxt.h"
+#include "stb_image.h"
+#include "StbImage.h"
+
+// Checks the mipmap chains ReadImageAsBCxFromMemory and ReadImageAsRGBAFromMemory build while an image
+// is decoded row by row against chains built here from a whole decode, one level and one block at a time.
+// Every generated PNG, and any image file named on the command line, is loaded flipped and not, on one
+// and several threads, into dests that hold the whole chain or cut it short.
+//
+// usage: StbImageTest [image files...]
+
+// bytes past destSize that must stay untouched
+#define GUARD_SIZE 64
+#define GUARD_BYTE 0xA5
+
+static int const formats[] =
+{
+  STBIMAGE_FORMAT_RGBA, STBIMAGE_FORMAT_BC1, STBIMAGE_FORMAT_BC3, STBIMAGE_FORMAT_BC4, STBIMAGE_FORMAT_BC5,
+  STBIMAGE_FORMAT_BC7_FAST,
+};
+
+static int const threadCounts[] = { 1, 4 };
+
+static int checkCount;
+static int failureCount;
+
+typedef struct
+{
+  unsigned char* data;
+  size_t size;
+  size_t capacity;
+} Buffer;
+
+static void Append(Buffer* buffer, void const* data, size_t size)
+{
+  if (buffer->size + size > buffer->capacity)
+  {
+    buffer->capacity = (buffer->size + size) * 2;
+    buffer->data = (unsigned char*)realloc(buffer->data, buffer->capacity);
+    if (!buffer->data)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(2);
+    }
+  }
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+}
+
+static void AppendBigEndian(Buffer* buffer, unsigned value)
+{
+  unsigned char bytes[4] =
+    { (unsigned char)(value >> 24), (unsigned char)(value >> 16), (unsigned char)(value >> 8), (unsigned char)value };
+  Append(buffer, bytes, 4);
+}
+
+static unsigned Crc32(unsigned crc, unsigned char const* data, size_t size)
+{
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++)
+  {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+  }
+  return ~crc;
+}
+
+static void AppendChunk(Buffer* png, char const* type, unsigned char const* data, size_t size)
+{
+  AppendBigEndian(png, (unsigned)size);
+  Append(png, type, 4);
+  Append(png, data, size);
+  AppendBigEndian(png, Crc32(Crc32(0, (unsigned char const*)type, 4), data, size));
+}
+
+static int Paeth(int a, int b, int c)
+{
+  int p = a + b - c;
+  int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+  return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+/** @brief Encodes an 8-bit gray, RGB or RGBA PNG.
+ *
+ *  Rows cycle through the five filter types, the zlib stream is made of stored blocks, and it is
+ *  split across IDAT chunks of an odd size, so rows and blocks straddle chunk boundaries.
+ */
+static Buffer EncodePng(unsigned char const* pixels, int width, int height, int channels)
+{
+  size_t rowSize = (size_t)width * channels;
+  Buffer filtered = { 0 };
+  for (int y = 0; y < height; y++)
+  {
+    unsigned char const* row = pixels + rowSize * y;
+    unsigned char const* above = y > 0 ? row - rowSize : NULL;
+    unsigned char filter = (unsigned char)(y % 5);
+    Append(&filtered, &filter, 1);
+    for (size_t i = 0; i < rowSize; i++)
+    {
+      int a = i >= (size_t)channels ? row[i - channels] : 0;
+      int b = above ? above[i] : 0;
+      int c = above && i >= (size_t)channels ? above[i - channels] : 0;
+      int predicted =
+        filter == 1 ? a : filter == 2 ? b : filter == 3 ? (a + b) / 2 : filter == 4 ? Paeth(a, b, c) : 0;
+      unsigned char value = (unsigned char)(row[i] - predicted);
+      Append(&filtered, &value, 1);
+    }
+  }
+
+  Buffer zlib = { 0 };
+  unsigned char header[2] = { 0x78, 0x01 };
+  Append(&zlib, header, 2);
+  size_t offset = 0;
+  do
+  {
+    size_t size = filtered.size - offset < 65535 ? filtered.size - offset : 65535;
+    unsigned char blockHeader[5] =
+    {
+      offset + size == filtered.size ? 1 : 0,
+      (unsigned char)size, (unsigned char)(size >> 8), (unsigned char)~size, (unsigned char)(~size >> 8),
+    };
+    Append(&zlib, blockHeader, 5);
+    Append(&zlib, filtered.data + offset, size);
+    offset += size;
+  } while (offset < filtered.size);
+  unsigned s1 = 1, s2 = 0;
+  for (size_t i = 0; i < filtered.size; i++)
+  {
+    s1 = (s1 + filtered.data[i]) % 65521;
+    s2 = (s2 + s1) % 65521;
+  }
+  AppendBigEndian(&zlib, (s2 << 16) | s1);
+  free(filtered.data);
+
+  Buffer png = { 0 };
+  unsigned char const signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+  Append(&png, signature, 8);
+  unsigned char ihdr[13] =
+  {
+    (unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+    (unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+    8, (unsigned char)(channels == 1 ? 0 : channels == 3 ? 2 : 6), 0, 0, 0,
+  };
+  AppendChunk(&png, "IHDR", ihdr, sizeof(ihdr));
+  for (offset = 0; offset < zlib.size; offset += 4099)
+    AppendChunk(&png, "IDAT", zlib.data + offset, zlib.size - offset < 4099 ? zlib.size - offset : 4099);
+  AppendChunk(&png, "IEND", NULL, 0);
+  free(zlib.data);
+  return png;
+}
+
+/** @brief Fills an image with noisy gradients, broken up by solid squares that repeat one color. */
+static unsigned char* GenerateImage(int width, int height, int channels)
+{
+  unsigned char* pixels = (unsigned char*)malloc((size_t)width * height * channels);
+  unsigned seed = (unsigned)(width * 31 + height * 7 + channels);
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      unsigned char* pixel = pixels + ((size_t)width * y + x) * channels;
+      int solid = (x / 8 + y / 8) % 3 == 0;
+      for (int c = 0; c < channels; c++)
+      {
+        seed = seed * 1103515245u + 12345u;
+        pixel[c] = solid ? (unsigned char)(40 + c * 60) : (unsigned char)(x * (c + 1) + y * (3 - c) + (seed >> 27));
+      }
+    }
+  }
+  return pixels;
+}
+
+static void FlipRows(unsigned char* pixels, int width, int height, int channels)
+{
+  size_t rowSize = (size_t)width * channels;
+  unsigned char* swap = (unsigned char*)malloc(rowSize);
+  for (int y = 0; y < height / 2; y++)
+  {
+    memcpy(swap, pixels + rowSize * y, rowSize);
+    memcpy(pixels + rowSize * y, pixels + rowSize * (height - 1 - y), rowSize);
+    memcpy(pixels + rowSize * (height - 1 - y), swap, rowSize);
+  }
+  free(swap);
+}
+
+/** @brief Compresses a whole level block by block, padding blocks past the edges with zeroes. */
+static void CompressLevel(unsigned char const* pixels, int width, int height, int format, unsigned char* dest)
+{
+  int channels = format == STBIMAGE_FORMAT_BC4 ? 1 : 4;
+  size_t blockSize = format == STBIMAGE_FORMAT_BC1 || format == STBIMAGE_FORMAT_BC4 ? 8 : 16;
+  for (int blockY = 0; blockY < (height + 3) / 4; blockY++)
+  {
+    for (int blockX = 0; blockX < (width + 3) / 4; blockX++)
+    {
+      unsigned char block[64] = { 0 };
+      for (int y = 0; y < 4 && blockY * 4 + y < height; y++)
+      {
+        for (int x = 0; x < 4 && blockX * 4 + x < width; x++)
+        {
+          size_t source = ((size_t)width * (blockY * 4 + y) + blockX * 4 + x) * channels;
+          memcpy(block + (y * 4 + x) * channels, pixels + source, channels);
+        }
+      }
+
+      switch (format)
+      {
+        case STBIMAGE_FORMAT_BC1:
+          stb_compress_dxt_block(dest, block, 0, STB_DXT_HIGHQUAL);
+          break;
+        case STBIMAGE_FORMAT_BC3:
+          stb_compress_dxt_block(dest, block, 1, STB_DXT_HIGHQUAL);
+          break;
+        case STBIMAGE_FORMAT_BC4:
+          stb_compress_bc4_block(dest, block);
+          break;
+        case STBIMAGE_FORMAT_BC5:
+          stb_compress_bc5_block_rgba(dest, block);
+          break;
+        default:
+          CompressBC7Block(dest, block, format == STBIMAGE_FORMAT_BC7_FAST ? BC7_QUALITY_FAST : BC7_QUALITY_NORMAL);
+          break;
+      }
+      dest += blockSize;
+    }
+  }
+}
+
+/** @brief Builds the chain the loaders should write from a whole decode, with the levels that fit in destSize.
+ *
+ *  @return what the loader should return
+ */
+static int BuildReference(
+  unsigned char const* encoded, size_t encodedSize, int flipVertically, int format, unsigned char* dest,
+  size_t destSize)
+{
+  int channels = format == STBIMAGE_FORMAT_BC4 ? 1 : 4;
+  int width, height, channelsInFile;
+  unsigned char* pixels = stbi_load_from_memory(encoded, (int)encodedSize, &width, &height, &channelsInFile, channels);
+  if (!pixels)
+    return 0;
+  if (flipVertically)
+    FlipRows(pixels, width, height, channels);
+
+  StbImageMipmapLevel levels[STBIMAGE_MAX_MIPMAP_LEVELS];
+  int levelCount;
+  GetMipmapLayout(width, height, format, 0, levels, &levelCount);
+  if (format == STBIMAGE_FORMAT_RGBA && destSize < levels[0].size)
+  {
+    stbi_image_free(pixels);
+    return 0;
+  }
+
+  unsigned char* level = pixels;
+  for (int i = 0; i < levelCount && levels[i].offset + levels[i].size <= destSize; i++)
+  {
+    if (i > 0)
+    {
+      unsigned char* next = (unsigned char*)malloc((size_t)levels[i].width * levels[i].height * channels);
+      DownsampleImage(
+        level, levels[i - 1].width, levels[i - 1].height, next, levels[i].width, levels[i].height, channels);
+      if (level != pixels)
+        free(level);
+      level = next;
+    }
+    if (format == STBIMAGE_FORMAT_RGBA)
+      memcpy(dest + levels[i].offset, level, levels[i].size);
+    else
+      CompressLevel(level, levels[i].width, levels[i].height, format, dest + levels[i].offset);
+  }
+  if (level != pixels)
+    free(level);
+  stbi_image_free(pixels);
+  return 1;
+}
+
+static void CheckLoad(
+  char const* name, unsigned char const* encoded, size_t encodedSize, int flipVertically, int format,
+  size_t destSize, int threadCount)
+{
+  unsigned char* expected = (unsigned char*)malloc(destSize + GUARD_SIZE);
+  unsigned char* actual = (unsigned char*)malloc(destSize + GUARD_SIZE);
+  memset(expected, GUARD_BYTE, destSize + GUARD_SIZE);
+  memset(actual, GUARD_BYTE, destSize + GUARD_SIZE);
+
+  int expectedResult = BuildReference(encoded, encodedSize, flipVertically, format, expected, destSize);
+  int actualResult = format == STBIMAGE_FORMAT_RGBA
+    ? ReadImageAsRGBAFromMemory(encoded, encodedSize, flipVertically, actual, destSize)
+    : ReadImageAsBCxFromMemory(encoded, encodedSize, flipVertically, format, actual, destSize);
+
+  checkCount++;
+  size_t difference = 0;
+  while (difference < destSize + GUARD_SIZE && expected[difference] == actual[difference])
+    difference++;
+  if (actualResult != expectedResult || (expectedResult && difference < destSize + GUARD_SIZE))
+  {
+    failureCount++;
+    printf(
+      "FAIL %s: format %d, flip %d, %d threads, destSize %zu: returned %d, expected %d, first difference at %zu\n",
+      name, format, flipVertically, threadCount, destSize, actualResult, expectedResult, difference);
+  }
+  free(expected);
+  free(actual);
+}
+
+static void CheckImage(char const* name, unsigned char const* encoded, size_t encodedSize)
+{
+  int width, height, channels;
+  if (!GetImageInfoFromMemory(encoded, encodedSize, &width, &height, &channels))
+  {
+    failureCount++;
+    printf("FAIL %s: not a supported image\n", name);
+    return;
+  }
+
+  for (int t = 0; t < (int)(sizeof(threadCounts) / sizeof(threadCounts[0])); t++)
+  {
+    SetWorkerThreadCount(threadCounts[t]);
+    for (int f = 0; f < (int)(sizeof(formats) / sizeof(formats[0])); f++)
+    {
+      StbImageMipmapLevel levels[STBIMAGE_MAX_MIPMAP_LEVELS];
+      int levelCount;
+      size_t fullSize = GetMipmapLayout(width, height, formats[f], 0, levels, &levelCount);
+
+      // the whole chain, all but the last byte, two levels, half of the second level, and too little for the first
+      size_t destSizes[5] = { fullSize, fullSize - 1, fullSize, fullSize, levels[0].size - 1 };
+      if (levelCount > 1)
+      {
+        destSizes[2] = levels[1].offset + levels[1].size;
+        destSizes[3] = levels[1].offset + levels[1].size / 2;
+      }
+
+      for (int flipVertically = 0; flipVertically < 2; flipVertically++)
+      {
+        for (int s = 0; s < 5; s++)
+          CheckLoad(name, encoded, encodedSize, flipVertically, formats[f], destSizes[s], threadCounts[t]);
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  // even and odd sizes, so chains are streamed to the end or continued from a whole level
+  static struct
+  {
+    int width;
+    int height;
+    int channels;
+  } const images[] =
+  {
+    { 256, 256, 4 }, { 300, 200, 3 }, { 257, 129, 1 }, { 1024, 96, 4 }, { 512, 512, 3 },
+    { 64, 7, 4 }, { 5, 3, 3 }, { 1, 1, 1 },
+  };
+
+  for (int i = 0; i < (int)(sizeof(images) / sizeof(images[0])); i++)
+  {
+    unsigned char* pixels = GenerateImage(images[i].width, images[i].height, images[i].channels);
+    Buffer png = EncodePng(pixels, images[i].width, images[i].height, images[i].channels);
+    char name[64];
+    snprintf(name, sizeof(name), "%dx%d, %d channels", images[i].width, images[i].height, images[i].channels);
+    CheckImage(name, png.data, png.size);
+    free(png.data);
+    free(pixels);
+  }
+
+  for (int i = 1; i < argc; i++)
+  {
+    FILE* file;
+    if (fopen_s(&file, argv[i], "rb") != 0)
+    {
+      failureCount++;
+      printf("FAIL %s: cannot open\n", argv[i]);
+      continue;
+    }
+    Buffer contents = { 0 };
+    unsigned char chunk[65536];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+      Append(&contents, chunk, read);
+    fclose(file);
+    CheckImage(argv[i], contents.data, contents.size);
+    free(contents.data);
+  }
+
+  printf("%d of %d checks passed\n", checkCount - failureCount, checkCount);
+  return failureCount ? 1 : 0;
+}
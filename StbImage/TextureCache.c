@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ImageFile.h"
+#include "TextureCache.h"
+
+// bump whenever the compressed output for the same source and arguments changes, so entries
+// written by older encoders are no longer matched
+#define TEXTURE_CACHE_VERSION 1
+
+#define TEXTURE_CACHE_MAGIC 0x43545342 // "BSTC"
+
+typedef struct
+{
+  DWORD magic;
+  DWORD version;
+  ULONGLONG sourceSize;
+  ULONGLONG sourceWriteTime;
+  ULONGLONG contentHash;
+  int format;
+  int flipVertically;
+  ULONGLONG destSize;
+  ULONGLONG dataSize;
+  DWORD sourcePathLength; // the path follows the header, then the data
+} TextureCacheHeader;
+
+// guards cacheDirectory and hashCacheContents
+static SRWLOCK cacheLock = SRWLOCK_INIT;
+static char* cacheDirectory;
+static int hashCacheContents;
+
+int SetTextureCacheDirectory(char const* directory, int hashContents)
+{
+  char* copy = NULL;
+  if (directory)
+  {
+    size_t length = strlen(directory) + 1;
+    copy = (char*)malloc(length);
+    if (!copy)
+      return 0;
+    memcpy_s(copy, length, directory, length);
+  }
+
+  AcquireSRWLockExclusive(&cacheLock);
+  char* previous = cacheDirectory;
+  cacheDirectory = copy;
+  hashCacheContents = hashContents;
+  ReleaseSRWLockExclusive(&cacheLock);
+
+  free(previous);
+  return 1;
+}
+
+static ULONGLONG HashBytes(ULONGLONG hash, void const* data, size_t size)
+{
+  // 64-bit FNV-1a
+  unsigned char const* bytes = (unsigned char const*)data;
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+  return hash;
+}
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+static ULONGLONG HashFileContents(char const* filename)
+{
+  ImageFile file;
+  if (!OpenImageFile(filename, &file))
+    return 0;
+
+  ULONGLONG hash = HASH_SEED;
+  if (file.data)
+  {
+    hash = HashBytes(hash, file.data, file.size);
+  }
+  else
+  {
+    unsigned char buffer[65536];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file.file)) > 0)
+      hash = HashBytes(hash, buffer, count);
+  }
+  CloseImageFile(&file);
+  return hash;
+}
+
+int GetTextureCacheKey(
+  char const* filename, int flipVertically, int format, size_t destSize, TextureCacheKey* key)
+{
+  char directory[MAX_PATH];
+  int hashContents;
+  AcquireSRWLockShared(&cacheLock);
+  int enabled = cacheDirectory && strcpy_s(directory, sizeof(directory), cacheDirectory) == 0;
+  hashContents = hashCacheContents;
+  ReleaseSRWLockShared(&cacheLock);
+  if (!enabled)
+    return 0;
+
+  DWORD pathLength = GetFullPathNameA(filename, MAX_PATH, key->sourcePath, NULL);
+  if (pathLength == 0 || pathLength >= MAX_PATH)
+    return 0;
+
+  WIN32_FILE_ATTRIBUTE_DATA attributes;
+  if (!GetFileAttributesExA(key->sourcePath, GetFileExInfoStandard, &attributes))
+    return 0;
+  key->sourceSize = ((ULONGLONG)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+  key->sourceWriteTime =
+    ((ULONGLONG)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+  key->contentHash = hashContents ? HashFileContents(key->sourcePath) : 0;
+  key->format = format;
+  key->flipVertically = flipVertically;
+  key->destSize = destSize;
+
+  // the file name only has to spread entries out; the header identifies the entry exactly
+  ULONGLONG nameHash = HashBytes(HASH_SEED, key->sourcePath, pathLength);
+  nameHash = HashBytes(nameHash, &key->format, sizeof(key->format));
+  nameHash = HashBytes(nameHash, &key->flipVertically, sizeof(key->flipVertically));
+  nameHash = HashBytes(nameHash, &key->destSize, sizeof(key->destSize));
+  int length = sprintf_s(key->cachePath, MAX_PATH, "%s\\%016llx.bcx", directory, nameHash);
+  return length > 0;
+}
+
+static void GetCacheHeader(TextureCacheKey const* key, size_t dataSize, TextureCacheHeader* header)
+{
+  memset(header, 0, sizeof(TextureCacheHeader));
+  header->magic = TEXTURE_CACHE_MAGIC;
+  header->version = TEXTURE_CACHE_VERSION;
+  header->sourceSize = key->sourceSize;
+  header->sourceWriteTime = key->sourceWriteTime;
+  header->contentHash = key->contentHash;
+  header->format = key->format;
+  header->flipVertically = key->flipVertically;
+  header->destSize = key->destSize;
+  header->dataSize = dataSize;
+  header->sourcePathLength = (DWORD)strlen(key->sourcePath);
+}
+
+int ReadCachedTexture(TextureCacheKey const* key, unsigned char* dest, size_t destSize)
+{
+  FILE* file;
+  if (fopen_s(&file, key->cachePath, "rb") != 0)
+    return 0;
+
+  TextureCacheHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1)
+  {
+    fclose(file);
+    return 0;
+  }
+
+  TextureCacheHeader expected;
+  char sourcePath[MAX_PATH];
+  GetCacheHeader(key, (size_t)header.dataSize, &expected);
+  int hit = memcmp(&header, &expected, sizeof(header)) == 0
+    && header.dataSize <= destSize
+    && header.sourcePathLength < MAX_PATH
+    && fread(sourcePath, 1, header.sourcePathLength, file) == header.sourcePathLength
+    && memcmp(sourcePath, key->sourcePath, header.sourcePathLength) == 0
+    && fread(dest, 1, (size_t)header.dataSize, file) == header.dataSize;
+
+  fclose(file);
+  return hit;
+}
+
+void WriteCachedTexture(TextureCacheKey const* key, unsigned char const* data, size_t dataSize)
+{
+  // unique per thread, so concurrent loads of the same texture do not write into each other
+  char temporaryPath[MAX_PATH + 16];
+  if (sprintf_s(temporaryPath, sizeof(temporaryPath), "%s.%lu.tmp", key->cachePath, GetCurrentThreadId()) <= 0)
+    return;
+
+  FILE* file;
+  if (fopen_s(&file, temporaryPath, "wb") != 0)
+    return;
+
+  TextureCacheHeader header;
+  GetCacheHeader(key, dataSize, &header);
+  int written = fwrite(&header, sizeof(header), 1, file) == 1
+    && fwrite(key->sourcePath, 1, header.sourcePathLength, file) == header.sourcePathLength
+    && fwrite(data, 1, dataSize, file) == dataSize;
+  written = fclose(file) == 0 && written;
+
+  if (!written || !MoveFileExA(temporaryPath, key->cachePath, MOVEFILE_REPLACE_EXISTING))
+    DeleteFileA(temporaryPath);
+}
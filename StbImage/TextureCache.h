@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <windows.h>
+#include "StbImage.h"
+
+/** @brief Identifies one compressed load of one version of a source file. */
+typedef struct
+{
+  char sourcePath[MAX_PATH]; // full path of the source file
+  char cachePath[MAX_PATH]; // cache file holding the compressed chain
+  ULONGLONG sourceSize;
+  ULONGLONG sourceWriteTime;
+  ULONGLONG contentHash; // 0 unless content hashing is enabled
+  int format;
+  int flipVertically;
+  ULONGLONG destSize; // the number of levels loaded depends on it
+} TextureCacheKey;
+
+/** @brief Builds the cache key for a load of filename.
+ *
+ *  @return 1 on success, 0 if the cache is disabled or the source file cannot be examined
+ */
+int GetTextureCacheKey(
+  char const* filename, int flipVertically, int format, size_t destSize, TextureCacheKey* key);
+
+/** @brief Copies a cached compressed chain into dest.
+ *
+ *  @return 1 if an entry matching key was found and copied, 0 otherwise
+ */
+int ReadCachedTexture(TextureCacheKey const* key, unsigned char* dest, size_t destSize);
+
+/** @brief Stores the first dataSize bytes of dest as the cache entry for key.
+ *
+ *  The entry is written under a temporary name and renamed into place, so concurrent readers
+ *  never see a partial entry. Failures are ignored; the texture is simply not cached.
+ */
+void WriteCachedTexture(TextureCacheKey const* key, unsigned char const* data, size_t dataSize);
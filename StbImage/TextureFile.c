@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <string.h>
+#include <windows.h>
+#include "ImageFile.h"
+#include "StbImage.h"
+
+typedef struct
+{
+  int format;
+  DWORD bytesPerBlock;
+  DWORD dxgiFormat;
+  DWORD vkFormat;
+  BYTE colorModel; // Khronos data format descriptor color model
+  BYTE sampleCount;
+  BYTE sampleQualifiers; // data format descriptor qualifier bits of every sample, such as float
+  BYTE sampleChannels[2]; // data format descriptor channel of each sample, which split the block evenly
+} TextureFormat;
+
+static TextureFormat const textureFormats[] =
+{
+  // BC1 blocks are written without alpha, so KTX2 files use the RGB variant
+  { STBIMAGE_FORMAT_BC1, 8, 71 /* DXGI_FORMAT_BC1_UNORM */, 131 /* VK_FORMAT_BC1_RGB_UNORM_BLOCK */, 128, 1, 0, { 0 } },
+  { STBIMAGE_FORMAT_BC3, 16, 77 /* DXGI_FORMAT_BC3_UNORM */, 137 /* VK_FORMAT_BC3_UNORM_BLOCK */, 130, 2, 0, { 15, 0 } },
+  { STBIMAGE_FORMAT_BC4, 8, 80 /* DXGI_FORMAT_BC4_UNORM */, 139 /* VK_FORMAT_BC4_UNORM_BLOCK */, 131, 1, 0, { 0 } },
+  { STBIMAGE_FORMAT_BC5, 16, 83 /* DXGI_FORMAT_BC5_UNORM */, 141 /* VK_FORMAT_BC5_UNORM_BLOCK */, 132, 2, 0, { 0, 1 } },
+  { STBIMAGE_FORMAT_BC6H, 16, 95 /* DXGI_FORMAT_BC6H_UF16 */, 143 /* VK_FORMAT_BC6H_UFLOAT_BLOCK */, 133, 1, 0x80, { 0 } },
+  { STBIMAGE_FORMAT_BC7, 16, 98 /* DXGI_FORMAT_BC7_UNORM */, 145 /* VK_FORMAT_BC7_UNORM_BLOCK */, 134, 1, 0, { 0 } },
+};
+
+#define TEXTURE_FORMAT_COUNT ((int)(sizeof(textureFormats) / sizeof(textureFormats[0])))
+
+static TextureFormat const* FindTextureFormat(int format, DWORD dxgiFormat, DWORD vkFormat)
+{
+  for (int i = 0; i < TEXTURE_FORMAT_COUNT; i++)
+  {
+    TextureFormat const* textureFormat = &textureFormats[i];
+    if ((format && textureFormat->format == format)
+      || (dxgiFormat && textureFormat->dxgiFormat == dxgiFormat)
+      || (vkFormat && textureFormat->vkFormat == vkFormat))
+    {
+      return textureFormat;
+    }
+  }
+  return NULL;
+}
+
+static size_t GetLevelSize(TextureFormat const* textureFormat, int width, int height, int level)
+{
+  int levelWidth = max(width >> level, 1);
+  int levelHeight = max(height >> level, 1);
+  return (size_t)((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * textureFormat->bytesPerBlock;
+}
+
+// DDS file layout, as described by the DirectX documentation
+
+#define DDS_MAGIC 0x20534444 // "DDS "
+#define DDSD_CAPS 0x1
+#define DDSD_HEIGHT 0x2
+#define DDSD_WIDTH 0x4
+#define DDSD_PIXELFORMAT 0x1000
+#define DDSD_MIPMAPCOUNT 0x20000
+#define DDSD_LINEARSIZE 0x80000
+#define DDPF_FOURCC 0x4
+#define DDS_FOURCC_DX10 0x30315844 // "DX10"
+#define DDSCAPS_COMPLEX 0x8
+#define DDSCAPS_TEXTURE 0x1000
+#define DDSCAPS_MIPMAP 0x400000
+#define DDS_DIMENSION_TEXTURE2D 3
+
+typedef struct
+{
+  DWORD magic;
+  DWORD size;
+  DWORD flags;
+  DWORD height;
+  DWORD width;
+  DWORD pitchOrLinearSize;
+  DWORD depth;
+  DWORD mipMapCount;
+  DWORD reserved1[11];
+  DWORD pixelFormatSize;
+  DWORD pixelFormatFlags;
+  DWORD fourCC;
+  DWORD pixelFormatBits[5];
+  DWORD caps[4];
+  DWORD reserved2;
+  DWORD dxgiFormat;
+  DWORD resourceDimension;
+  DWORD miscFlag;
+  DWORD arraySize;
+  DWORD miscFlags2;
+} DdsHeader;
+
+// KTX2 file layout, as described by the Khronos KTX 2.0 specification
+
+static BYTE const ktx2Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+typedef struct
+{
+  BYTE identifier[12];
+  DWORD vkFormat;
+  DWORD typeSize;
+  DWORD pixelWidth;
+  DWORD pixelHeight;
+  DWORD pixelDepth;
+  DWORD layerCount;
+  DWORD faceCount;
+  DWORD levelCount;
+  DWORD supercompressionScheme;
+  DWORD dfdByteOffset;
+  DWORD dfdByteLength;
+  DWORD kvdByteOffset;
+  DWORD kvdByteLength;
+  ULONGLONG sgdByteOffset;
+  ULONGLONG sgdByteLength;
+} Ktx2Header;
+
+typedef struct
+{
+  ULONGLONG byteOffset;
+  ULONGLONG byteLength;
+  ULONGLONG uncompressedByteLength;
+} Ktx2Level;
+
+/** @brief Fills in the data format descriptor of a block-compressed format.
+ *
+ *  @return the size of the descriptor in bytes, at most 60
+ */
+static DWORD GetKtx2DataFormat(TextureFormat const* textureFormat, DWORD* dfd)
+{
+  DWORD blockSize = 24 + 16 * textureFormat->sampleCount;
+  dfd[0] = 4 + blockSize;
+  dfd[1] = 0; // Khronos vendor, basic descriptor type
+  dfd[2] = 2 | (blockSize << 16); // version 1.3
+  dfd[3] = textureFormat->colorModel | (1 << 8) /* BT.709 primaries */ | (1 << 16) /* linear transfer */;
+  dfd[4] = 3 | (3 << 8); // 4x4 texel blocks
+  dfd[5] = textureFormat->bytesPerBlock;
+  dfd[6] = 0;
+  for (int i = 0; i < textureFormat->sampleCount; i++)
+  {
+    DWORD* sample = dfd + 7 + 4 * i;
+    DWORD sampleBits = textureFormat->bytesPerBlock * 8 / textureFormat->sampleCount;
+    DWORD channelType = textureFormat->sampleChannels[i] | textureFormat->sampleQualifiers;
+    sample[0] = (sampleBits * i) | ((sampleBits - 1) << 16) | (channelType << 24);
+    sample[1] = 0;
+    sample[2] = 0;
+    // float samples give their range as floats, 0 to 1.0f
+    sample[3] = textureFormat->sampleQualifiers & 0x80 ? 0x3F800000 : 0xFFFFFFFF;
+  }
+  return dfd[0];
+}
+
+static int WriteDds(FILE* file, TextureFormat const* textureFormat, int width, int height, int levelCount,
+  unsigned char const* data, size_t dataSize)
+{
+  DdsHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = DDS_MAGIC;
+  header.size = 124;
+  header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+  header.height = height;
+  header.width = width;
+  header.pitchOrLinearSize = (DWORD)GetLevelSize(textureFormat, width, height, 0);
+  header.mipMapCount = levelCount;
+  header.pixelFormatSize = 32;
+  header.pixelFormatFlags = DDPF_FOURCC;
+  header.fourCC = DDS_FOURCC_DX10;
+  header.caps[0] = DDSCAPS_TEXTURE | (levelCount > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+  header.dxgiFormat = textureFormat->dxgiFormat;
+  header.resourceDimension = DDS_DIMENSION_TEXTURE2D;
+  header.arraySize = 1;
+
+  // levels are stored largest first, as in dest
+  return fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data, 1, dataSize, file) == dataSize;
+}
+
+static int WriteKtx2(FILE* file, TextureFormat const* textureFormat, int width, int height, int levelCount,
+  unsigned char const* data)
+{
+  DWORD dfd[15];
+  DWORD dfdSize = GetKtx2DataFormat(textureFormat, dfd);
+
+  Ktx2Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy_s(header.identifier, sizeof(header.identifier), ktx2Identifier, sizeof(ktx2Identifier));
+  header.vkFormat = textureFormat->vkFormat;
+  header.typeSize = 1;
+  header.pixelWidth = width;
+  header.pixelHeight = height;
+  header.faceCount = 1;
+  header.levelCount = levelCount;
+  header.dfdByteOffset = (DWORD)(sizeof(Ktx2Header) + sizeof(Ktx2Level) * levelCount);
+  header.dfdByteLength = dfdSize;
+
+  // levels are stored smallest first, each aligned to the block size (a multiple of 4) from the
+  // start of the file
+  DWORD alignment = textureFormat->bytesPerBlock;
+  Ktx2Level levels[STBIMAGE_MAX_MIPMAP_LEVELS];
+  size_t levelOffsets[STBIMAGE_MAX_MIPMAP_LEVELS];
+  size_t dataOffset = 0;
+  ULONGLONG fileOffset = header.dfdByteOffset + dfdSize;
+  for (int i = 0; i < levelCount; i++)
+  {
+    levelOffsets[i] = dataOffset;
+    dataOffset += GetLevelSize(textureFormat, width, height, i);
+  }
+  for (int i = levelCount - 1; i >= 0; i--)
+  {
+    fileOffset = (fileOffset + alignment - 1) / alignment * alignment;
+    levels[i].byteOffset = fileOffset;
+    levels[i].byteLength = GetLevelSize(textureFormat, width, height, i);
+    levels[i].uncompressedByteLength = levels[i].byteLength;
+    fileOffset += levels[i].byteLength;
+  }
+
+  if (fwrite(&header, sizeof(header), 1, file) != 1
+    || fwrite(levels, sizeof(Ktx2Level), levelCount, file) != (size_t)levelCount
+    || fwrite(dfd, 1, dfdSize, file) != dfdSize)
+  {
+    return 0;
+  }
+
+  static BYTE const padding[16] = { 0 };
+  ULONGLONG position = header.dfdByteOffset + dfdSize;
+  for (int i = levelCount - 1; i >= 0; i--)
+  {
+    size_t paddingSize = (size_t)(levels[i].byteOffset - position);
+    if (fwrite(padding, 1, paddingSize, file) != paddingSize
+      || fwrite(data + levelOffsets[i], 1, (size_t)levels[i].byteLength, file) != levels[i].byteLength)
+    {
+      return 0;
+    }
+    position = levels[i].byteOffset + levels[i].byteLength;
+  }
+  return 1;
+}
+
+int WriteTextureFile(
+  char const* filename, int container, int width, int height, int format, unsigned char const* data, size_t dataSize)
+{
+  // the BC7 presets differ only in how hard the encoder searched
+  int blockFormat = format == STBIMAGE_FORMAT_BC7_FAST || format == STBIMAGE_FORMAT_BC7_SLOW ? STBIMAGE_FORMAT_BC7 : format;
+  TextureFormat const* textureFormat = FindTextureFormat(blockFormat, 0, 0);
+  if (!textureFormat || width <= 0 || height <= 0)
+    return 0;
+
+  // the levels are those a load into a dataSize dest fills
+  StbImageMipmapLevel layout[STBIMAGE_MAX_MIPMAP_LEVELS];
+  int layoutCount;
+  GetMipmapLayout(width, height, format, 0, layout, &layoutCount);
+  int levelCount = 0;
+  while (levelCount < layoutCount && layout[levelCount].offset + layout[levelCount].size <= dataSize)
+    levelCount++;
+  if (levelCount == 0)
+    return 0;
+  dataSize = layout[levelCount - 1].offset + layout[levelCount - 1].size;
+
+  FILE* file;
+  if (fopen_s(&file, filename, "wb") != 0)
+    return 0;
+
+  int written;
+  switch (container)
+  {
+    case STBIMAGE_CONTAINER_DDS:
+      written = WriteDds(file, textureFormat, width, height, levelCount, data, dataSize);
+      break;
+    case STBIMAGE_CONTAINER_KTX2:
+      written = WriteKtx2(file, textureFormat, width, height, levelCount, data);
+      break;
+    default:
+      written = 0;
+      break;
+  }
+
+  written = fclose(file) == 0 && written;
+  if (!written)
+    remove(filename);
+  return written;
+}
+
+typedef struct
+{
+  TextureFormat const* textureFormat;
+  int width;
+  int height;
+  int levelCount;
+  ULONGLONG levelOffsets[STBIMAGE_MAX_MIPMAP_LEVELS]; // from the start of the file
+} TextureFileLayout;
+
+static int ReadFileBytes(ImageFile* file, ULONGLONG offset, void* dest, size_t size)
+{
+  if (file->data)
+  {
+    if (offset > file->size || size > file->size - offset)
+      return 0;
+    memcpy_s(dest, size, file->data + offset, size);
+    return 1;
+  }
+  return _fseeki64(file->file, offset, SEEK_SET) == 0 && fread(dest, 1, size, file->file) == size;
+}
+
+static int ReadDdsLayout(ImageFile* file, TextureFileLayout* layout)
+{
+  DdsHeader header;
+  if (!ReadFileBytes(file, 0, &header, sizeof(header))
+    || header.magic != DDS_MAGIC
+    || header.size != 124
+    || !(header.pixelFormatFlags & DDPF_FOURCC)
+    || header.fourCC != DDS_FOURCC_DX10
+    || header.resourceDimension != DDS_DIMENSION_TEXTURE2D
+    || header.arraySize != 1)
+  {
+    return 0;
+  }
+
+  layout->textureFormat = FindTextureFormat(0, header.dxgiFormat, 0);
+  layout->width = header.width;
+  layout->height = header.height;
+  layout->levelCount = (header.flags & DDSD_MIPMAPCOUNT) && header.mipMapCount > 0 ? header.mipMapCount : 1;
+  if (!layout->textureFormat || layout->levelCount > STBIMAGE_MAX_MIPMAP_LEVELS)
+    return 0;
+
+  ULONGLONG offset = sizeof(header);
+  for (int i = 0; i < layout->levelCount; i++)
+  {
+    layout->levelOffsets[i] = offset;
+    offset += GetLevelSize(layout->textureFormat, layout->width, layout->height, i);
+  }
+  return 1;
+}
+
+static int ReadKtx2Layout(ImageFile* file, TextureFileLayout* layout)
+{
+  Ktx2Header header;
+  if (!ReadFileBytes(file, 0, &header, sizeof(header))
+    || memcmp(header.identifier, ktx2Identifier, sizeof(ktx2Identifier)) != 0
+    || header.pixelDepth != 0
+    || header.layerCount > 1
+    || header.faceCount != 1
+    || header.supercompressionScheme != 0)
+  {
+    return 0;
+  }
+
+  layout->textureFormat = FindTextureFormat(0, 0, header.vkFormat);
+  layout->width = header.pixelWidth;
+  layout->height = header.pixelHeight;
+  layout->levelCount = header.levelCount > 0 ? header.levelCount : 1;
+  if (!layout->textureFormat || layout->levelCount > STBIMAGE_MAX_MIPMAP_LEVELS)
+    return 0;
+
+  Ktx2Level levels[STBIMAGE_MAX_MIPMAP_LEVELS];
+  if (!ReadFileBytes(file, sizeof(header), levels, sizeof(Ktx2Level) * layout->levelCount))
+    return 0;
+  for (int i = 0; i < layout->levelCount; i++)
+  {
+    if (levels[i].byteLength != GetLevelSize(layout->textureFormat, layout->width, layout->height, i))
+      return 0;
+    layout->levelOffsets[i] = levels[i].byteOffset;
+  }
+  return 1;
+}
+
+static int ReadTextureFileLayout(ImageFile* file, TextureFileLayout* layout)
+{
+  return ReadDdsLayout(file, layout) || ReadKtx2Layout(file, layout);
+}
+
+int GetTextureFileInfo(char const* filename, int* width, int* height, int* format, int* levelCount)
+{
+  ImageFile file;
+  if (!OpenImageFile(filename, &file))
+    return 0;
+
+  TextureFileLayout layout;
+  int result = ReadTextureFileLayout(&file, &layout);
+  CloseImageFile(&file);
+  if (!result)
+    return 0;
+
+  if (width)
+    *width = layout.width;
+  if (height)
+    *height = layout.height;
+  if (format)
+    *format = layout.textureFormat->format;
+  if (levelCount)
+    *levelCount = layout.levelCount;
+  return 1;
+}
+
+int ReadTextureFile(char const* filename, unsigned char* dest, size_t destSize)
+{
+  ImageFile file;
+  if (!OpenImageFile(filename, &file))
+    return 0;
+
+  TextureFileLayout layout;
+  int result = ReadTextureFileLayout(&file, &layout);
+
+  // copy as many levels as fit, in the same layout ReadImageAsBCx writes
+  for (int i = 0; result && i < layout.levelCount; i++)
+  {
+    size_t levelSize = GetLevelSize(layout.textureFormat, layout.width, layout.height, i);
+    if (levelSize > destSize)
+      break;
+    result = ReadFileBytes(&file, layout.levelOffsets[i], dest, levelSize);
+    dest += levelSize;
+    destSize -= levelSize;
+  }
+
+  CloseImageFile(&file);
+  return result;
+}
@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <windows.h>
+#include "ThreadPool.h"
+
+static INIT_ONCE poolInitOnce = INIT_ONCE_STATIC_INIT;
+static PTP_POOL pool;
+static TP_CALLBACK_ENVIRON poolEnvironment;
+static volatile LONG poolSize; // 0 until first use or SetThreadPoolSize
+
+typedef struct
+{
+  ParallelForCallback callback;
+  void* context;
+  LONG count;
+  volatile LONG nextIndex;
+} ParallelForJob;
+
+static int GetDefaultThreadPoolSize(void)
+{
+  SYSTEM_INFO systemInfo;
+  GetSystemInfo(&systemInfo);
+  return systemInfo.dwNumberOfProcessors > 0 ? (int)systemInfo.dwNumberOfProcessors : 1;
+}
+
+static BOOL CALLBACK InitializeThreadPool(PINIT_ONCE initOnce, PVOID parameter, PVOID* context)
+{
+  pool = CreateThreadpool(NULL);
+  if (!pool)
+    return FALSE;
+
+  InitializeThreadpoolEnvironment(&poolEnvironment);
+  SetThreadpoolCallbackPool(&poolEnvironment, pool);
+  SetThreadpoolThreadMaximum(pool, GetThreadPoolSize());
+  return TRUE;
+}
+
+void SetThreadPoolSize(int threadCount)
+{
+  if (threadCount <= 0)
+    threadCount = GetDefaultThreadPoolSize();
+  InterlockedExchange(&poolSize, threadCount);
+
+  // the pool itself is only created on first use; if it already exists, resize it
+  BOOL pending;
+  if (InitOnceBeginInitialize(&poolInitOnce, INIT_ONCE_CHECK_ONLY, &pending, NULL) && !pending)
+    SetThreadpoolThreadMaximum(pool, threadCount);
+}
+
+int GetThreadPoolSize(void)
+{
+  LONG size = poolSize;
+  if (size == 0)
+  {
+    InterlockedCompareExchange(&poolSize, GetDefaultThreadPoolSize(), 0);
+    size = poolSize;
+  }
+  return size;
+}
+
+static void RunParallelForJob(ParallelForJob* job)
+{
+  LONG index;
+  while ((index = InterlockedIncrement(&job->nextIndex) - 1) < job->count)
+    job->callback(job->context, index);
+}
+
+static VOID CALLBACK ParallelForWorkCallback(PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_WORK work)
+{
+  RunParallelForJob((ParallelForJob*)context);
+}
+
+void ParallelFor(int count, ParallelForCallback callback, void* context)
+{
+  ParallelForJob job = { callback, context, count, 0 };
+  int helperCount = min(GetThreadPoolSize(), count) - 1;
+
+  PTP_WORK work = NULL;
+  if (helperCount > 0 && InitOnceExecuteOnce(&poolInitOnce, InitializeThreadPool, NULL, NULL))
+    work = CreateThreadpoolWork(ParallelForWorkCallback, &job, &poolEnvironment);
+
+  if (work)
+  {
+    for (int i = 0; i < helperCount; i++)
+      SubmitThreadpoolWork(work);
+  }
+
+  // the calling thread claims indices alongside the helpers, so the job completes even if no
+  // helper ever gets scheduled (e.g. when called from a pool thread while the pool is saturated)
+  RunParallelForJob(&job);
+
+  if (work)
+  {
+    // every index has been claimed; cancel helpers that never started and wait for the rest
+    WaitForThreadpoolWorkCallbacks(work, TRUE);
+    CloseThreadpoolWork(work);
+  }
+}
+
+typedef struct
+{
+  void (*callback)(void* context);
+  void* context;
+} QueuedWork;
+
+static VOID CALLBACK QueuedWorkCallback(PTP_CALLBACK_INSTANCE instance, PVOID context)
+{
+  QueuedWork work = *(QueuedWork*)context;
+  free(context);
+  work.callback(work.context);
+}
+
+int QueueThreadPoolWork(void (*callback)(void* context), void* context)
+{
+  if (!InitOnceExecuteOnce(&poolInitOnce, InitializeThreadPool, NULL, NULL))
+    return 0;
+
+  QueuedWork* work = (QueuedWork*)malloc(sizeof(QueuedWork));
+  if (!work)
+    return 0;
+
+  work->callback = callback;
+  work->context = context;
+  if (!TrySubmitThreadpoolCallback(QueuedWorkCallback, work, &poolEnvironment))
+  {
+    free(work);
+    return 0;
+  }
+  return 1;
+}
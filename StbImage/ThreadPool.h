@@ -0,0 +1,36 @@
+#pragma once
+
+/** @brief Callback run by ParallelFor once for every index in [0, count).
+ *
+ *  @param context the context pointer passed to ParallelFor
+ *  @param index the index of the work item to run
+ */
+typedef void (*ParallelForCallback)(void* context, int index);
+
+/** @brief Sets the number of threads used by ParallelFor, including the calling thread.
+ *
+ *  @param threadCount the number of threads to use, or 0 to use one thread per logical processor
+ */
+void SetThreadPoolSize(int threadCount);
+
+/** @brief Returns the number of threads used by ParallelFor, including the calling thread. */
+int GetThreadPoolSize(void);
+
+/** @brief Runs callback for every index in [0, count), spread across the worker pool.
+ *
+ *  The calling thread takes part in the work, so ParallelFor may safely be called from
+ *  inside another ParallelFor callback. Returns once every index has been processed.
+ *
+ *  @param count the number of work items
+ *  @param callback the function to run for each work item
+ *  @param context opaque pointer passed through to callback
+ */
+void ParallelFor(int count, ParallelForCallback callback, void* context);
+
+/** @brief Queues callback to run once on a pool thread and returns without waiting for it.
+ *
+ *  @param callback the function to run
+ *  @param context opaque pointer passed through to callback
+ *  @return nonzero if the callback was queued
+ */
+int QueueThreadPoolWork(void (*callback)(void* context), void* context);
@@ -58,6 +58,8 @@ extern "C" {
   STBDDEF void stb_compress_dxt_block(unsigned char* dest, const unsigned char* src_rgba_four_bytes_per_pixel, int alpha, int mode);
   STBDDEF void stb_compress_bc4_block(unsigned char* dest, const unsigned char* src_r_one_byte_per_pixel);
   STBDDEF void stb_compress_bc5_block(unsigned char* dest, const unsigned char* src_rg_two_byte_per_pixel);
+  // same as stb_compress_bc5_block, but reads red and green straight from a 4x4 RGBA block
+  STBDDEF void stb_compress_bc5_block_rgba(unsigned char* dest, const unsigned char* src_rgba_four_bytes_per_pixel);
 
 #define STB_COMPRESS_DXT_BLOCK
 
@@ -82,6 +84,12 @@ extern "C" {
 //     you also see "(a*5 + b*3) / 8" on some old GPU designs.
 // #define STB_DXT_USE_ROUNDING_BIAS
 
+// STB_DXT_NO_SIMD
+//     disable the SSE2 color and alpha block encoders. on x86 targets they are used by default
+//     (after a CPUID check on 32-bit MSVC builds) and produce exactly the same output as the
+//     scalar code, since every step up to the float power iteration is done in integer arithmetic.
+// #define STB_DXT_NO_SIMD
+
 #include <stdlib.h>
 
 #if !defined(STBD_FABS)
@@ -92,6 +100,29 @@ extern "C" {
 #define STBD_FABS(x)          fabs(x)
 #endif
 
+#if !defined(STB_DXT_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || (defined(_MSC_VER) && defined(_M_IX86)) || (defined(__i386) && defined(__SSE2__)))
+#define STB_DXT_SSE2
+#include <emmintrin.h>
+
+#if defined(_MSC_VER) && defined(_M_IX86)
+#include <intrin.h> // __cpuid
+static int stb__sse2_available(void)
+{
+  // benign race: every thread computes the same value
+  static int available = -1;
+  if (available < 0) {
+    int info[4];
+    __cpuid(info, 1);
+    available = (info[3] >> 26) & 1;
+  }
+  return available;
+}
+#else
+// x64 always has SSE2, and GCC/Clang only get here when compiling with -msse2
+#define stb__sse2_available() 1
+#endif
+#endif
+
 static const unsigned char stb__OMatch5[256][2] = {
    {  0,  0 }, {  0,  0 }, {  0,  1 }, {  0,  1 }, {  1,  0 }, {  1,  0 }, {  1,  0 }, {  1,  1 },
    {  1,  1 }, {  1,  1 }, {  1,  2 }, {  0,  4 }, {  2,  1 }, {  2,  1 }, {  2,  1 }, {  2,  2 },
@@ -259,20 +290,60 @@ static unsigned int stb__MatchColorsBlock(unsigned char* block, unsigned char* c
   return mask;
 }
 
+// convert covariance matrix to float, find principal axis via power iter
+static void stb__PrincipalAxis(const int* cov, const int* min, const int* max, int* v_r, int* v_g, int* v_b)
+{
+  static const int nIterPower = 4;
+  float covf[6], vfr, vfg, vfb;
+  double magn;
+  int i, iter;
+
+  for (i = 0; i < 6; i++)
+    covf[i] = cov[i] / 255.0f;
+
+  vfr = (float)(max[0] - min[0]);
+  vfg = (float)(max[1] - min[1]);
+  vfb = (float)(max[2] - min[2]);
+
+  for (iter = 0; iter < nIterPower; iter++)
+  {
+    float r = vfr * covf[0] + vfg * covf[1] + vfb * covf[2];
+    float g = vfr * covf[1] + vfg * covf[3] + vfb * covf[4];
+    float b = vfr * covf[2] + vfg * covf[4] + vfb * covf[5];
+
+    vfr = r;
+    vfg = g;
+    vfb = b;
+  }
+
+  magn = STBD_FABS(vfr);
+  if (STBD_FABS(vfg) > magn) magn = STBD_FABS(vfg);
+  if (STBD_FABS(vfb) > magn) magn = STBD_FABS(vfb);
+
+  if (magn < 4.0f) { // too small, default to luminance
+    *v_r = 299; // JPEG YCbCr luma coefs, scaled by 1000.
+    *v_g = 587;
+    *v_b = 114;
+  }
+  else {
+    magn = 512.0 / magn;
+    *v_r = (int)(vfr * magn);
+    *v_g = (int)(vfg * magn);
+    *v_b = (int)(vfb * magn);
+  }
+}
+
 // The color optimization function. (Clever code, part 1)
 static void stb__OptimizeColorsBlock(unsigned char* block, unsigned short* pmax16, unsigned short* pmin16)
 {
   int mind, maxd;
   unsigned char* minp, * maxp;
-  double magn;
   int v_r, v_g, v_b;
-  static const int nIterPower = 4;
-  float covf[6], vfr, vfg, vfb;
 
   // determine color distribution
   int cov[6];
   int mu[3], min[3], max[3];
-  int ch, i, iter;
+  int ch, i;
 
   for (ch = 0; ch < 3; ch++)
   {
@@ -310,40 +381,7 @@ static void stb__OptimizeColorsBlock(unsigned char* block, unsigned short* pmax1
     cov[5] += b * b;
   }
 
-  // convert covariance matrix to float, find principal axis via power iter
-  for (i = 0; i < 6; i++)
-    covf[i] = cov[i] / 255.0f;
-
-  vfr = (float)(max[0] - min[0]);
-  vfg = (float)(max[1] - min[1]);
-  vfb = (float)(max[2] - min[2]);
-
-  for (iter = 0; iter < nIterPower; iter++)
-  {
-    float r = vfr * covf[0] + vfg * covf[1] + vfb * covf[2];
-    float g = vfr * covf[1] + vfg * covf[3] + vfb * covf[4];
-    float b = vfr * covf[2] + vfg * covf[4] + vfb * covf[5];
-
-    vfr = r;
-    vfg = g;
-    vfb = b;
-  }
-
-  magn = STBD_FABS(vfr);
-  if (STBD_FABS(vfg) > magn) magn = STBD_FABS(vfg);
-  if (STBD_FABS(vfb) > magn) magn = STBD_FABS(vfb);
-
-  if (magn < 4.0f) { // too small, default to luminance
-    v_r = 299; // JPEG YCbCr luma coefs, scaled by 1000.
-    v_g = 587;
-    v_b = 114;
-  }
-  else {
-    magn = 512.0 / magn;
-    v_r = (int)(vfr * magn);
-    v_g = (int)(vfg * magn);
-    v_b = (int)(vfb * magn);
-  }
+  stb__PrincipalAxis(cov, min, max, &v_r, &v_g, &v_b);
 
   minp = maxp = block;
   mind = maxd = block[0] * v_r + block[1] * v_g + block[2] * v_b;
@@ -397,17 +435,36 @@ static unsigned short stb__Quantize6(float x)
   return q;
 }
 
+// solve the least squares system for the refined endpoints, given the accumulated sums
+static void stb__SolveEndpoints(int At1_r, int At1_g, int At1_b, int At2_r, int At2_g, int At2_b,
+                                int xx, int yy, int xy, unsigned short* pmax16, unsigned short* pmin16)
+{
+  float f = 3.0f / 255.0f / (xx * yy - xy * xy);
+  unsigned short max16, min16;
+
+  max16 = stb__Quantize5((At1_r * yy - At2_r * xy) * f) << 11;
+  max16 |= stb__Quantize6((At1_g * yy - At2_g * xy) * f) << 5;
+  max16 |= stb__Quantize5((At1_b * yy - At2_b * xy) * f) << 0;
+
+  min16 = stb__Quantize5((At2_r * xx - At1_r * xy) * f) << 11;
+  min16 |= stb__Quantize6((At2_g * xx - At1_g * xy) * f) << 5;
+  min16 |= stb__Quantize5((At2_b * xx - At1_b * xy) * f) << 0;
+
+  *pmax16 = max16;
+  *pmin16 = min16;
+}
+
+static const int stb__w1Tab[4] = { 3,0,2,1 };
+
 // The refinement function. (Clever code, part 2)
 // Tries to optimize colors to suit block contents better.
 // (By solving a least squares system via normal equations+Cramer's rule)
 static int stb__RefineBlock(unsigned char* block, unsigned short* pmax16, unsigned short* pmin16, unsigned int mask)
 {
-  static const int w1Tab[4] = { 3,0,2,1 };
   static const int prods[4] = { 0x090000,0x000900,0x040102,0x010402 };
   // ^some magic to save a lot of multiplies in the accumulating loop...
   // (precomputed products of weights for least squares system, accumulated inside one 32-bit register)
 
-  float f;
   unsigned short oldMin, oldMax, min16, max16;
   int i, akku = 0, xx, xy, yy;
   int At1_r, At1_g, At1_b;
@@ -438,7 +495,7 @@ static int stb__RefineBlock(unsigned char* block, unsigned short* pmax16, unsign
     At2_r = At2_g = At2_b = 0;
     for (i = 0; i < 16; ++i, cm >>= 2) {
       int step = cm & 3;
-      int w1 = w1Tab[step];
+      int w1 = stb__w1Tab[step];
       int r = block[i * 4 + 0];
       int g = block[i * 4 + 1];
       int b = block[i * 4 + 2];
@@ -461,15 +518,247 @@ static int stb__RefineBlock(unsigned char* block, unsigned short* pmax16, unsign
     yy = (akku >> 8) & 0xff;
     xy = (akku >> 0) & 0xff;
 
-    f = 3.0f / 255.0f / (xx * yy - xy * xy);
+    stb__SolveEndpoints(At1_r, At1_g, At1_b, At2_r, At2_g, At2_b, xx, yy, xy, &max16, &min16);
+  }
+
+  *pmin16 = min16;
+  *pmax16 = max16;
+  return oldMin != min16 || oldMax != max16;
+}
+
+#ifdef STB_DXT_SSE2
+// SSE2 versions of the color block functions above. they work on a planar copy of the block
+// with 16-bit lanes, so every product and sum is exact and the results match the scalar code
+// bit for bit.
+
+typedef struct
+{
+  __m128i r[2], g[2], b[2]; // pixels 0-7 and 8-15, one channel per 16-bit lane
+  int sum[3];
+} stb__PlanarBlock;
+
+static int stb__HorizontalSum32(__m128i v)
+{
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(v);
+}
+
+// sum over all 16 pixels of a[i] * b[i]
+static int stb__DotProduct16(const __m128i* a, const __m128i* b)
+{
+  return stb__HorizontalSum32(_mm_add_epi32(_mm_madd_epi16(a[0], b[0]), _mm_madd_epi16(a[1], b[1])));
+}
+
+static void stb__LoadPlanarBlock(stb__PlanarBlock* p, const unsigned char* block)
+{
+  const __m128i byteMask = _mm_set1_epi32(0xff);
+  const __m128i ones[2] = { _mm_set1_epi16(1), _mm_set1_epi16(1) };
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    __m128i lo = _mm_loadu_si128((const __m128i*)(block + i * 32));
+    __m128i hi = _mm_loadu_si128((const __m128i*)(block + i * 32 + 16));
+    p->r[i] = _mm_packs_epi32(_mm_and_si128(lo, byteMask), _mm_and_si128(hi, byteMask));
+    p->g[i] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), byteMask), _mm_and_si128(_mm_srli_epi32(hi, 8), byteMask));
+    p->b[i] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), byteMask), _mm_and_si128(_mm_srli_epi32(hi, 16), byteMask));
+  }
+
+  p->sum[0] = stb__DotProduct16(p->r, ones);
+  p->sum[1] = stb__DotProduct16(p->g, ones);
+  p->sum[2] = stb__DotProduct16(p->b, ones);
+}
 
-    max16 = stb__Quantize5((At1_r * yy - At2_r * xy) * f) << 11;
-    max16 |= stb__Quantize6((At1_g * yy - At2_g * xy) * f) << 5;
-    max16 |= stb__Quantize5((At1_b * yy - At2_b * xy) * f) << 0;
+// dot products of the 16 pixels with (dr, dg, db), four pixels per register
+static void stb__ProjectPlanarBlock(__m128i* dots, const stb__PlanarBlock* p, int dr, int dg, int db)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i rg = _mm_set1_epi32((dg << 16) | (dr & 0xffff));
+  __m128i b0 = _mm_set1_epi32(db & 0xffff);
+  int i;
 
-    min16 = stb__Quantize5((At2_r * xx - At1_r * xy) * f) << 11;
-    min16 |= stb__Quantize6((At2_g * xx - At1_g * xy) * f) << 5;
-    min16 |= stb__Quantize5((At2_b * xx - At1_b * xy) * f) << 0;
+  for (i = 0; i < 2; i++) {
+    dots[i * 2 + 0] = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(p->r[i], p->g[i]), rg),
+                                    _mm_madd_epi16(_mm_unpacklo_epi16(p->b[i], zero), b0));
+    dots[i * 2 + 1] = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(p->r[i], p->g[i]), rg),
+                                    _mm_madd_epi16(_mm_unpackhi_epi16(p->b[i], zero), b0));
+  }
+}
+
+// 16-bit mask with bit i set where the 32-bit lane for pixel i is all ones
+static int stb__MoveMask16(const __m128i* m)
+{
+  return _mm_movemask_epi8(_mm_packs_epi16(_mm_packs_epi32(m[0], m[1]), _mm_packs_epi32(m[2], m[3])));
+}
+
+// spreads the low 16 bits of x to the even bits of the result
+static unsigned int stb__SpreadBits(unsigned int x)
+{
+  x = (x | (x << 8)) & 0x00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  return x;
+}
+
+static int stb__LowestSetBit(int x)
+{
+  int i = 0;
+  while (!(x & (1 << i)))
+    i++;
+  return i;
+}
+
+static unsigned int stb__MatchColorsBlockSSE2(const stb__PlanarBlock* p, unsigned char* color)
+{
+  int dirr = color[0 * 4 + 0] - color[1 * 4 + 0];
+  int dirg = color[0 * 4 + 1] - color[1 * 4 + 1];
+  int dirb = color[0 * 4 + 2] - color[1 * 4 + 2];
+  int stops[4];
+  __m128i dots[4], lowHalf[4], highBit[4];
+  __m128i c0Point, halfPoint, c3Point;
+  int i;
+
+  for (i = 0; i < 4; i++)
+    stops[i] = color[i * 4 + 0] * dirr + color[i * 4 + 1] * dirg + color[i * 4 + 2] * dirb;
+
+  // same crossover points as stb__MatchColorsBlock
+  c0Point = _mm_set1_epi32(stops[1] + stops[3]);
+  halfPoint = _mm_set1_epi32(stops[3] + stops[2]);
+  c3Point = _mm_set1_epi32(stops[2] + stops[0]);
+
+  stb__ProjectPlanarBlock(dots, p, dirr, dirg, dirb);
+  for (i = 0; i < 4; i++) {
+    __m128i dot = _mm_slli_epi32(dots[i], 1);
+    __m128i belowHalf = _mm_cmplt_epi32(dot, halfPoint);
+    __m128i belowC0 = _mm_cmplt_epi32(dot, c0Point);
+    __m128i belowC3 = _mm_cmplt_epi32(dot, c3Point);
+
+    // indices are 1/3 below the half point and 2/0 above it; the high bit is set for 3 and 2
+    lowHalf[i] = belowHalf;
+    highBit[i] = _mm_or_si128(_mm_andnot_si128(belowC0, belowHalf), _mm_andnot_si128(belowHalf, belowC3));
+  }
+
+  return stb__SpreadBits(stb__MoveMask16(lowHalf)) | (stb__SpreadBits(stb__MoveMask16(highBit)) << 1);
+}
+
+static int stb__HorizontalMin16(__m128i v)
+{
+  v = _mm_min_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_min_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  v = _mm_min_epi16(v, _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return (short)_mm_cvtsi128_si32(v);
+}
+
+static int stb__HorizontalMax16(__m128i v)
+{
+  v = _mm_max_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_max_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  v = _mm_max_epi16(v, _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return (short)_mm_cvtsi128_si32(v);
+}
+
+static void stb__OptimizeColorsBlockSSE2(const stb__PlanarBlock* p, const unsigned char* block,
+                                         unsigned short* pmax16, unsigned short* pmin16)
+{
+  const __m128i* planes[3] = { p->r, p->g, p->b };
+  __m128i delta[3][2], dots[4], minDot, maxDot, minMask[4], maxMask[4];
+  int cov[6], min[3], max[3];
+  int v_r, v_g, v_b;
+  int ch, i, minIndex, maxIndex;
+  const unsigned char* minp, * maxp;
+
+  // determine color distribution
+  for (ch = 0; ch < 3; ch++) {
+    __m128i mu = _mm_set1_epi16((short)((p->sum[ch] + 8) >> 4));
+    min[ch] = stb__HorizontalMin16(_mm_min_epi16(planes[ch][0], planes[ch][1]));
+    max[ch] = stb__HorizontalMax16(_mm_max_epi16(planes[ch][0], planes[ch][1]));
+    delta[ch][0] = _mm_sub_epi16(planes[ch][0], mu);
+    delta[ch][1] = _mm_sub_epi16(planes[ch][1], mu);
+  }
+
+  // determine covariance matrix
+  cov[0] = stb__DotProduct16(delta[0], delta[0]);
+  cov[1] = stb__DotProduct16(delta[0], delta[1]);
+  cov[2] = stb__DotProduct16(delta[0], delta[2]);
+  cov[3] = stb__DotProduct16(delta[1], delta[1]);
+  cov[4] = stb__DotProduct16(delta[1], delta[2]);
+  cov[5] = stb__DotProduct16(delta[2], delta[2]);
+
+  stb__PrincipalAxis(cov, min, max, &v_r, &v_g, &v_b);
+
+  // pick colors at extreme points; ties go to the lowest pixel index, as in the scalar loop
+  stb__ProjectPlanarBlock(dots, p, v_r, v_g, v_b);
+  minDot = maxDot = dots[0];
+  for (i = 1; i < 4; i++) {
+    __m128i less = _mm_cmplt_epi32(dots[i], minDot);
+    __m128i greater = _mm_cmpgt_epi32(dots[i], maxDot);
+    minDot = _mm_or_si128(_mm_and_si128(less, dots[i]), _mm_andnot_si128(less, minDot));
+    maxDot = _mm_or_si128(_mm_and_si128(greater, dots[i]), _mm_andnot_si128(greater, maxDot));
+  }
+  for (i = 0; i < 2; i++) {
+    __m128i shuffledMin = _mm_shuffle_epi32(minDot, i ? _MM_SHUFFLE(2, 3, 0, 1) : _MM_SHUFFLE(1, 0, 3, 2));
+    __m128i shuffledMax = _mm_shuffle_epi32(maxDot, i ? _MM_SHUFFLE(2, 3, 0, 1) : _MM_SHUFFLE(1, 0, 3, 2));
+    __m128i less = _mm_cmplt_epi32(shuffledMin, minDot);
+    __m128i greater = _mm_cmpgt_epi32(shuffledMax, maxDot);
+    minDot = _mm_or_si128(_mm_and_si128(less, shuffledMin), _mm_andnot_si128(less, minDot));
+    maxDot = _mm_or_si128(_mm_and_si128(greater, shuffledMax), _mm_andnot_si128(greater, maxDot));
+  }
+  for (i = 0; i < 4; i++) {
+    minMask[i] = _mm_cmpeq_epi32(dots[i], minDot);
+    maxMask[i] = _mm_cmpeq_epi32(dots[i], maxDot);
+  }
+  minIndex = stb__LowestSetBit(stb__MoveMask16(minMask));
+  maxIndex = stb__LowestSetBit(stb__MoveMask16(maxMask));
+
+  minp = block + minIndex * 4;
+  maxp = block + maxIndex * 4;
+  *pmax16 = stb__As16Bit(maxp[0], maxp[1], maxp[2]);
+  *pmin16 = stb__As16Bit(minp[0], minp[1], minp[2]);
+}
+
+static int stb__RefineBlockSSE2(const stb__PlanarBlock* p, unsigned short* pmax16, unsigned short* pmin16, unsigned int mask)
+{
+  unsigned short oldMin, oldMax, min16, max16;
+
+  oldMin = *pmin16;
+  oldMax = *pmax16;
+
+  if ((mask ^ (mask << 2)) < 4) // all pixels have the same index?
+  {
+    // yes, linear system would be singular; solve using optimal
+    // single-color match on average color
+    int r = (p->sum[0] + 8) >> 4, g = (p->sum[1] + 8) >> 4, b = (p->sum[2] + 8) >> 4;
+
+    max16 = (stb__OMatch5[r][0] << 11) | (stb__OMatch6[g][0] << 5) | stb__OMatch5[b][0];
+    min16 = (stb__OMatch5[r][1] << 11) | (stb__OMatch6[g][1] << 5) | stb__OMatch5[b][1];
+  }
+  else {
+    short weights[16];
+    __m128i w1[2], w2[2];
+    int i, xx, yy, xy;
+    int At1_r, At1_g, At1_b;
+    int At2_r, At2_g, At2_b;
+
+    for (i = 0; i < 16; i++)
+      weights[i] = (short)stb__w1Tab[(mask >> (i * 2)) & 3];
+    w1[0] = _mm_loadu_si128((const __m128i*)(weights + 0));
+    w1[1] = _mm_loadu_si128((const __m128i*)(weights + 8));
+    w2[0] = _mm_sub_epi16(_mm_set1_epi16(3), w1[0]);
+    w2[1] = _mm_sub_epi16(_mm_set1_epi16(3), w1[1]);
+
+    At1_r = stb__DotProduct16(p->r, w1);
+    At1_g = stb__DotProduct16(p->g, w1);
+    At1_b = stb__DotProduct16(p->b, w1);
+    At2_r = 3 * p->sum[0] - At1_r;
+    At2_g = 3 * p->sum[1] - At1_g;
+    At2_b = 3 * p->sum[2] - At1_b;
+
+    xx = stb__DotProduct16(w1, w1);
+    yy = stb__DotProduct16(w2, w2);
+    xy = stb__DotProduct16(w1, w2);
+
+    stb__SolveEndpoints(At1_r, At1_g, At1_b, At2_r, At2_g, At2_b, xx, yy, xy, &max16, &min16);
   }
 
   *pmin16 = min16;
@@ -477,6 +766,52 @@ static int stb__RefineBlock(unsigned char* block, unsigned short* pmax16, unsign
   return oldMin != min16 || oldMax != max16;
 }
 
+// the refinement loop of stb__CompressColorBlock, on a planar copy of the block
+static void stb__CompressColorBlockSSE2(unsigned char* block, int refinecount,
+                                        unsigned short* pmax16, unsigned short* pmin16, unsigned int* pmask)
+{
+  stb__PlanarBlock planar;
+  unsigned short max16, min16;
+  unsigned char color[4 * 4];
+  unsigned int mask;
+  int i;
+
+  stb__LoadPlanarBlock(&planar, block);
+
+  // first step: PCA+map along principal axis
+  stb__OptimizeColorsBlockSSE2(&planar, block, &max16, &min16);
+  if (max16 != min16) {
+    stb__EvalColors(color, max16, min16);
+    mask = stb__MatchColorsBlockSSE2(&planar, color);
+  }
+  else
+    mask = 0;
+
+  // third step: refine (multiple times if requested)
+  for (i = 0; i < refinecount; i++) {
+    unsigned int lastmask = mask;
+
+    if (stb__RefineBlockSSE2(&planar, &max16, &min16, mask)) {
+      if (max16 != min16) {
+        stb__EvalColors(color, max16, min16);
+        mask = stb__MatchColorsBlockSSE2(&planar, color);
+      }
+      else {
+        mask = 0;
+        break;
+      }
+    }
+
+    if (mask == lastmask)
+      break;
+  }
+
+  *pmax16 = max16;
+  *pmin16 = min16;
+  *pmask = mask;
+}
+#endif // STB_DXT_SSE2
+
 // Color block compression
 static void stb__CompressColorBlock(unsigned char* dest, unsigned char* block, int mode)
 {
@@ -499,6 +834,11 @@ static void stb__CompressColorBlock(unsigned char* dest, unsigned char* block, i
     max16 = (stb__OMatch5[r][0] << 11) | (stb__OMatch6[g][0] << 5) | stb__OMatch5[b][0];
     min16 = (stb__OMatch5[r][1] << 11) | (stb__OMatch6[g][1] << 5) | stb__OMatch5[b][1];
   }
+#ifdef STB_DXT_SSE2
+  else if (stb__sse2_available()) {
+    stb__CompressColorBlockSSE2(block, refinecount, &max16, &min16, &mask);
+  }
+#endif
   else {
     // first step: PCA+map along principal axis
     stb__OptimizeColorsBlock(block, &max16, &min16);
@@ -601,12 +941,114 @@ static void stb__CompressAlphaBlock(unsigned char* dest, unsigned char* src, int
   }
 }
 
+#ifdef STB_DXT_SSE2
+// SSE2 version of stb__CompressAlphaBlock. src points at the first byte of pixel 0 and the
+// block is stored with stride bytes (1, 2 or 4) per pixel; channel selects the byte to encode.
+// never reads outside the 16*stride bytes of the block, and matches the scalar code exactly.
+static void stb__CompressAlphaBlockSSE2(unsigned char* dest, const unsigned char* src, int stride, int channel)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i v, mnv, mxv, lo, hi, a[2], ind[2], packed;
+  int i, mn, mx, dist, bias;
+  unsigned int bits01, bits23;
+
+  // gather the 16 values into one register
+  if (stride == 1)
+    v = _mm_loadu_si128((const __m128i*)src);
+  else if (stride == 2) {
+    const __m128i mask = _mm_set1_epi16(0xff);
+    lo = _mm_and_si128(_mm_srli_epi16(_mm_loadu_si128((const __m128i*)src), channel * 8), mask);
+    hi = _mm_and_si128(_mm_srli_epi16(_mm_loadu_si128((const __m128i*)(src + 16)), channel * 8), mask);
+    v = _mm_packus_epi16(lo, hi);
+  }
+  else {
+    const __m128i mask = _mm_set1_epi32(0xff);
+    __m128i p0 = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src + 0)), channel * 8), mask);
+    __m128i p1 = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src + 16)), channel * 8), mask);
+    __m128i p2 = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src + 32)), channel * 8), mask);
+    __m128i p3 = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i*)(src + 48)), channel * 8), mask);
+    v = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+  }
+
+  // find min/max color
+  mnv = _mm_min_epu8(v, _mm_srli_si128(v, 8));
+  mxv = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+  mnv = _mm_min_epu8(mnv, _mm_srli_si128(mnv, 4));
+  mxv = _mm_max_epu8(mxv, _mm_srli_si128(mxv, 4));
+  mnv = _mm_min_epu8(mnv, _mm_srli_si128(mnv, 2));
+  mxv = _mm_max_epu8(mxv, _mm_srli_si128(mxv, 2));
+  mnv = _mm_min_epu8(mnv, _mm_srli_si128(mnv, 1));
+  mxv = _mm_max_epu8(mxv, _mm_srli_si128(mxv, 1));
+  mn = _mm_cvtsi128_si32(mnv) & 0xff;
+  mx = _mm_cvtsi128_si32(mxv) & 0xff;
+
+  // encode them
+  dest[0] = (unsigned char)mx;
+  dest[1] = (unsigned char)mn;
+  dest += 2;
+
+  // same index selection as the scalar code, in 16-bit lanes: a = (v - mn) * 7 + bias
+  // stays within [-1, 1914]
+  dist = mx - mn;
+  bias = (dist < 8) ? (dist - 1) : (dist / 2 + 2);
+  a[0] = _mm_unpacklo_epi8(v, zero);
+  a[1] = _mm_unpackhi_epi8(v, zero);
+  for (i = 0; i < 2; i++) {
+    const __m128i dist4 = _mm_set1_epi16((short)(dist * 4)), dist2 = _mm_set1_epi16((short)(dist * 2));
+    __m128i t, x;
+    x = _mm_sub_epi16(a[i], _mm_set1_epi16((short)mn));
+    x = _mm_add_epi16(_mm_sub_epi16(_mm_slli_epi16(x, 3), x), _mm_set1_epi16((short)bias));
+
+    // select index. this is a "linear scale" lerp factor between 0 (val=min) and 7 (val=max).
+    t = _mm_cmpgt_epi16(dist4, x); // a < dist4
+    ind[i] = _mm_andnot_si128(t, _mm_set1_epi16(4));
+    x = _mm_sub_epi16(x, _mm_andnot_si128(t, dist4));
+    t = _mm_cmpgt_epi16(dist2, x);
+    ind[i] = _mm_add_epi16(ind[i], _mm_andnot_si128(t, _mm_set1_epi16(2)));
+    x = _mm_sub_epi16(x, _mm_andnot_si128(t, dist2));
+    t = _mm_cmpgt_epi16(_mm_set1_epi16((short)dist), x);
+    ind[i] = _mm_add_epi16(ind[i], _mm_andnot_si128(t, _mm_set1_epi16(1)));
+
+    // turn linear scale into DXT index (0/1 are extremal pts)
+    ind[i] = _mm_and_si128(_mm_sub_epi16(zero, ind[i]), _mm_set1_epi16(7));
+    ind[i] = _mm_xor_si128(ind[i], _mm_and_si128(_mm_cmpgt_epi16(_mm_set1_epi16(2), ind[i]), _mm_set1_epi16(1)));
+  }
+
+  // pack pairs of 3-bit indices into 6 bits, then pairs of those into 12 bits per 32-bit lane
+  lo = _mm_madd_epi16(ind[0], _mm_set1_epi32(0x00080001));
+  hi = _mm_madd_epi16(ind[1], _mm_set1_epi32(0x00080001));
+  packed = _mm_madd_epi16(_mm_packs_epi32(lo, hi), _mm_set1_epi32(0x00400001));
+
+  // write indices: four groups of 12 bits
+  bits01 = (unsigned int)_mm_cvtsi128_si32(packed) | ((unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(packed, 4)) << 12);
+  bits23 = (unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(packed, 8)) | ((unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(packed, 12)) << 12);
+  dest[0] = (unsigned char)bits01;
+  dest[1] = (unsigned char)(bits01 >> 8);
+  dest[2] = (unsigned char)(bits01 >> 16);
+  dest[3] = (unsigned char)bits23;
+  dest[4] = (unsigned char)(bits23 >> 8);
+  dest[5] = (unsigned char)(bits23 >> 16);
+}
+#endif // STB_DXT_SSE2
+
+// encodes one channel of a block stored with stride bytes per pixel
+static void stb__CompressAlphaChannel(unsigned char* dest, const unsigned char* src, int stride, int channel)
+{
+#ifdef STB_DXT_SSE2
+  if (stb__sse2_available()) {
+    stb__CompressAlphaBlockSSE2(dest, src, stride, channel);
+    return;
+  }
+#endif
+  stb__CompressAlphaBlock(dest, (unsigned char*)src + channel, stride);
+}
+
 void stb_compress_dxt_block(unsigned char* dest, const unsigned char* src, int alpha, int mode)
 {
   unsigned char data[16][4];
   if (alpha) {
     int i;
-    stb__CompressAlphaBlock(dest, (unsigned char*)src + 3, 4);
+    stb__CompressAlphaChannel(dest, src, 4, 3);
     dest += 8;
     // make a new copy of the data in which alpha is opaque,
     // because code uses a fast test for color constancy
@@ -621,13 +1063,19 @@ void stb_compress_dxt_block(unsigned char* dest, const unsigned char* src, int a
 
 void stb_compress_bc4_block(unsigned char* dest, const unsigned char* src)
 {
-  stb__CompressAlphaBlock(dest, (unsigned char*)src, 1);
+  stb__CompressAlphaChannel(dest, src, 1, 0);
 }
 
 void stb_compress_bc5_block(unsigned char* dest, const unsigned char* src)
 {
-  stb__CompressAlphaBlock(dest, (unsigned char*)src, 2);
-  stb__CompressAlphaBlock(dest + 8, (unsigned char*)src + 1, 2);
+  stb__CompressAlphaChannel(dest, src, 2, 0);
+  stb__CompressAlphaChannel(dest + 8, src, 2, 1);
+}
+
+void stb_compress_bc5_block_rgba(unsigned char* dest, const unsigned char* src)
+{
+  stb__CompressAlphaChannel(dest, src, 4, 0);
+  stb__CompressAlphaChannel(dest + 8, src, 4, 1);
 }
 #endif // STB_DXT_IMPLEMENTATION
 
@@ -1,4 +1,9 @@
+#include "ThreadPool.h"
+
 #define STBI_ONLY_JPEG
 #define STBI_ONLY_PNG
+#define STBI_ONLY_HDR
+#define STBI_PARALLEL_FOR(count, task, context) ParallelFor(count, task, context)
+#define STBI_PARALLEL_THREADS() GetThreadPoolSize()
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
\ No newline at end of file
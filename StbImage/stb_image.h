@@ -15,6 +15,11 @@
    You can #define STBI_ASSERT(x) before the #include to avoid using assert.h.
    And #define STBI_MALLOC, STBI_REALLOC, and STBI_FREE to avoid using malloc,realloc,free
 
+   #define STBI_PARALLEL_FOR(count, task, context) to a function that runs task(context, i) for
+   every i in [0, count) on several threads and returns when all are done, and STBI_PARALLEL_THREADS()
+   to the number of threads it uses, to decode the restart intervals of large baseline JPEGs
+   held in memory concurrently.
+
 
    QUICK NOTES:
       Primarily of interest to game developers and other people who can
@@ -267,6 +272,11 @@ RECENT REVISION HISTORY:
 // (at least this is true for iOS and Android). Therefore, the NEON support is
 // toggled by a build flag: define STBI_NEON to get NEON loops.
 //
+// Where the compiler supports AVX2 (Visual C++ 2013 or later, GCC 5 or
+// Clang), wider kernels for the IDCT, YCbCr conversion, 2x2 upsampling and
+// CMYK/grayscale expansion are compiled alongside the SSE2 ones and chosen
+// by a run-time test. Define STBI_NO_AVX2 to leave them out.
+//
 // If for some reason you do not want to use any of SIMD code, or if
 // you have issues compiling it, you can disable it entirely by
 // defining STBI_NO_SIMD.
@@ -434,6 +444,44 @@ extern "C" {
   STBIDEF int stbi_convert_wchar_to_utf8(char* buffer, size_t bufferlen, const wchar_t* input);
 #endif
 
+  ////////////////////////////////////
+  //
+  // row-at-a-time interface
+  //
+  // Decodes an image and hands it to a callback one 8-bit scanline at a time, top to bottom
+  // in file order (the vertical flip setting is ignored). desired_channels must be 1..4.
+  // Sequential JPEGs whose first scan holds every component are decoded one MCU row at a
+  // time, so only a couple of MCU rows of the image are ever held in memory. Non-interlaced
+  // PNGs are inflated as their IDAT chunks are read, through a 32k window, and unfiltered
+  // and converted one row at a time, so they take a fixed amount of memory plus a few rows.
+  // Interlaced PNGs and other images are decoded in full and converted to desired_channels
+  // row by row.
+  //
+  // The callback gets the image size with every row, and returns 0 to abort the load.
+  // Returns 1 once every row has been delivered, 0 on failure or abort.
+
+  typedef int (*stbi_row_callback)(void* user, stbi_uc const* row, int y, int width, int height);
+
+  STBIDEF int stbi_load_rows_from_memory(stbi_uc const* buffer, int len, int* x, int* y, int* channels_in_file, int desired_channels, stbi_row_callback callback, void* user);
+  STBIDEF int stbi_load_rows_from_callbacks(stbi_io_callbacks const* clbk, void* clbk_user, int* x, int* y, int* channels_in_file, int desired_channels, stbi_row_callback callback, void* user);
+
+#ifndef STBI_NO_STDIO
+  STBIDEF int stbi_load_rows(char const* filename, int* x, int* y, int* channels_in_file, int desired_channels, stbi_row_callback callback, void* user);
+  STBIDEF int stbi_load_rows_from_file(FILE* f, int* x, int* y, int* channels_in_file, int desired_channels, stbi_row_callback callback, void* user);
+#endif
+
+  // Like the functions above, but JPEGs are decoded at 1/2, 1/4 or 1/8 of their size for a
+  // scale_shift of 1, 2 or 3, as libjpeg's scale_denom does: each 8x8 block goes through a 4x4,
+  // 2x2 or 1x1 IDCT whose pixels are the averages of the full IDCT's pixels they cover, and the
+  // component planes are kept at the reduced size. *x and *y receive the size delivered, which
+  // for JPEGs is the full size divided by 1 << scale_shift and rounded up. Other formats ignore
+  // scale_shift and are delivered in full.
+
+  STBIDEF int stbi_load_rows_scaled_from_memory(stbi_uc const* buffer, int len, int* x, int* y, int* channels_in_file, int desired_channels, int scale_shift, stbi_row_callback callback, void* user);
+#ifndef STBI_NO_STDIO
+  STBIDEF int stbi_load_rows_scaled_from_file(FILE* f, int* x, int* y, int* channels_in_file, int desired_channels, int scale_shift, stbi_row_callback callback, void* user);
+#endif
+
   ////////////////////////////////////
   //
   // 16-bits-per-channel interface
@@ -640,12 +688,14 @@ typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
 typedef unsigned int   stbi__uint32;
 typedef   signed int   stbi__int32;
+typedef unsigned __int64 stbi__uint64;
 #else
 #include <stdint.h>
 typedef uint16_t stbi__uint16;
 typedef int16_t  stbi__int16;
 typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
+typedef uint64_t stbi__uint64;
 #endif
 
 // should produce compiler error if size is wrong
@@ -771,6 +821,41 @@ static int stbi__sse2_available(void)
 #endif
 #endif
 
+// AVX2 kernels are compiled for the target regardless of the build's
+// architecture flags and only called after a run-time check.
+#if defined(STBI_SSE2) && !defined(STBI_NO_AVX2) && !defined(STBI_NO_JPEG) && \
+    ((defined(_MSC_VER) && _MSC_VER >= 1800) || (defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))))
+#define STBI_AVX2
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define STBI__AVX2_TARGET
+static int stbi__avx2_available(void)
+{
+  // benign race: every thread computes the same value
+  static int available = -1;
+  if (available < 0) {
+    int info[4];
+    int result = 0;
+    __cpuid(info, 1);
+    // the OS must save the YMM registers (OSXSAVE, AVX, and XCR0 bits 1-2)
+    if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6) {
+      __cpuidex(info, 7, 0);
+      result = (info[1] & (1 << 5)) != 0;
+    }
+    available = result;
+  }
+  return available;
+}
+#else
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+static int stbi__avx2_available(void)
+{
+  return __builtin_cpu_supports("avx2") != 0;
+}
+#endif
+#endif
+
 // ARM NEON
 #if defined(STBI_NO_SIMD) && defined(STBI_NEON)
 #undef STBI_NEON
@@ -905,12 +990,14 @@ typedef struct
 #ifndef STBI_NO_JPEG
 static int      stbi__jpeg_test(stbi__context* s);
 static void* stbi__jpeg_load(stbi__context* s, int* x, int* y, int* comp, int req_comp, stbi__result_info* ri);
+static int      stbi__jpeg_load_rows(stbi__context* s, int* x, int* y, int* comp, int req_comp, int scale_shift, stbi_row_callback callback, void* user);
 static int      stbi__jpeg_info(stbi__context* s, int* x, int* y, int* comp);
 #endif
 
 #ifndef STBI_NO_PNG
 static int      stbi__png_test(stbi__context* s);
 static void* stbi__png_load(stbi__context* s, int* x, int* y, int* comp, int req_comp, stbi__result_info* ri);
+static int      stbi__png_load_rows(stbi__context* s, int* x, int* y, int* comp, int req_comp, stbi_row_callback callback, void* user);
 static int      stbi__png_info(stbi__context* s, int* x, int* y, int* comp);
 static int      stbi__png_is16(stbi__context* s);
 #endif
@@ -1290,6 +1377,37 @@ static stbi__uint16* stbi__load_and_postprocess_16bit(stbi__context* s, int* x,
   return (stbi__uint16*)result;
 }
 
+static int stbi__load_rows_main(stbi__context* s, int* x, int* y, int* comp, int req_comp, int scale_shift, stbi_row_callback callback, void* user)
+{
+  stbi__result_info ri;
+  stbi_uc* result;
+  int j, ok = 1;
+
+  if (req_comp < 1 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+  if (scale_shift < 0 || scale_shift > 3) return stbi__err("bad scale_shift", "Internal error");
+
+#ifndef STBI_NO_PNG
+  if (stbi__png_test(s))  return stbi__png_load_rows(s, x, y, comp, req_comp, callback, user);
+#endif
+#ifndef STBI_NO_JPEG
+  if (stbi__jpeg_test(s)) return stbi__jpeg_load_rows(s, x, y, comp, req_comp, scale_shift, callback, user);
+#endif
+
+  // every other format is decoded in full, then handed out row by row
+  result = (stbi_uc*)stbi__load_main(s, x, y, comp, req_comp, &ri, 8);
+  if (result == NULL)
+    return 0;
+  if (ri.bits_per_channel != 8) {
+    result = stbi__convert_16_to_8((stbi__uint16*)result, *x, *y, req_comp);
+    if (result == NULL)
+      return 0;
+  }
+  for (j = 0; j < *y && ok; ++j)
+    ok = callback(user, result + (size_t)*x * req_comp * j, j, *x, *y);
+  STBI_FREE(result);
+  return ok ? 1 : stbi__err("aborted", "Load aborted by callback");
+}
+
 #if !defined(STBI_NO_HDR) && !defined(STBI_NO_LINEAR)
 static void stbi__float_postprocess(float* result, int* x, int* y, int* comp, int req_comp)
 {
@@ -1389,6 +1507,34 @@ STBIDEF stbi_us* stbi_load_16(char const* filename, int* x, int* y, int* comp, i
   return result;
 }
 
+STBIDEF int stbi_load_rows(char const* filename, int* x, int* y, int* comp, int req_comp, stbi_row_callback callback, void* user)
+{
+  FILE* f = stbi__fopen(filename, "rb");
+  int result;
+  if (!f) return stbi__err("can't fopen", "Unable to open file");
+  result = stbi_load_rows_from_file(f, x, y, comp, req_comp, callback, user);
+  fclose(f);
+  return result;
+}
+
+STBIDEF int stbi_load_rows_from_file(FILE* f, int* x, int* y, int* comp, int req_comp, stbi_row_callback callback, void* user)
+{
+  return stbi_load_rows_scaled_from_file(f, x, y, comp, req_comp, 0, callback, user);
+}
+
+STBIDEF int stbi_load_rows_scaled_from_file(FILE* f, int* x, int* y, int* comp, int req_comp, int scale_shift, stbi_row_callback callback, void* user)
+{
+  int result;
+  stbi__context s;
+  stbi__start_file(&s, f);
+  result = stbi__load_rows_main(&s, x, y, comp, req_comp, scale_shift, callback, user);
+  if (result) {
+    // need to 'unget' all the characters in the IO buffer
+    fseek(f, -(int)(s.img_buffer_end - s.img_buffer), SEEK_CUR);
+  }
+  return result;
+}
+
 
 #endif //!STBI_NO_STDIO
 
@@ -1420,6 +1566,25 @@ STBIDEF stbi_uc* stbi_load_from_callbacks(stbi_io_callbacks const* clbk, void* u
   return stbi__load_and_postprocess_8bit(&s, x, y, comp, req_comp);
 }
 
+STBIDEF int stbi_load_rows_from_memory(stbi_uc const* buffer, int len, int* x, int* y, int* comp, int req_comp, stbi_row_callback callback, void* user)
+{
+  return stbi_load_rows_scaled_from_memory(buffer, len, x, y, comp, req_comp, 0, callback, user);
+}
+
+STBIDEF int stbi_load_rows_scaled_from_memory(stbi_uc const* buffer, int len, int* x, int* y, int* comp, int req_comp, int scale_shift, stbi_row_callback callback, void* user)
+{
+  stbi__context s;
+  stbi__start_mem(&s, buffer, len);
+  return stbi__load_rows_main(&s, x, y, comp, req_comp, scale_shift, callback, user);
+}
+
+STBIDEF int stbi_load_rows_from_callbacks(stbi_io_callbacks const* clbk, void* clbk_user, int* x, int* y, int* comp, int req_comp, stbi_row_callback callback, void* user)
+{
+  stbi__context s;
+  stbi__start_callbacks(&s, (stbi_io_callbacks*)clbk, clbk_user);
+  return stbi__load_rows_main(&s, x, y, comp, req_comp, 0, callback, user);
+}
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc* stbi_load_gif_from_memory(stbi_uc const* buffer, int len, int** delays, int* x, int* y, int* z, int* comp, int req_comp)
 {
@@ -1734,9 +1899,36 @@ static stbi_uc stbi__compute_y(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
 // nothing
 #else
+// convert one scanline with img_n components to one with req_comp components
+static int stbi__convert_format_row(unsigned char* src, unsigned char* dest, int img_n, int req_comp, unsigned int x)
+{
+  int i;
+
+#define STBI__COMBO(a,b)  ((a)*8+(b))
+#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+  // avoid switch per pixel, so use switch per scanline and massive macros
+  switch (STBI__COMBO(img_n, req_comp)) {
+    STBI__CASE(1, 2) { dest[0] = src[0]; dest[1] = 255; } break;
+    STBI__CASE(1, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
+    STBI__CASE(1, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = 255; } break;
+    STBI__CASE(2, 1) { dest[0] = src[0]; } break;
+    STBI__CASE(2, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
+    STBI__CASE(2, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = src[1]; } break;
+    STBI__CASE(3, 4) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; dest[3] = 255; } break;
+    STBI__CASE(3, 1) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); } break;
+    STBI__CASE(3, 2) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); dest[1] = 255; } break;
+    STBI__CASE(4, 1) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); } break;
+    STBI__CASE(4, 2) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); dest[1] = src[3]; } break;
+    STBI__CASE(4, 3) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; } break;
+  default: STBI_ASSERT(0); return stbi__err("unsupported", "Unsupported format conversion");
+  }
+#undef STBI__CASE
+  return 1;
+}
+
 static unsigned char* stbi__convert_format(unsigned char* data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
-  int i, j;
+  int j;
   unsigned char* good;
 
   if (req_comp == img_n) return data;
@@ -1748,30 +1940,13 @@ static unsigned char* stbi__convert_format(unsigned char* data, int img_n, int r
     return stbi__errpuc("outofmem", "Out of memory");
   }
 
+  // convert source image with img_n components to one with req_comp components
   for (j = 0; j < (int)y; ++j) {
-    unsigned char* src = data + j * x * img_n;
-    unsigned char* dest = good + j * x * req_comp;
-
-#define STBI__COMBO(a,b)  ((a)*8+(b))
-#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-    // convert source image with img_n components to one with req_comp components;
-    // avoid switch per pixel, so use switch per scanline and massive macros
-    switch (STBI__COMBO(img_n, req_comp)) {
-      STBI__CASE(1, 2) { dest[0] = src[0]; dest[1] = 255; } break;
-      STBI__CASE(1, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
-      STBI__CASE(1, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = 255; } break;
-      STBI__CASE(2, 1) { dest[0] = src[0]; } break;
-      STBI__CASE(2, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
-      STBI__CASE(2, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = src[1]; } break;
-      STBI__CASE(3, 4) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; dest[3] = 255; } break;
-      STBI__CASE(3, 1) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); } break;
-      STBI__CASE(3, 2) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); dest[1] = 255; } break;
-      STBI__CASE(4, 1) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); } break;
-      STBI__CASE(4, 2) { dest[0] = stbi__compute_y(src[0], src[1], src[2]); dest[1] = src[3]; } break;
-      STBI__CASE(4, 3) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; } break;
-    default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
+    if (!stbi__convert_format_row(data + j * x * img_n, good + j * x * req_comp, img_n, req_comp, x)) {
+      STBI_FREE(data);
+      STBI_FREE(good);
+      return NULL;
     }
-#undef STBI__CASE
   }
 
   STBI_FREE(data);
@@ -1791,9 +1966,36 @@ static stbi__uint16 stbi__compute_y_16(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_PSD)
 // nothing
 #else
+// convert one 16-bit scanline with img_n components to one with req_comp components
+static int stbi__convert_format16_row(stbi__uint16* src, stbi__uint16* dest, int img_n, int req_comp, unsigned int x)
+{
+  int i;
+
+#define STBI__COMBO(a,b)  ((a)*8+(b))
+#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+  // avoid switch per pixel, so use switch per scanline and massive macros
+  switch (STBI__COMBO(img_n, req_comp)) {
+    STBI__CASE(1, 2) { dest[0] = src[0]; dest[1] = 0xffff; } break;
+    STBI__CASE(1, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
+    STBI__CASE(1, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = 0xffff; } break;
+    STBI__CASE(2, 1) { dest[0] = src[0]; } break;
+    STBI__CASE(2, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
+    STBI__CASE(2, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = src[1]; } break;
+    STBI__CASE(3, 4) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; dest[3] = 0xffff; } break;
+    STBI__CASE(3, 1) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); } break;
+    STBI__CASE(3, 2) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); dest[1] = 0xffff; } break;
+    STBI__CASE(4, 1) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); } break;
+    STBI__CASE(4, 2) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); dest[1] = src[3]; } break;
+    STBI__CASE(4, 3) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; } break;
+  default: STBI_ASSERT(0); return stbi__err("unsupported", "Unsupported format conversion");
+  }
+#undef STBI__CASE
+  return 1;
+}
+
 static stbi__uint16* stbi__convert_format16(stbi__uint16* data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
-  int i, j;
+  int j;
   stbi__uint16* good;
 
   if (req_comp == img_n) return data;
@@ -1805,30 +2007,13 @@ static stbi__uint16* stbi__convert_format16(stbi__uint16* data, int img_n, int r
     return (stbi__uint16*)stbi__errpuc("outofmem", "Out of memory");
   }
 
+  // convert source image with img_n components to one with req_comp components
   for (j = 0; j < (int)y; ++j) {
-    stbi__uint16* src = data + j * x * img_n;
-    stbi__uint16* dest = good + j * x * req_comp;
-
-#define STBI__COMBO(a,b)  ((a)*8+(b))
-#define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-    // convert source image with img_n components to one with req_comp components;
-    // avoid switch per pixel, so use switch per scanline and massive macros
-    switch (STBI__COMBO(img_n, req_comp)) {
-      STBI__CASE(1, 2) { dest[0] = src[0]; dest[1] = 0xffff; } break;
-      STBI__CASE(1, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
-      STBI__CASE(1, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = 0xffff; } break;
-      STBI__CASE(2, 1) { dest[0] = src[0]; } break;
-      STBI__CASE(2, 3) { dest[0] = dest[1] = dest[2] = src[0]; } break;
-      STBI__CASE(2, 4) { dest[0] = dest[1] = dest[2] = src[0]; dest[3] = src[1]; } break;
-      STBI__CASE(3, 4) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; dest[3] = 0xffff; } break;
-      STBI__CASE(3, 1) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); } break;
-      STBI__CASE(3, 2) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); dest[1] = 0xffff; } break;
-      STBI__CASE(4, 1) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); } break;
-      STBI__CASE(4, 2) { dest[0] = stbi__compute_y_16(src[0], src[1], src[2]); dest[1] = src[3]; } break;
-      STBI__CASE(4, 3) { dest[0] = src[0]; dest[1] = src[1]; dest[2] = src[2]; } break;
-    default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return (stbi__uint16*)stbi__errpuc("unsupported", "Unsupported format conversion");
+    if (!stbi__convert_format16_row(data + j * x * img_n, good + j * x * req_comp, img_n, req_comp, x)) {
+      STBI_FREE(data);
+      STBI_FREE(good);
+      return NULL;
     }
-#undef STBI__CASE
   }
 
   STBI_FREE(data);
@@ -1928,6 +2113,8 @@ typedef struct
   int    delta[17];   // old 'firstsymbol' - old 'firstcode'
 } stbi__huffman;
 
+typedef struct stbi__jpeg_row_output stbi__jpeg_row_output;
+
 typedef struct
 {
   stbi__context* s;
@@ -1940,6 +2127,7 @@ typedef struct
   int img_h_max, img_v_max;
   int img_mcu_x, img_mcu_y;
   int img_mcu_w, img_mcu_h;
+  int block_size; // pixels across each 8x8 block of a full-resolution component: 8, or 4, 2 or 1 when scaling down
 
   // definition of jpeg image component
   struct
@@ -1950,7 +2138,10 @@ typedef struct
     int hd, ha;
     int dc_pred;
 
-    int x, y, w2, h2;
+    int x, y, w2, h2; // in decoded pixels, so reduced along with block_size
+    int block_size;   // pixels across each decoded block of this component
+    void (*idct_block_kernel)(stbi_uc* out, int out_stride, short data[64]);
+    int rows;      // rows of data kept; fewer than h2 when decoding a row at a time
     stbi_uc* data;
     void* raw_data, * raw_coeff;
     stbi_uc* linebuf;
@@ -1980,6 +2171,12 @@ typedef struct
   void (*idct_block_kernel)(stbi_uc* out, int out_stride, short data[64]);
   void (*YCbCr_to_RGB_kernel)(stbi_uc* out, const stbi_uc* y, const stbi_uc* pcb, const stbi_uc* pcr, int count, int step);
   stbi_uc* (*resample_row_hv_2_kernel)(stbi_uc* out, stbi_uc* in_near, stbi_uc* in_far, int w, int hs);
+  void (*CMYK_to_RGB_kernel)(stbi_uc* out, const stbi_uc* pc, const stbi_uc* pm, const stbi_uc* py, const stbi_uc* pk, int count, int step);
+  void (*YCCK_fixup_kernel)(stbi_uc* out, const stbi_uc* pk, int count, int step);
+  void (*gray_to_RGB_kernel)(stbi_uc* out, const stbi_uc* y, int count, int step);
+
+  stbi__jpeg_row_output* row_output; // set by stbi_load_rows
+  int pipelined; // the streamed scan is decoded by stbi__jpeg_decode_pipelined
 } stbi__jpeg;
 
 static int stbi__build_huffman(stbi__huffman* h, int* count)
@@ -2506,6 +2703,87 @@ static void stbi__idct_block(stbi_uc* out, int out_stride, short data[64])
   }
 }
 
+// reduced IDCTs for scaled decoding. each output pixel is the average of the pixels of the full
+// 8x8 IDCT that it stands for, which is a fixed weighting of the coefficients along each axis.
+// the weights are symmetric about the block's center, so they are split into even and odd
+// parts as in the full IDCT. coefficient 4 averages to 0 over pairs of pixels, and 2, 4 and 6
+// over groups of four, so those are never read.
+#define STBI__IDCT_4_1D(s0,s1,s2,s3,s5,s6,s7) \
+   int e0,e1,o0,o1;                            \
+   e0 = e1 = (s0) * stbi__f2f(0.353553391f);   \
+   e0 += (s2)*stbi__f2f(0.326640741f) - (s6)*stbi__f2f(0.135299025f); \
+   e1 -= (s2)*stbi__f2f(0.326640741f) - (s6)*stbi__f2f(0.135299025f); \
+   o0 = (s1)*stbi__f2f(0.453063723f) + (s3)*stbi__f2f(0.159094823f)   \
+      - (s5)*stbi__f2f(0.106303762f) - (s7)*stbi__f2f(0.090119978f);  \
+   o1 = (s1)*stbi__f2f(0.187665139f) - (s3)*stbi__f2f(0.384088878f)   \
+      + (s5)*stbi__f2f(0.256639984f) - (s7)*stbi__f2f(0.037328917f);
+
+#define STBI__IDCT_2_1D(s0,s1,s3,s5,s7) \
+   int e0,o0;                            \
+   e0 = (s0) * stbi__f2f(0.353553391f);  \
+   o0 = (s1)*stbi__f2f(0.320364431f) - (s3)*stbi__f2f(0.112497028f)  \
+      + (s5)*stbi__f2f(0.075168111f) - (s7)*stbi__f2f(0.063724447f);
+
+static void stbi__idct_block_4x4(stbi_uc* out, int out_stride, short data[64])
+{
+  int i, val[32], * v = val;
+  stbi_uc* o;
+  short* d = data;
+
+  // columns: weights are scaled by 1<<12, keep 2 bits of that in val
+  for (i = 0; i < 8; ++i, ++d, ++v) {
+    if (i == 4) continue;
+    if (d[8] == 0 && d[16] == 0 && d[24] == 0 && d[40] == 0 && d[48] == 0 && d[56] == 0) {
+      v[0] = v[8] = v[16] = v[24] = (d[0] * stbi__f2f(0.353553391f) + 512) >> 10;
+    }
+    else {
+      STBI__IDCT_4_1D(d[0], d[8], d[16], d[24], d[40], d[48], d[56])
+      e0 += 512; e1 += 512;
+      v[0] = (e0 + o0) >> 10;
+      v[24] = (e0 - o0) >> 10;
+      v[8] = (e1 + o1) >> 10;
+      v[16] = (e1 - o1) >> 10;
+    }
+  }
+
+  // rows: 1<<12 from these weights and 1<<2 from the columns; round and add the 128 offset
+  for (i = 0, v = val, o = out; i < 4; ++i, v += 8, o += out_stride) {
+    STBI__IDCT_4_1D(v[0], v[1], v[2], v[3], v[5], v[6], v[7])
+    e0 += 8192 + (128 << 14);
+    e1 += 8192 + (128 << 14);
+    o[0] = stbi__clamp((e0 + o0) >> 14);
+    o[3] = stbi__clamp((e0 - o0) >> 14);
+    o[1] = stbi__clamp((e1 + o1) >> 14);
+    o[2] = stbi__clamp((e1 - o1) >> 14);
+  }
+}
+
+static void stbi__idct_block_2x2(stbi_uc* out, int out_stride, short data[64])
+{
+  int i, val[16];
+  for (i = 0; i < 8; i += (i == 0 ? 1 : 2)) { // columns 0, 1, 3, 5 and 7
+    short* d = data + i;
+    STBI__IDCT_2_1D(d[0], d[8], d[24], d[40], d[56])
+    e0 += 512;
+    val[i] = (e0 + o0) >> 10;
+    val[8 + i] = (e0 - o0) >> 10;
+  }
+  for (i = 0; i < 2; ++i) {
+    int* v = val + 8 * i;
+    STBI__IDCT_2_1D(v[0], v[1], v[3], v[5], v[7])
+    e0 += 8192 + (128 << 14);
+    out[out_stride * i] = stbi__clamp((e0 + o0) >> 14);
+    out[out_stride * i + 1] = stbi__clamp((e0 - o0) >> 14);
+  }
+}
+
+static void stbi__idct_block_1x1(stbi_uc* out, int out_stride, short data[64])
+{
+  STBI_NOTUSED(out_stride);
+  // the mean of the full IDCT is the DC coefficient over 8
+  out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2685,6 +2963,161 @@ static void stbi__idct_simd(stbi_uc* out, int out_stride, short data[64])
 #undef dct_pass
 }
 
+#ifdef STBI_AVX2
+// avx2 version of the integer IDCT above, with the same arithmetic. the 32-bit
+// intermediates of a row fit one register, so each multiply, add and shift
+// covers all eight columns at once; transposes still work on 128-bit rows.
+static STBI__AVX2_TARGET void stbi__idct_avx2(stbi_uc* out, int out_stride, short data[64])
+{
+  __m128i row0, row1, row2, row3, row4, row5, row6, row7;
+  __m128i tmp;
+
+#define dct_const(x,y)  _mm256_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y))
+
+// interleave x and y into one register of 8 (x,y) pairs
+#define dct_pairs(x,y) \
+      _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16((x),(y))), _mm_unpackhi_epi16((x),(y)), 1)
+
+// out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
+// out(1) = c1[even]*x + c1[odd]*y
+#define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##xy = dct_pairs(x,y); \
+      __m256i out0 = _mm256_madd_epi16(c0##xy, c0); \
+      __m256i out1 = _mm256_madd_epi16(c0##xy, c1)
+
+   // out = in << 12  (in 16-bit, out 32-bit)
+#define dct_widen(out, in) \
+      __m256i out = _mm256_slli_epi32(_mm256_cvtepi16_epi32(in), 12)
+
+   // butterfly a/b, add bias, then shift by "s" and pack
+#define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased = _mm256_add_epi32(a, bias); \
+         __m256i sum = _mm256_srai_epi32(_mm256_add_epi32(abiased, b), s); \
+         __m256i dif = _mm256_srai_epi32(_mm256_sub_epi32(abiased, b), s); \
+         out0 = _mm_packs_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)); \
+         out1 = _mm_packs_epi32(_mm256_castsi256_si128(dif), _mm256_extracti128_si256(dif, 1)); \
+      }
+
+#define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi8(a, b); \
+      b = _mm_unpackhi_epi8(tmp, b)
+
+#define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm_unpacklo_epi16(a, b); \
+      b = _mm_unpackhi_epi16(tmp, b)
+
+#define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m128i sum04 = _mm_add_epi16(row0, row4); \
+         __m128i dif04 = _mm_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         __m256i x0 = _mm256_add_epi32(t0e, t3e); \
+         __m256i x3 = _mm256_sub_epi32(t0e, t3e); \
+         __m256i x1 = _mm256_add_epi32(t1e, t2e); \
+         __m256i x2 = _mm256_sub_epi32(t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m128i sum17 = _mm_add_epi16(row1, row7); \
+         __m128i sum35 = _mm_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         __m256i x4 = _mm256_add_epi32(y0o, y4o); \
+         __m256i x5 = _mm256_add_epi32(y1o, y5o); \
+         __m256i x6 = _mm256_add_epi32(y2o, y5o); \
+         __m256i x7 = _mm256_add_epi32(y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+  __m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+  __m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f(0.765366865f), stbi__f2f(0.5411961f));
+  __m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+  __m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+  __m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f(0.298631336f), stbi__f2f(-1.961570560f));
+  __m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f(3.072711026f));
+  __m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f(2.053119869f), stbi__f2f(-0.390180644f));
+  __m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f(1.501321110f));
+
+  // rounding biases in column/row passes, see stbi__idct_block for explanation.
+  __m256i bias_0 = _mm256_set1_epi32(512);
+  __m256i bias_1 = _mm256_set1_epi32(65536 + (128 << 17));
+
+  // load
+  row0 = _mm_load_si128((const __m128i*) (data + 0 * 8));
+  row1 = _mm_load_si128((const __m128i*) (data + 1 * 8));
+  row2 = _mm_load_si128((const __m128i*) (data + 2 * 8));
+  row3 = _mm_load_si128((const __m128i*) (data + 3 * 8));
+  row4 = _mm_load_si128((const __m128i*) (data + 4 * 8));
+  row5 = _mm_load_si128((const __m128i*) (data + 5 * 8));
+  row6 = _mm_load_si128((const __m128i*) (data + 6 * 8));
+  row7 = _mm_load_si128((const __m128i*) (data + 7 * 8));
+
+  // column pass
+  dct_pass(bias_0, 10);
+
+  {
+    // 16bit 8x8 transpose
+    dct_interleave16(row0, row4);
+    dct_interleave16(row1, row5);
+    dct_interleave16(row2, row6);
+    dct_interleave16(row3, row7);
+    dct_interleave16(row0, row2);
+    dct_interleave16(row1, row3);
+    dct_interleave16(row4, row6);
+    dct_interleave16(row5, row7);
+    dct_interleave16(row0, row1);
+    dct_interleave16(row2, row3);
+    dct_interleave16(row4, row5);
+    dct_interleave16(row6, row7);
+  }
+
+  // row pass
+  dct_pass(bias_1, 17);
+
+  {
+    // pack, then 8bit 8x8 transpose
+    __m128i p0 = _mm_packus_epi16(row0, row1);
+    __m128i p1 = _mm_packus_epi16(row2, row3);
+    __m128i p2 = _mm_packus_epi16(row4, row5);
+    __m128i p3 = _mm_packus_epi16(row6, row7);
+    dct_interleave8(p0, p2);
+    dct_interleave8(p1, p3);
+    dct_interleave8(p0, p1);
+    dct_interleave8(p2, p3);
+    dct_interleave8(p0, p2);
+    dct_interleave8(p1, p3);
+
+    // store
+    _mm_storel_epi64((__m128i*) out, p0); out += out_stride;
+    _mm_storel_epi64((__m128i*) out, _mm_shuffle_epi32(p0, 0x4e)); out += out_stride;
+    _mm_storel_epi64((__m128i*) out, p2); out += out_stride;
+    _mm_storel_epi64((__m128i*) out, _mm_shuffle_epi32(p2, 0x4e)); out += out_stride;
+    _mm_storel_epi64((__m128i*) out, p1); out += out_stride;
+    _mm_storel_epi64((__m128i*) out, _mm_shuffle_epi32(p1, 0x4e)); out += out_stride;
+    _mm_storel_epi64((__m128i*) out, p3); out += out_stride;
+    _mm_storel_epi64((__m128i*) out, _mm_shuffle_epi32(p3, 0x4e));
+  }
+  _mm256_zeroupper();
+
+#undef dct_const
+#undef dct_pairs
+#undef dct_rot
+#undef dct_widen
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+}
+#endif // STBI_AVX2
+
 #endif // STBI_SSE2
 
 #ifdef STBI_NEON
@@ -2929,25 +3362,224 @@ static void stbi__jpeg_reset(stbi__jpeg* j)
   // since we don't even allow 1<<30 pixels
 }
 
-static int stbi__parse_entropy_coded_data(stbi__jpeg* z)
+static int stbi__jpeg_rows_decoded(stbi__jpeg* z, int row_count);
+
+// number of MCUs in the current scan; a single-component scan has one block per MCU
+static int stbi__jpeg_scan_mcu_count(stbi__jpeg* z)
 {
-  stbi__jpeg_reset(z);
-  if (!z->progressive) {
-    if (z->scan_n == 1) {
-      int i, j;
-      STBI_SIMD_ALIGN(short, data[64]);
-      int n = z->order[0];
-      // non-interleaved data, we just need to process one block at a time,
-      // in trivial scanline order
-      // number of blocks to do just depends on how many actual "pixels" this
-      // component has, independent of interleaved MCU blocking and such
-      int w = (z->img_comp[n].x + 7) >> 3;
-      int h = (z->img_comp[n].y + 7) >> 3;
-      for (j = 0; j < h; ++j) {
-        for (i = 0; i < w; ++i) {
-          int ha = z->img_comp[n].ha;
+  if (z->scan_n == 1) {
+    int n = z->order[0];
+    int w = (z->img_comp[n].x + z->img_comp[n].block_size - 1) / z->img_comp[n].block_size;
+    int h = (z->img_comp[n].y + z->img_comp[n].block_size - 1) / z->img_comp[n].block_size;
+    return w * h;
+  }
+  return z->img_mcu_x * z->img_mcu_y;
+}
+
+// MCU rows entropy-decoded per step of a pipelined decode
+#define STBI__PIPELINE_MCU_ROWS   4
+
+#ifdef STBI_PARALLEL_FOR
+
+// fewer MCUs than this per thread aren't worth handing out
+#define STBI__PARALLEL_MIN_MCUS   64
+
+// number of tasks a baseline scan held in memory is split into along its restart intervals,
+// or 0 if it's decoded serially
+static int stbi__jpeg_parallel_task_count(stbi__jpeg* z)
+{
+  int mcus, segments, tasks, threads = STBI_PARALLEL_THREADS();
+  if (threads < 2 || z->progressive || !z->restart_interval || z->s->read_from_callbacks)
+    return 0;
+  mcus = stbi__jpeg_scan_mcu_count(z);
+  segments = (mcus + z->restart_interval - 1) / z->restart_interval;
+  tasks = threads * 4; // a few tasks per thread evens out segments of uneven cost
+  if (tasks > segments) tasks = segments;
+  if (tasks > mcus / STBI__PARALLEL_MIN_MCUS) tasks = mcus / STBI__PARALLEL_MIN_MCUS;
+  return tasks >= 2 ? tasks : 0;
+}
+
+// whether a row-streamed baseline scan is decoded as a pipeline: the entropy decoding of each band
+// of MCU rows overlaps the inverse transform of the band before it and the color conversion of the
+// rows before that, which run on other threads
+static int stbi__jpeg_pipelined(stbi__jpeg* z)
+{
+  if (!z->row_output || z->progressive || z->scan_n != z->s->img_n || STBI_PARALLEL_THREADS() < 2)
+    return 0;
+  // a single-component scan is in block order, which only matches MCU order for 1x1 sampling
+  if (z->scan_n == 1 && (z->img_comp[z->order[0]].h != 1 || z->img_comp[z->order[0]].v != 1))
+    return 0;
+  return z->img_mcu_y > STBI__PIPELINE_MCU_ROWS * 2;
+}
+
+// find where each restart interval of the scan begins, from the RSTn markers ahead in the buffer.
+// starts[segment_count] receives the end of the scan's data, just past the marker ending it
+static int stbi__jpeg_find_segments(stbi__jpeg* z, stbi_uc** starts, int segment_count, stbi_uc* marker)
+{
+  stbi_uc* p = z->s->img_buffer, * end = z->s->img_buffer_end;
+  int found = 1;
+  starts[0] = p;
+  *marker = STBI__MARKER_none;
+  while (p < end) {
+    p = (stbi_uc*)memchr(p, 0xff, end - p);
+    if (!p) {
+      p = end;
+      break;
+    }
+    while (p < end && *p == 0xff) ++p; // fill bytes
+    if (p == end) break;
+    if (*p == 0) {
+      ++p; // stuffed zero
+    }
+    else if (STBI__RESTART(*p)) {
+      // restart markers count up modulo 8; anything else and the serial decoder's recovery is kept
+      if (found == segment_count || *p != 0xd0 + ((found - 1) & 7)) return 0;
+      starts[found++] = ++p;
+    }
+    else {
+      *marker = *p++;
+      break;
+    }
+  }
+  starts[segment_count] = p;
+  return found == segment_count;
+}
+
+// decode baseline MCUs [first, last) of the current scan, numbered in scan order
+static int stbi__jpeg_decode_mcus(stbi__jpeg* z, int first, int last)
+{
+  int m, k, x, y;
+  STBI_SIMD_ALIGN(short, data[64]);
+  for (m = first; m < last; ++m) {
+    if (z->scan_n == 1) {
+      int n = z->order[0];
+      int bs = z->img_comp[n].block_size;
+      int w = (z->img_comp[n].x + bs - 1) / bs;
+      int ha = z->img_comp[n].ha;
+      if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+      z->img_comp[n].idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * (m / w) * bs + (m % w) * bs, z->img_comp[n].w2, data);
+      continue;
+    }
+    for (k = 0; k < z->scan_n; ++k) {
+      int n = z->order[k];
+      int bs = z->img_comp[n].block_size;
+      for (y = 0; y < z->img_comp[n].v; ++y) {
+        for (x = 0; x < z->img_comp[n].h; ++x) {
+          int x2 = ((m % z->img_mcu_x) * z->img_comp[n].h + x) * bs;
+          int y2 = ((m / z->img_mcu_x) * z->img_comp[n].v + y) * bs;
+          int ha = z->img_comp[n].ha;
+          if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+          z->img_comp[n].idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * y2 + x2, z->img_comp[n].w2, data);
+        }
+      }
+    }
+  }
+  return 1;
+}
+
+typedef struct
+{
+  stbi__jpeg* z;
+  stbi_uc** starts; // segment i is the data from starts[i] up to starts[i + 1]
+  int segment_count, segments_per_task, mcu_count;
+  volatile int failed;
+} stbi__jpeg_parallel_scan;
+
+// decode one task's run of restart intervals with a private copy of the decoder state
+static void stbi__jpeg_decode_segments(void* context, int index)
+{
+  stbi__jpeg_parallel_scan* scan = (stbi__jpeg_parallel_scan*)context;
+  int first = index * scan->segments_per_task, i;
+  int last = first + scan->segments_per_task < scan->segment_count ? first + scan->segments_per_task : scan->segment_count;
+  stbi__context s;
+  stbi__jpeg* z = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
+  if (!z) {
+    scan->failed = 1;
+    return;
+  }
+  *z = *scan->z;
+  z->s = &s;
+  for (i = first; i < last && !scan->failed; ++i) {
+    int first_mcu = i * z->restart_interval;
+    int last_mcu = first_mcu + z->restart_interval < scan->mcu_count ? first_mcu + z->restart_interval : scan->mcu_count;
+    stbi__start_mem(&s, scan->starts[i], (int)(scan->starts[i + 1] - scan->starts[i]));
+    stbi__jpeg_reset(z);
+    if (!stbi__jpeg_decode_mcus(z, first_mcu, last_mcu))
+      scan->failed = 1;
+  }
+  STBI_FREE(z);
+}
+
+// decode a baseline scan by restart intervals on several threads; 0 in *done leaves the scan
+// to the serial decoder, which also recovers from missing or out-of-order markers
+static int stbi__parse_entropy_coded_data_parallel(stbi__jpeg* z, int* done)
+{
+  stbi__jpeg_parallel_scan scan;
+  stbi_uc marker;
+  int k, tasks = stbi__jpeg_parallel_task_count(z);
+  *done = 0;
+  if (!tasks) return 1;
+  // segments write straight into the planes, so every row of them must be kept
+  for (k = 0; k < z->scan_n; ++k)
+    if (z->img_comp[z->order[k]].rows < z->img_comp[z->order[k]].h2) return 1;
+
+  scan.z = z;
+  scan.mcu_count = stbi__jpeg_scan_mcu_count(z);
+  scan.segment_count = (scan.mcu_count + z->restart_interval - 1) / z->restart_interval;
+  scan.segments_per_task = (scan.segment_count + tasks - 1) / tasks;
+  scan.failed = 0;
+  scan.starts = (stbi_uc**)stbi__malloc_mad2(scan.segment_count + 1, sizeof(stbi_uc*), 0);
+  if (!scan.starts) return 1;
+  if (!stbi__jpeg_find_segments(z, scan.starts, scan.segment_count, &marker)) {
+    STBI_FREE(scan.starts);
+    return 1;
+  }
+
+  STBI_PARALLEL_FOR((scan.segment_count + scan.segments_per_task - 1) / scan.segments_per_task, stbi__jpeg_decode_segments, &scan);
+
+  // carry on after the scan as the serial decoder would, with the marker ending it already read
+  z->s->img_buffer = scan.starts[scan.segment_count];
+  z->marker = marker;
+  STBI_FREE(scan.starts);
+  *done = 1;
+  if (scan.failed) return stbi__err("bad huffman code", "Corrupt JPEG");
+  return 1;
+}
+
+static int stbi__jpeg_decode_pipelined(stbi__jpeg* z);
+
+#else
+#define stbi__jpeg_pipelined(z)             0
+#endif // STBI_PARALLEL_FOR
+
+static int stbi__parse_entropy_coded_data(stbi__jpeg* z)
+{
+  stbi__jpeg_reset(z);
+#ifdef STBI_PARALLEL_FOR
+  {
+    int done;
+    if (!stbi__parse_entropy_coded_data_parallel(z, &done)) return 0;
+    if (done) return 1;
+  }
+  if (z->pipelined)
+    return stbi__jpeg_decode_pipelined(z);
+#endif
+  if (!z->progressive) {
+    if (z->scan_n == 1) {
+      int i, j;
+      STBI_SIMD_ALIGN(short, data[64]);
+      int n = z->order[0];
+      // non-interleaved data, we just need to process one block at a time,
+      // in trivial scanline order
+      // number of blocks to do just depends on how many actual "pixels" this
+      // component has, independent of interleaved MCU blocking and such
+      int w = (z->img_comp[n].x + z->img_comp[n].block_size - 1) / z->img_comp[n].block_size;
+      int h = (z->img_comp[n].y + z->img_comp[n].block_size - 1) / z->img_comp[n].block_size;
+      for (j = 0; j < h; ++j) {
+        for (i = 0; i < w; ++i) {
+          int ha = z->img_comp[n].ha;
           if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-          z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * j * 8 + i * 8, z->img_comp[n].w2, data);
+          z->img_comp[n].idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * ((j * z->img_comp[n].block_size) % z->img_comp[n].rows) + i * z->img_comp[n].block_size, z->img_comp[n].w2, data);
           // every data block is an MCU, so countdown the restart interval
           if (--z->todo <= 0) {
             if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2957,6 +3589,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg* z)
             stbi__jpeg_reset(z);
           }
         }
+        if (z->img_comp[n].rows < z->img_comp[n].h2 && !stbi__jpeg_rows_decoded(z, j + 1)) return 0;
       }
       return 1;
     }
@@ -2972,11 +3605,11 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg* z)
             // by the basic H and V specified for the component
             for (y = 0; y < z->img_comp[n].v; ++y) {
               for (x = 0; x < z->img_comp[n].h; ++x) {
-                int x2 = (i * z->img_comp[n].h + x) * 8;
-                int y2 = (j * z->img_comp[n].v + y) * 8;
+                int x2 = (i * z->img_comp[n].h + x) * z->img_comp[n].block_size;
+                int y2 = ((j * z->img_comp[n].v + y) * z->img_comp[n].block_size) % z->img_comp[n].rows;
                 int ha = z->img_comp[n].ha;
                 if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * y2 + x2, z->img_comp[n].w2, data);
+                z->img_comp[n].idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * y2 + x2, z->img_comp[n].w2, data);
               }
             }
           }
@@ -2988,6 +3621,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg* z)
             stbi__jpeg_reset(z);
           }
         }
+        if (z->img_comp[z->order[0]].rows < z->img_comp[z->order[0]].h2 && !stbi__jpeg_rows_decoded(z, j + 1)) return 0;
       }
       return 1;
     }
@@ -3000,8 +3634,8 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg* z)
       // in trivial scanline order
       // number of blocks to do just depends on how many actual "pixels" this
       // component has, independent of interleaved MCU blocking and such
-      int w = (z->img_comp[n].x + 7) >> 3;
-      int h = (z->img_comp[n].y + 7) >> 3;
+      int w = (z->img_comp[n].x + z->img_comp[n].block_size - 1) / z->img_comp[n].block_size;
+      int h = (z->img_comp[n].y + z->img_comp[n].block_size - 1) / z->img_comp[n].block_size;
       for (j = 0; j < h; ++j) {
         for (i = 0; i < w; ++i) {
           short* data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
@@ -3070,13 +3704,13 @@ static void stbi__jpeg_finish(stbi__jpeg* z)
     // dequantize and idct the data
     int i, j, n;
     for (n = 0; n < z->s->img_n; ++n) {
-      int w = (z->img_comp[n].x + 7) >> 3;
-      int h = (z->img_comp[n].y + 7) >> 3;
+      int w = (z->img_comp[n].x + z->img_comp[n].block_size - 1) / z->img_comp[n].block_size;
+      int h = (z->img_comp[n].y + z->img_comp[n].block_size - 1) / z->img_comp[n].block_size;
       for (j = 0; j < h; ++j) {
         for (i = 0; i < w; ++i) {
           short* data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
           stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-          z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * j * 8 + i * 8, z->img_comp[n].w2, data);
+          z->img_comp[n].idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * j * z->img_comp[n].block_size + i * z->img_comp[n].block_size, z->img_comp[n].w2, data);
         }
       }
     }
@@ -3253,7 +3887,7 @@ static int stbi__free_jpeg_components(stbi__jpeg* z, int ncomp, int why)
 static int stbi__process_frame_header(stbi__jpeg* z, int scan)
 {
   stbi__context* s = z->s;
-  int Lf, p, i, q, h_max = 1, v_max = 1, c;
+  int Lf, p, i, q, h_max = 1, v_max = 1, c, scale;
   Lf = stbi__get16be(s);         if (Lf < 11) return stbi__err("bad SOF len", "Corrupt JPEG"); // JPEG
   p = stbi__get8(s);            if (p != 8) return stbi__err("only 8-bit", "JPEG format not supported: 8-bit only"); // JPEG baseline
   s->img_y = stbi__get16be(s);   if (s->img_y == 0) return stbi__err("no header height", "JPEG format not supported: delayed height"); // Legal, but we don't handle it--but neither does IJG
@@ -3300,10 +3934,28 @@ static int stbi__process_frame_header(stbi__jpeg* z, int scan)
   z->img_mcu_x = (s->img_x + z->img_mcu_w - 1) / z->img_mcu_w;
   z->img_mcu_y = (s->img_y + z->img_mcu_h - 1) / z->img_mcu_h;
 
+  // when scaling, every size from here on is in decoded pixels, rounded up
+  scale = 8 / z->block_size;
   for (i = 0; i < s->img_n; ++i) {
+    // subsampled components get larger blocks where that replaces upsampling them, as in libjpeg
+    int comp_scale;
+    z->img_comp[i].block_size = z->block_size;
+    if (h_max % z->img_comp[i].h == 0 && v_max % z->img_comp[i].v == 0)
+      while (z->img_comp[i].block_size < 8
+             && (h_max / z->img_comp[i].h) % (z->img_comp[i].block_size * 2 / z->block_size) == 0
+             && (v_max / z->img_comp[i].v) % (z->img_comp[i].block_size * 2 / z->block_size) == 0)
+        z->img_comp[i].block_size *= 2;
+    switch (z->img_comp[i].block_size) {
+      case 4:  z->img_comp[i].idct_block_kernel = stbi__idct_block_4x4; break;
+      case 2:  z->img_comp[i].idct_block_kernel = stbi__idct_block_2x2; break;
+      case 1:  z->img_comp[i].idct_block_kernel = stbi__idct_block_1x1; break;
+      default: z->img_comp[i].idct_block_kernel = z->idct_block_kernel; break;
+    }
+    comp_scale = 8 / z->img_comp[i].block_size;
+
     // number of effective pixels (e.g. for non-interleaved MCU)
-    z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max - 1) / h_max;
-    z->img_comp[i].y = (s->img_y * z->img_comp[i].v + v_max - 1) / v_max;
+    z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max * comp_scale - 1) / (h_max * comp_scale);
+    z->img_comp[i].y = (s->img_y * z->img_comp[i].v + v_max * comp_scale - 1) / (v_max * comp_scale);
     // to simplify generation, we'll allocate enough memory to decode
     // the bogus oversized data from using interleaved MCUs and their
     // big blocks (e.g. a 16x16 iMCU on an image of width 33); we won't
@@ -3311,27 +3963,34 @@ static int stbi__process_frame_header(stbi__jpeg* z, int scan)
     //
     // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
     // so these muls can't overflow with 32-bit ints (which we require)
-    z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-    z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+    z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * z->img_comp[i].block_size;
+    z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * z->img_comp[i].block_size;
+    z->img_comp[i].rows = z->img_comp[i].h2;
     z->img_comp[i].coeff = 0;
     z->img_comp[i].raw_coeff = 0;
     z->img_comp[i].linebuf = NULL;
+    // when handing rows out as they are decoded, the planes are allocated at the first scan,
+    // once it is known whether that scan carries every component
+    if (z->row_output && !z->progressive) continue;
     z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
     if (z->img_comp[i].raw_data == NULL)
       return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
     // align blocks for idct using mmx/sse
     z->img_comp[i].data = (stbi_uc*)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
     if (z->progressive) {
-      // w2, h2 are multiples of 8 (see above)
-      z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-      z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-      z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+      // w2, h2 are multiples of block_size (see above); coefficients are kept in full when scaling
+      z->img_comp[i].coeff_w = z->img_comp[i].w2 / z->img_comp[i].block_size;
+      z->img_comp[i].coeff_h = z->img_comp[i].h2 / z->img_comp[i].block_size;
+      z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
       if (z->img_comp[i].raw_coeff == NULL)
         return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
       z->img_comp[i].coeff = (short*)(((size_t)z->img_comp[i].raw_coeff + 15) & ~15);
     }
   }
 
+  // the image is delivered at the decoded size
+  s->img_x = (s->img_x + scale - 1) / scale;
+  s->img_y = (s->img_y + scale - 1) / scale;
   return 1;
 }
 
@@ -3368,6 +4027,8 @@ static int stbi__decode_jpeg_header(stbi__jpeg* z, int scan)
   return 1;
 }
 
+static int stbi__jpeg_begin_rows(stbi__jpeg* z);
+
 // decode image to YCbCr format
 static int stbi__decode_jpeg_image(stbi__jpeg* j)
 {
@@ -3382,6 +4043,7 @@ static int stbi__decode_jpeg_image(stbi__jpeg* j)
   while (!stbi__EOI(m)) {
     if (stbi__SOS(m)) {
       if (!stbi__process_scan_header(j)) return 0;
+      if (j->row_output && !j->img_comp[0].data && !stbi__jpeg_begin_rows(j)) return 0;
       if (!stbi__parse_entropy_coded_data(j)) return 0;
       if (j->marker == STBI__MARKER_none) {
         // handle 0s at the end of image data from IP Kamera 9060
@@ -3399,7 +4061,7 @@ static int stbi__decode_jpeg_image(stbi__jpeg* j)
       int Ld = stbi__get16be(j->s);
       stbi__uint32 NL = stbi__get16be(j->s);
       if (Ld != 4) return stbi__err("bad DNL len", "Corrupt JPEG");
-      if (NL != j->s->img_y) return stbi__err("bad DNL height", "Corrupt JPEG");
+      if ((NL * j->block_size + 7) / 8 != j->s->img_y) return stbi__err("bad DNL height", "Corrupt JPEG");
     }
     else {
       if (!stbi__process_marker(j, m)) return 0;
@@ -3608,6 +4270,65 @@ static stbi_uc* stbi__resample_row_hv_2_simd(stbi_uc* out, stbi_uc* in_near, stb
 }
 #endif
 
+#ifdef STBI_AVX2
+// same filter as stbi__resample_row_hv_2_simd, 16 input pixels per step
+static STBI__AVX2_TARGET stbi_uc* stbi__resample_row_hv_2_avx2(stbi_uc* out, stbi_uc* in_near, stbi_uc* in_far, int w, int hs)
+{
+  int i = 0, t0, t1;
+  __m256i bias = _mm256_set1_epi16(8);
+
+  if (w == 1) {
+    out[0] = out[1] = stbi__div4(3 * in_near[0] + in_far[0] + 2);
+    return out;
+  }
+
+  t1 = 3 * in_near[0] + in_far[0];
+  for (; i < ((w - 1) & ~15); i += 16) {
+    // vertical pass: 3*near + far = 4*near + (far - near)
+    __m256i farw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (in_far + i)));
+    __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (in_near + i)));
+    __m256i curr = _mm256_add_epi16(_mm256_slli_epi16(nearw, 2), _mm256_sub_epi16(farw, nearw));
+
+    // current row shifted by one pixel each way across the lane boundary, with
+    // the previous pixel (t1) and the first pixel of the next group at the ends
+    __m256i prv0 = _mm256_alignr_epi8(curr, _mm256_permute2x128_si256(curr, curr, 0x08), 14);
+    __m256i nxt0 = _mm256_alignr_epi8(_mm256_permute2x128_si256(curr, curr, 0x81), curr, 2);
+    __m256i prev = _mm256_or_si256(prv0, _mm256_setr_epi16((short)t1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0));
+    __m256i next = _mm256_or_si256(nxt0, _mm256_setr_epi16(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                                           (short)(3 * in_near[i + 16] + in_far[i + 16])));
+
+    // horizontal pass: even = 4*cur + (prev - cur), odd = 4*cur + (next - cur)
+    __m256i curb = _mm256_add_epi16(_mm256_slli_epi16(curr, 2), bias);
+    __m256i even = _mm256_add_epi16(_mm256_sub_epi16(prev, curr), curb);
+    __m256i odd = _mm256_add_epi16(_mm256_sub_epi16(next, curr), curb);
+
+    // interleave within each lane, undo scaling; the lanes come out in order
+    __m256i de0 = _mm256_srli_epi16(_mm256_unpacklo_epi16(even, odd), 4);
+    __m256i de1 = _mm256_srli_epi16(_mm256_unpackhi_epi16(even, odd), 4);
+    _mm256_storeu_si256((__m256i*) (out + i * 2), _mm256_packus_epi16(de0, de1));
+
+    t1 = 3 * in_near[i + 15] + in_far[i + 15];
+  }
+  _mm256_zeroupper();
+
+  t0 = t1;
+  t1 = 3 * in_near[i] + in_far[i];
+  out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+
+  for (++i; i < w; ++i) {
+    t0 = t1;
+    t1 = 3 * in_near[i] + in_far[i];
+    out[i * 2 - 1] = stbi__div16(3 * t0 + t1 + 8);
+    out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+  }
+  out[w * 2 - 1] = stbi__div4(t1 + 2);
+
+  STBI_NOTUSED(hs);
+
+  return out;
+}
+#endif
+
 static stbi_uc* stbi__resample_row_generic(stbi_uc* out, stbi_uc* in_near, stbi_uc* in_far, int w, int hs)
 {
   // resample with nearest-neighbor
@@ -3619,6 +4340,13 @@ static stbi_uc* stbi__resample_row_generic(stbi_uc* out, stbi_uc* in_near, stbi_
   return out;
 }
 
+// fast 0..255 * 0..255 => 0..255 rounded multiplication
+static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
+{
+  unsigned int t = x * y + 128;
+  return (stbi_uc)((t + (t >> 8)) >> 8);
+}
+
 // this is a reduced-precision calculation of YCbCr-to-RGB introduced
 // to make sure the code produces the same results in both SIMD and scalar
 #define stbi__float2fixed(x)  (((int) ((x) * 4096.0f + 0.5f)) << 8)
@@ -3782,18 +4510,318 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc* out, stbi_uc const* y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_AVX2
+// same conversion as stbi__YCbCr_to_RGB_simd, 16 pixels per step
+static STBI__AVX2_TARGET void stbi__YCbCr_to_RGB_avx2(stbi_uc* out, stbi_uc const* y, stbi_uc const* pcb, stbi_uc const* pcr, int count, int step)
+{
+  int i = 0;
+
+  if (step == 4) {
+    __m256i signflip = _mm256_set1_epi8(-0x80);
+    __m256i cr_const0 = _mm256_set1_epi16((short)(1.40200f * 4096.0f + 0.5f));
+    __m256i cr_const1 = _mm256_set1_epi16(-(short)(0.71414f * 4096.0f + 0.5f));
+    __m256i cb_const0 = _mm256_set1_epi16(-(short)(0.34414f * 4096.0f + 0.5f));
+    __m256i cb_const1 = _mm256_set1_epi16((short)(1.77200f * 4096.0f + 0.5f));
+    __m256i y_bias = _mm256_set1_epi8((char)(unsigned char)128);
+    __m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+    for (; i + 15 < count; i += 16) {
+      // load 16 bytes each and spread them so that each lane's low half holds 8 pixels
+      __m256i y_bytes = _mm256_permute4x64_epi64(_mm256_castsi128_si256(_mm_loadu_si128((__m128i*) (y + i))), 0x50);
+      __m256i cr_bytes = _mm256_permute4x64_epi64(_mm256_castsi128_si256(_mm_loadu_si128((__m128i*) (pcr + i))), 0x50);
+      __m256i cb_bytes = _mm256_permute4x64_epi64(_mm256_castsi128_si256(_mm_loadu_si128((__m128i*) (pcb + i))), 0x50);
+      __m256i cr_biased = _mm256_xor_si256(cr_bytes, signflip); // -128
+      __m256i cb_biased = _mm256_xor_si256(cb_bytes, signflip); // -128
+
+      // unpack to short (and left-shift cr, cb by 8)
+      __m256i yw = _mm256_unpacklo_epi8(y_bias, y_bytes);
+      __m256i crw = _mm256_unpacklo_epi8(_mm256_setzero_si256(), cr_biased);
+      __m256i cbw = _mm256_unpacklo_epi8(_mm256_setzero_si256(), cb_biased);
+
+      // color transform
+      __m256i yws = _mm256_srli_epi16(yw, 4);
+      __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+      __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+      __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+      __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+      __m256i rws = _mm256_add_epi16(cr0, yws);
+      __m256i gwt = _mm256_add_epi16(cb0, yws);
+      __m256i bws = _mm256_add_epi16(yws, cb1);
+      __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+      // descale
+      __m256i rw = _mm256_srai_epi16(rws, 4);
+      __m256i bw = _mm256_srai_epi16(bws, 4);
+      __m256i gw = _mm256_srai_epi16(gws, 4);
+
+      // back to byte, transpose to interleave channels
+      __m256i brb = _mm256_packus_epi16(rw, bw);
+      __m256i gxb = _mm256_packus_epi16(gw, xw);
+      __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+      __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+      __m256i o0 = _mm256_unpacklo_epi16(t0, t1); // pixels 0-3 and 8-11
+      __m256i o1 = _mm256_unpackhi_epi16(t0, t1); // pixels 4-7 and 12-15
+
+      // store
+      _mm256_storeu_si256((__m256i*) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+      _mm256_storeu_si256((__m256i*) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+      out += 64;
+    }
+    _mm256_zeroupper();
+  }
+
+  stbi__YCbCr_to_RGB_simd(out, y + i, pcb + i, pcr + i, count - i, step);
+}
+#endif
+
+static void stbi__CMYK_to_RGB_row(stbi_uc* out, stbi_uc const* pc, stbi_uc const* pm, stbi_uc const* py, stbi_uc const* pk, int count, int step)
+{
+  int i;
+  for (i = 0; i < count; ++i) {
+    stbi_uc k = pk[i];
+    out[0] = stbi__blinn_8x8(pc[i], k);
+    out[1] = stbi__blinn_8x8(pm[i], k);
+    out[2] = stbi__blinn_8x8(py[i], k);
+    out[3] = 255;
+    out += step;
+  }
+}
+
+// turns the RGB that the YCbCr kernel produced from YCCK into the final RGB
+static void stbi__YCCK_fixup_row(stbi_uc* out, stbi_uc const* pk, int count, int step)
+{
+  int i;
+  for (i = 0; i < count; ++i) {
+    stbi_uc k = pk[i];
+    out[0] = stbi__blinn_8x8(255 - out[0], k);
+    out[1] = stbi__blinn_8x8(255 - out[1], k);
+    out[2] = stbi__blinn_8x8(255 - out[2], k);
+    out += step;
+  }
+}
+
+static void stbi__gray_to_RGB_row(stbi_uc* out, stbi_uc const* y, int count, int step)
+{
+  int i;
+  for (i = 0; i < count; ++i) {
+    out[0] = out[1] = out[2] = y[i];
+    out[3] = 255; // not used if step==3
+    out += step;
+  }
+}
+
+#ifdef STBI_SSE2
+// stbi__blinn_8x8 on 16-bit lanes. it's exact: x*y+128 fits 16 bits unsigned.
+stbi_inline static __m128i stbi__blinn_sse2(__m128i x, __m128i y)
+{
+  __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, y), _mm_set1_epi16(128));
+  return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// like the YCbCr kernels, these only accelerate step == 4
+static void stbi__CMYK_to_RGB_simd(stbi_uc* out, stbi_uc const* pc, stbi_uc const* pm, stbi_uc const* py, stbi_uc const* pk, int count, int step)
+{
+  int i = 0;
+  if (step == 4) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i xw = _mm_set1_epi16(255); // alpha channel
+    for (; i + 7 < count; i += 8) {
+      __m128i kw = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*) (pk + i)), zero);
+      __m128i rw = stbi__blinn_sse2(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*) (pc + i)), zero), kw);
+      __m128i gw = stbi__blinn_sse2(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*) (pm + i)), zero), kw);
+      __m128i bw = stbi__blinn_sse2(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*) (py + i)), zero), kw);
+
+      // same interleave as stbi__YCbCr_to_RGB_simd
+      __m128i brb = _mm_packus_epi16(rw, bw);
+      __m128i gxb = _mm_packus_epi16(gw, xw);
+      __m128i t0 = _mm_unpacklo_epi8(brb, gxb);
+      __m128i t1 = _mm_unpackhi_epi8(brb, gxb);
+      _mm_storeu_si128((__m128i*) (out + 0), _mm_unpacklo_epi16(t0, t1));
+      _mm_storeu_si128((__m128i*) (out + 16), _mm_unpackhi_epi16(t0, t1));
+      out += 32;
+    }
+  }
+  stbi__CMYK_to_RGB_row(out, pc + i, pm + i, py + i, pk + i, count - i, step);
+}
+
+static void stbi__YCCK_fixup_simd(stbi_uc* out, stbi_uc const* pk, int count, int step)
+{
+  int i = 0;
+  if (step == 4) {
+    __m128i zero = _mm_setzero_si128();
+    // inverting alpha and multiplying it by 255 leaves it as it was
+    __m128i invert = _mm_set1_epi32(0x00ffffff);
+    __m128i alpha = _mm_set1_epi32((int)0xff000000);
+    for (; i + 7 < count; i += 8) {
+      // k repeated across each pixel's r, g and b
+      __m128i kb = _mm_loadl_epi64((__m128i*) (pk + i));
+      __m128i kw = _mm_unpacklo_epi8(kb, kb);
+      __m128i kd0 = _mm_or_si128(_mm_unpacklo_epi16(kw, kw), alpha);
+      __m128i kd1 = _mm_or_si128(_mm_unpackhi_epi16(kw, kw), alpha);
+      __m128i p0 = _mm_xor_si128(_mm_loadu_si128((__m128i*) (out + 0)), invert);
+      __m128i p1 = _mm_xor_si128(_mm_loadu_si128((__m128i*) (out + 16)), invert);
+      __m128i p0l = stbi__blinn_sse2(_mm_unpacklo_epi8(p0, zero), _mm_unpacklo_epi8(kd0, zero));
+      __m128i p0h = stbi__blinn_sse2(_mm_unpackhi_epi8(p0, zero), _mm_unpackhi_epi8(kd0, zero));
+      __m128i p1l = stbi__blinn_sse2(_mm_unpacklo_epi8(p1, zero), _mm_unpacklo_epi8(kd1, zero));
+      __m128i p1h = stbi__blinn_sse2(_mm_unpackhi_epi8(p1, zero), _mm_unpackhi_epi8(kd1, zero));
+      _mm_storeu_si128((__m128i*) (out + 0), _mm_packus_epi16(p0l, p0h));
+      _mm_storeu_si128((__m128i*) (out + 16), _mm_packus_epi16(p1l, p1h));
+      out += 32;
+    }
+  }
+  stbi__YCCK_fixup_row(out, pk + i, count - i, step);
+}
+
+static void stbi__gray_to_RGB_simd(stbi_uc* out, stbi_uc const* y, int count, int step)
+{
+  int i = 0;
+  if (step == 4) {
+    __m128i xb = _mm_set1_epi8(-1); // alpha channel
+    for (; i + 15 < count; i += 16) {
+      __m128i yb = _mm_loadu_si128((__m128i*) (y + i));
+      __m128i yy0 = _mm_unpacklo_epi8(yb, yb);
+      __m128i yy1 = _mm_unpackhi_epi8(yb, yb);
+      __m128i yx0 = _mm_unpacklo_epi8(yb, xb);
+      __m128i yx1 = _mm_unpackhi_epi8(yb, xb);
+      _mm_storeu_si128((__m128i*) (out + 0), _mm_unpacklo_epi16(yy0, yx0));
+      _mm_storeu_si128((__m128i*) (out + 16), _mm_unpackhi_epi16(yy0, yx0));
+      _mm_storeu_si128((__m128i*) (out + 32), _mm_unpacklo_epi16(yy1, yx1));
+      _mm_storeu_si128((__m128i*) (out + 48), _mm_unpackhi_epi16(yy1, yx1));
+      out += 64;
+    }
+  }
+  stbi__gray_to_RGB_row(out, y + i, count - i, step);
+}
+#endif // STBI_SSE2
+
+#ifdef STBI_AVX2
+stbi_inline static STBI__AVX2_TARGET __m256i stbi__blinn_avx2(__m256i x, __m256i y)
+{
+  __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(x, y), _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+// 16 bytes spread so that the low half of each lane holds 8 of them, widened to 16 bits
+#define stbi__spread_avx2(p) \
+  _mm256_unpacklo_epi8(_mm256_permute4x64_epi64(_mm256_castsi128_si256(_mm_loadu_si128((__m128i*) (p))), 0x50), \
+                       _mm256_setzero_si256())
+
+static STBI__AVX2_TARGET void stbi__CMYK_to_RGB_avx2(stbi_uc* out, stbi_uc const* pc, stbi_uc const* pm, stbi_uc const* py, stbi_uc const* pk, int count, int step)
+{
+  int i = 0;
+  if (step == 4) {
+    __m256i xw = _mm256_set1_epi16(255); // alpha channel
+    for (; i + 15 < count; i += 16) {
+      __m256i kw = stbi__spread_avx2(pk + i);
+      __m256i rw = stbi__blinn_avx2(stbi__spread_avx2(pc + i), kw);
+      __m256i gw = stbi__blinn_avx2(stbi__spread_avx2(pm + i), kw);
+      __m256i bw = stbi__blinn_avx2(stbi__spread_avx2(py + i), kw);
+
+      // same interleave as stbi__YCbCr_to_RGB_avx2
+      __m256i brb = _mm256_packus_epi16(rw, bw);
+      __m256i gxb = _mm256_packus_epi16(gw, xw);
+      __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+      __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+      __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+      __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+      _mm256_storeu_si256((__m256i*) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+      _mm256_storeu_si256((__m256i*) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+      out += 64;
+    }
+    _mm256_zeroupper();
+  }
+  stbi__CMYK_to_RGB_simd(out, pc + i, pm + i, py + i, pk + i, count - i, step);
+}
+
+static STBI__AVX2_TARGET void stbi__YCCK_fixup_avx2(stbi_uc* out, stbi_uc const* pk, int count, int step)
+{
+  int i = 0;
+  if (step == 4) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i invert = _mm256_set1_epi32(0x00ffffff);
+    __m256i alpha = _mm256_set1_epi32((int)0xff000000);
+    // copies the low byte of each dword into its r, g and b
+    __m256i splat = _mm256_setr_epi8(0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1,
+                                     0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1);
+    for (; i + 15 < count; i += 16) {
+      __m256i kd0 = _mm256_or_si256(_mm256_shuffle_epi8(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*) (pk + i))), splat), alpha);
+      __m256i kd1 = _mm256_or_si256(_mm256_shuffle_epi8(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*) (pk + i + 8))), splat), alpha);
+      __m256i p0 = _mm256_xor_si256(_mm256_loadu_si256((__m256i*) (out + 0)), invert);
+      __m256i p1 = _mm256_xor_si256(_mm256_loadu_si256((__m256i*) (out + 32)), invert);
+      __m256i p0l = stbi__blinn_avx2(_mm256_unpacklo_epi8(p0, zero), _mm256_unpacklo_epi8(kd0, zero));
+      __m256i p0h = stbi__blinn_avx2(_mm256_unpackhi_epi8(p0, zero), _mm256_unpackhi_epi8(kd0, zero));
+      __m256i p1l = stbi__blinn_avx2(_mm256_unpacklo_epi8(p1, zero), _mm256_unpacklo_epi8(kd1, zero));
+      __m256i p1h = stbi__blinn_avx2(_mm256_unpackhi_epi8(p1, zero), _mm256_unpackhi_epi8(kd1, zero));
+      _mm256_storeu_si256((__m256i*) (out + 0), _mm256_packus_epi16(p0l, p0h));
+      _mm256_storeu_si256((__m256i*) (out + 32), _mm256_packus_epi16(p1l, p1h));
+      out += 64;
+    }
+    _mm256_zeroupper();
+  }
+  stbi__YCCK_fixup_simd(out, pk + i, count - i, step);
+}
+
+static STBI__AVX2_TARGET void stbi__gray_to_RGB_avx2(stbi_uc* out, stbi_uc const* y, int count, int step)
+{
+  int i = 0;
+  if (step == 4) {
+    __m256i xb = _mm256_set1_epi8(-1); // alpha channel
+    for (; i + 31 < count; i += 32) {
+      __m256i yb = _mm256_loadu_si256((__m256i*) (y + i));
+      __m256i yy0 = _mm256_unpacklo_epi8(yb, yb); // pixels 0-7 and 16-23
+      __m256i yy1 = _mm256_unpackhi_epi8(yb, yb); // pixels 8-15 and 24-31
+      __m256i yx0 = _mm256_unpacklo_epi8(yb, xb);
+      __m256i yx1 = _mm256_unpackhi_epi8(yb, xb);
+      __m256i o0 = _mm256_unpacklo_epi16(yy0, yx0); // pixels 0-3 and 16-19
+      __m256i o1 = _mm256_unpackhi_epi16(yy0, yx0); // pixels 4-7 and 20-23
+      __m256i o2 = _mm256_unpacklo_epi16(yy1, yx1); // pixels 8-11 and 24-27
+      __m256i o3 = _mm256_unpackhi_epi16(yy1, yx1); // pixels 12-15 and 28-31
+      _mm256_storeu_si256((__m256i*) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+      _mm256_storeu_si256((__m256i*) (out + 32), _mm256_permute2x128_si256(o2, o3, 0x20));
+      _mm256_storeu_si256((__m256i*) (out + 64), _mm256_permute2x128_si256(o0, o1, 0x31));
+      _mm256_storeu_si256((__m256i*) (out + 96), _mm256_permute2x128_si256(o2, o3, 0x31));
+      out += 128;
+    }
+    _mm256_zeroupper();
+  }
+  stbi__gray_to_RGB_simd(out, y + i, count - i, step);
+}
+
+#undef stbi__spread_avx2
+#endif // STBI_AVX2
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg* j)
 {
   j->idct_block_kernel = stbi__idct_block;
   j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
   j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
+  j->CMYK_to_RGB_kernel = stbi__CMYK_to_RGB_row;
+  j->YCCK_fixup_kernel = stbi__YCCK_fixup_row;
+  j->gray_to_RGB_kernel = stbi__gray_to_RGB_row;
+  j->row_output = NULL;
+  j->pipelined = 0;
+  j->block_size = 8;
 
 #ifdef STBI_SSE2
   if (stbi__sse2_available()) {
     j->idct_block_kernel = stbi__idct_simd;
     j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
     j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+    j->CMYK_to_RGB_kernel = stbi__CMYK_to_RGB_simd;
+    j->YCCK_fixup_kernel = stbi__YCCK_fixup_simd;
+    j->gray_to_RGB_kernel = stbi__gray_to_RGB_simd;
+  }
+#endif
+
+#ifdef STBI_AVX2
+  if (stbi__avx2_available()) {
+    j->idct_block_kernel = stbi__idct_avx2;
+    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+    j->CMYK_to_RGB_kernel = stbi__CMYK_to_RGB_avx2;
+    j->YCCK_fixup_kernel = stbi__YCCK_fixup_avx2;
+    j->gray_to_RGB_kernel = stbi__gray_to_RGB_avx2;
   }
 #endif
 
@@ -3813,6 +4841,7 @@ static void stbi__cleanup_jpeg(stbi__jpeg* j)
 typedef struct
 {
   resample_row_func resample;
+  stbi_uc* linebuf; // scratch row the resampler writes to
   stbi_uc* line0, * line1;
   int hs, vs;   // expansion factor in each axis
   int w_lores; // horizontal pixels pre-expansion
@@ -3820,11 +4849,142 @@ typedef struct
   int ypos;    // which pre-expansion row we're on
 } stbi__resample;
 
-// fast 0..255 * 0..255 => 0..255 rounded multiplication
-static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
+// choose the resamplers that bring each component to full resolution, and allocate their line buffers
+static int stbi__jpeg_setup_resample(stbi__jpeg* z, stbi__resample* res_comp, int decode_n)
 {
-  unsigned int t = x * y + 128;
-  return (stbi_uc)((t + (t >> 8)) >> 8);
+  int k;
+  for (k = 0; k < decode_n; ++k) {
+    stbi__resample* r = &res_comp[k];
+
+    // allocate line buffer big enough for upsampling off the edges
+    // with upsample factor of 4
+    z->img_comp[k].linebuf = (stbi_uc*)stbi__malloc(z->s->img_x + 3);
+    if (!z->img_comp[k].linebuf) return stbi__err("outofmem", "Out of memory");
+
+    // components decoded with larger blocks than the image need less upsampling
+    r->hs = z->img_h_max * z->block_size / (z->img_comp[k].h * z->img_comp[k].block_size);
+    r->vs = z->img_v_max * z->block_size / (z->img_comp[k].v * z->img_comp[k].block_size);
+    r->ystep = r->vs >> 1;
+    r->w_lores = (z->s->img_x + r->hs - 1) / r->hs;
+    r->ypos = 0;
+    r->line0 = r->line1 = z->img_comp[k].data;
+    r->linebuf = z->img_comp[k].linebuf;
+
+    if (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+    else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+    else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+    else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+    else                               r->resample = stbi__resample_row_generic;
+  }
+  return 1;
+}
+
+// resample and color-convert the next output row into out
+static void stbi__jpeg_output_row(stbi__jpeg* z, stbi__resample* res_comp, int decode_n, int n, int is_rgb, stbi_uc* out)
+{
+  int k;
+  unsigned int i;
+  stbi_uc* coutput[4] = { NULL, NULL, NULL, NULL };
+
+  for (k = 0; k < decode_n; ++k) {
+    stbi__resample* r = &res_comp[k];
+    int y_bot = r->ystep >= (r->vs >> 1);
+    coutput[k] = r->resample(r->linebuf,
+                             y_bot ? r->line1 : r->line0,
+                             y_bot ? r->line0 : r->line1,
+                             r->w_lores, r->hs);
+    if (++r->ystep >= r->vs) {
+      r->ystep = 0;
+      r->line0 = r->line1;
+      if (++r->ypos < z->img_comp[k].y)
+        r->line1 = z->img_comp[k].data + z->img_comp[k].w2 * (r->ypos % z->img_comp[k].rows);
+    }
+  }
+  if (n >= 3) {
+    stbi_uc* y = coutput[0];
+    if (z->s->img_n == 3) {
+      if (is_rgb) {
+        for (i = 0; i < z->s->img_x; ++i) {
+          out[0] = y[i];
+          out[1] = coutput[1][i];
+          out[2] = coutput[2][i];
+          out[3] = 255;
+          out += n;
+        }
+      }
+      else {
+        z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+      }
+    }
+    else if (z->s->img_n == 4) {
+      if (z->app14_color_transform == 0) { // CMYK
+        z->CMYK_to_RGB_kernel(out, coutput[0], coutput[1], coutput[2], coutput[3], z->s->img_x, n);
+      }
+      else if (z->app14_color_transform == 2) { // YCCK
+        z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+        z->YCCK_fixup_kernel(out, coutput[3], z->s->img_x, n);
+      }
+      else { // YCbCr + alpha?  Ignore the fourth channel for now
+        z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+      }
+    }
+    else
+      z->gray_to_RGB_kernel(out, y, z->s->img_x, n);
+  }
+  else {
+    if (is_rgb) {
+      if (n == 1)
+        for (i = 0; i < z->s->img_x; ++i)
+          *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+      else {
+        for (i = 0; i < z->s->img_x; ++i, out += 2) {
+          out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+          out[1] = 255;
+        }
+      }
+    }
+    else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+      for (i = 0; i < z->s->img_x; ++i) {
+        stbi_uc m = coutput[3][i];
+        stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+        stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+        stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+        out[0] = stbi__compute_y(r, g, b);
+        out[1] = 255;
+        out += n;
+      }
+    }
+    else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+      for (i = 0; i < z->s->img_x; ++i) {
+        out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+        out[1] = 255;
+        out += n;
+      }
+    }
+    else {
+      stbi_uc* y = coutput[0];
+      if (n == 1)
+        for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
+      else
+        for (i = 0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+    }
+  }
+}
+
+// number of components to generate and to decode for req_comp; returns 0 if there is nothing to decode
+static int stbi__jpeg_output_components(stbi__jpeg* z, int req_comp, int* n, int* decode_n, int* is_rgb)
+{
+  // determine actual number of components to generate
+  *n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
+
+  *is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+
+  if (z->s->img_n == 3 && *n < 3 && !*is_rgb)
+    *decode_n = 1;
+  else
+    *decode_n = z->s->img_n;
+
+  return *decode_n > 0;
 }
 
 static stbi_uc* load_jpeg_image(stbi__jpeg* z, int* out_x, int* out_y, int* comp, int req_comp)
@@ -3838,165 +4998,371 @@ static stbi_uc* load_jpeg_image(stbi__jpeg* z, int* out_x, int* out_y, int* comp
   // load a jpeg image from whichever source, but leave in YCbCr format
   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
-  // determine actual number of components to generate
-  n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
-
-  is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
-
-  if (z->s->img_n == 3 && n < 3 && !is_rgb)
-    decode_n = 1;
-  else
-    decode_n = z->s->img_n;
-
   // nothing to do if no components requested; check this now to avoid
   // accessing uninitialized coutput[0] later
-  if (decode_n <= 0) { stbi__cleanup_jpeg(z); return NULL; }
+  if (!stbi__jpeg_output_components(z, req_comp, &n, &decode_n, &is_rgb)) { stbi__cleanup_jpeg(z); return NULL; }
 
   // resample and color-convert
   {
-    int k;
-    unsigned int i, j;
+    unsigned int j;
     stbi_uc* output;
-    stbi_uc* coutput[4] = { NULL, NULL, NULL, NULL };
-
     stbi__resample res_comp[4];
 
-    for (k = 0; k < decode_n; ++k) {
-      stbi__resample* r = &res_comp[k];
-
-      // allocate line buffer big enough for upsampling off the edges
-      // with upsample factor of 4
-      z->img_comp[k].linebuf = (stbi_uc*)stbi__malloc(z->s->img_x + 3);
-      if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-      r->hs = z->img_h_max / z->img_comp[k].h;
-      r->vs = z->img_v_max / z->img_comp[k].v;
-      r->ystep = r->vs >> 1;
-      r->w_lores = (z->s->img_x + r->hs - 1) / r->hs;
-      r->ypos = 0;
-      r->line0 = r->line1 = z->img_comp[k].data;
-
-      if (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-      else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-      else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-      else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-      else                               r->resample = stbi__resample_row_generic;
-    }
+    if (!stbi__jpeg_setup_resample(z, res_comp, decode_n)) { stbi__cleanup_jpeg(z); return NULL; }
 
     // can't error after this so, this is safe
     output = (stbi_uc*)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
     if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
 
     // now go ahead and resample
-    for (j = 0; j < z->s->img_y; ++j) {
-      stbi_uc* out = output + n * z->s->img_x * j;
-      for (k = 0; k < decode_n; ++k) {
-        stbi__resample* r = &res_comp[k];
-        int y_bot = r->ystep >= (r->vs >> 1);
-        coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                 y_bot ? r->line1 : r->line0,
-                                 y_bot ? r->line0 : r->line1,
-                                 r->w_lores, r->hs);
-        if (++r->ystep >= r->vs) {
-          r->ystep = 0;
-          r->line0 = r->line1;
-          if (++r->ypos < z->img_comp[k].y)
-            r->line1 += z->img_comp[k].w2;
-        }
+    for (j = 0; j < z->s->img_y; ++j)
+      stbi__jpeg_output_row(z, res_comp, decode_n, n, is_rgb, output + n * z->s->img_x * j);
+    stbi__cleanup_jpeg(z);
+    *out_x = z->s->img_x;
+    *out_y = z->s->img_y;
+    if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
+    return output;
+  }
+}
+
+struct stbi__jpeg_row_output
+{
+  stbi_row_callback callback;
+  void* user;
+  int req_comp;
+  int n, decode_n, is_rgb;
+  stbi__resample res_comp[4];
+  int decoded[4];  // rows of each component decoded so far
+  int next_row;    // next output row to hand to the callback
+  stbi_uc* row;    // one output row, NULL until the resamplers are set up
+};
+
+static int stbi__jpeg_setup_row_output(stbi__jpeg* z);
+
+// allocate the component planes at the first scan; if that scan carries every component,
+// only two MCU rows of each are kept and rows are handed out as soon as they are decoded
+static int stbi__jpeg_begin_rows(stbi__jpeg* z)
+{
+  stbi__jpeg_row_output* o = z->row_output;
+  // the restart split only runs on whole planes, so a streamed scan is left to the serial or pipelined decoder
+  int i, streaming = z->scan_n == z->s->img_n;
+
+  // a pipelined scan keeps three bands: one being transformed, and the two its color conversion reads
+  z->pipelined = stbi__jpeg_pipelined(z);
+  for (i = 0; i < z->s->img_n; ++i) {
+    if (z->pipelined) {
+      int band_rows = z->img_comp[i].v * z->img_comp[i].block_size * STBI__PIPELINE_MCU_ROWS;
+      if (band_rows * 3 < z->img_comp[i].h2)
+        z->img_comp[i].rows = band_rows * 3;
+    }
+    else if (streaming)
+      z->img_comp[i].rows = z->img_comp[i].v * z->img_comp[i].block_size * 2;
+    z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].rows, 15);
+    if (z->img_comp[i].raw_data == NULL)
+      return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
+    z->img_comp[i].data = (stbi_uc*)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
+    o->decoded[i] = 0;
+  }
+  return stbi__jpeg_setup_row_output(z);
+}
+
+// choose output components and resamplers once the component planes exist
+static int stbi__jpeg_setup_row_output(stbi__jpeg* z)
+{
+  stbi__jpeg_row_output* o = z->row_output;
+  if (!stbi__jpeg_output_components(z, o->req_comp, &o->n, &o->decode_n, &o->is_rgb))
+    return stbi__err("bad req_comp", "Internal error");
+  if (!stbi__jpeg_setup_resample(z, o->res_comp, o->decode_n))
+    return 0;
+  o->row = (stbi_uc*)stbi__malloc_mad2(o->n, z->s->img_x, 1); // same slack as load_jpeg_image's output
+  if (!o->row) return stbi__err("outofmem", "Out of memory");
+  return 1;
+}
+
+// hand out every output row whose component rows are available; all_rows at the end of the image
+static int stbi__jpeg_emit_rows(stbi__jpeg* z, int all_rows)
+{
+  stbi__jpeg_row_output* o = z->row_output;
+  int k;
+
+  while (o->next_row < (int)z->s->img_y) {
+    if (!all_rows) {
+      // the resampler reads the row at ypos (and the one before it) for the next output row
+      for (k = 0; k < o->decode_n; ++k) {
+        int needed = o->res_comp[k].ypos < z->img_comp[k].y ? o->res_comp[k].ypos : z->img_comp[k].y - 1;
+        if (needed >= o->decoded[k]) return 1;
       }
-      if (n >= 3) {
-        stbi_uc* y = coutput[0];
-        if (z->s->img_n == 3) {
-          if (is_rgb) {
-            for (i = 0; i < z->s->img_x; ++i) {
-              out[0] = y[i];
-              out[1] = coutput[1][i];
-              out[2] = coutput[2][i];
-              out[3] = 255;
-              out += n;
-            }
-          }
-          else {
-            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-          }
-        }
-        else if (z->s->img_n == 4) {
-          if (z->app14_color_transform == 0) { // CMYK
-            for (i = 0; i < z->s->img_x; ++i) {
-              stbi_uc m = coutput[3][i];
-              out[0] = stbi__blinn_8x8(coutput[0][i], m);
-              out[1] = stbi__blinn_8x8(coutput[1][i], m);
-              out[2] = stbi__blinn_8x8(coutput[2][i], m);
-              out[3] = 255;
-              out += n;
-            }
-          }
-          else if (z->app14_color_transform == 2) { // YCCK
-            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-            for (i = 0; i < z->s->img_x; ++i) {
-              stbi_uc m = coutput[3][i];
-              out[0] = stbi__blinn_8x8(255 - out[0], m);
-              out[1] = stbi__blinn_8x8(255 - out[1], m);
-              out[2] = stbi__blinn_8x8(255 - out[2], m);
-              out += n;
-            }
-          }
-          else { // YCbCr + alpha?  Ignore the fourth channel for now
-            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+    }
+    stbi__jpeg_output_row(z, o->res_comp, o->decode_n, o->n, o->is_rgb, o->row);
+    if (!o->callback(o->user, o->row, o->next_row, z->s->img_x, z->s->img_y))
+      return stbi__err("aborted", "Load aborted by callback");
+    ++o->next_row;
+  }
+  return 1;
+}
+
+// called after each MCU row (or block row, for single-component scans) of a streamed scan
+static int stbi__jpeg_rows_decoded(stbi__jpeg* z, int row_count)
+{
+  int k;
+  if (z->scan_n == 1)
+    z->row_output->decoded[z->order[0]] = row_count * z->img_comp[z->order[0]].block_size;
+  else
+    for (k = 0; k < z->scan_n; ++k)
+      z->row_output->decoded[z->order[k]] = row_count * z->img_comp[z->order[k]].v * z->img_comp[z->order[k]].block_size;
+  return stbi__jpeg_emit_rows(z, 0);
+}
+
+#ifdef STBI_PARALLEL_FOR
+
+// output rows converted per color conversion task
+#define STBI__PIPELINE_OUTPUT_ROWS   16
+
+typedef struct
+{
+  stbi__jpeg* z;
+  short* coeff[2][4];    // coefficients of the bands being decoded and transformed, per component
+  void* raw_coeff[2];
+  int band_count;
+  int decode_band;       // band entropy-decoded in this step, or -1
+  int idct_band;         // band inverse-transformed in this step, or -1
+  int idct_tasks;        // MCU rows of idct_band
+  int color_tasks, rows_per_task;
+  int first_row, row_count; // output rows converted in this step
+  int max_rows;
+  size_t row_stride;     // a byte past each row, as the converters write a 4th byte even for 3 components
+  stbi_uc* rows;         // their pixels
+  stbi_uc* linebuf;      // scratch rows for each color conversion task
+  int stopped;           // a missing restart marker ended the scan
+  volatile int failed;
+} stbi__jpeg_pipeline;
+
+// number of blocks across a band of the scan's nth component
+static int stbi__jpeg_band_width(stbi__jpeg* z, int n)
+{
+  return z->img_mcu_x * z->img_comp[n].h;
+}
+
+// entropy-decode one band of MCU rows into coefficient blocks. like the serial decoder, an MCU without
+// its restart marker ends the scan; the blocks after it are left empty
+static int stbi__jpeg_pipeline_decode(stbi__jpeg_pipeline* p, int band)
+{
+  stbi__jpeg* z = p->z;
+  int first = band * STBI__PIPELINE_MCU_ROWS;
+  int last = first + STBI__PIPELINE_MCU_ROWS < z->img_mcu_y ? first + STBI__PIPELINE_MCU_ROWS : z->img_mcu_y;
+  int i, j, k, x, y;
+  for (j = first; j < last; ++j) {
+    for (i = 0; i < z->img_mcu_x; ++i) {
+      for (k = 0; k < z->scan_n; ++k) {
+        int n = z->order[k];
+        for (y = 0; y < z->img_comp[n].v; ++y) {
+          for (x = 0; x < z->img_comp[n].h; ++x) {
+            int row = (j - first) * z->img_comp[n].v + y;
+            short* data = p->coeff[band & 1][n] + 64 * (row * stbi__jpeg_band_width(z, n) + i * z->img_comp[n].h + x);
+            int ha = z->img_comp[n].ha;
+            if (p->stopped)
+              memset(data, 0, 64 * sizeof(data[0]));
+            else if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq]))
+              return 0;
           }
         }
-        else
-          for (i = 0; i < z->s->img_x; ++i) {
-            out[0] = out[1] = out[2] = y[i];
-            out[3] = 255; // not used if n==3
-            out += n;
-          }
       }
-      else {
-        if (is_rgb) {
-          if (n == 1)
-            for (i = 0; i < z->s->img_x; ++i)
-              *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-          else {
-            for (i = 0; i < z->s->img_x; ++i, out += 2) {
-              out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-              out[1] = 255;
-            }
-          }
-        }
-        else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-          for (i = 0; i < z->s->img_x; ++i) {
-            stbi_uc m = coutput[3][i];
-            stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-            stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-            stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-            out[0] = stbi__compute_y(r, g, b);
-            out[1] = 255;
-            out += n;
-          }
-        }
-        else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-          for (i = 0; i < z->s->img_x; ++i) {
-            out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-            out[1] = 255;
-            out += n;
-          }
-        }
-        else {
-          stbi_uc* y = coutput[0];
-          if (n == 1)
-            for (i = 0; i < z->s->img_x; ++i) out[i] = y[i];
-          else
-            for (i = 0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
-        }
+      if (!p->stopped && --z->todo <= 0) {
+        if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+        if (!STBI__RESTART(z->marker)) p->stopped = 1;
+        else stbi__jpeg_reset(z);
       }
     }
-    stbi__cleanup_jpeg(z);
-    *out_x = z->s->img_x;
-    *out_y = z->s->img_y;
-    if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
-    return output;
   }
+  return 1;
+}
+
+// inverse-transform one MCU row of a decoded band into the component planes
+static void stbi__jpeg_pipeline_idct(stbi__jpeg_pipeline* p, int mcu_row)
+{
+  stbi__jpeg* z = p->z;
+  int k, y, i;
+  for (k = 0; k < z->scan_n; ++k) {
+    int n = z->order[k];
+    int bs = z->img_comp[n].block_size;
+    int width = stbi__jpeg_band_width(z, n);
+    for (y = 0; y < z->img_comp[n].v; ++y) {
+      int row = mcu_row * z->img_comp[n].v + y;
+      int y2 = ((p->idct_band * STBI__PIPELINE_MCU_ROWS * z->img_comp[n].v + row) * bs) % z->img_comp[n].rows;
+      short* data = p->coeff[p->idct_band & 1][n] + 64 * row * width;
+      for (i = 0; i < width; ++i, data += 64)
+        z->img_comp[n].idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * y2 + i * bs, z->img_comp[n].w2, data);
+    }
+  }
+}
+
+// resample and color-convert a run of output rows with private copies of the resamplers, set to where
+// stbi__jpeg_output_row would have left them at the first row
+static void stbi__jpeg_pipeline_color(stbi__jpeg_pipeline* p, int task)
+{
+  stbi__jpeg* z = p->z;
+  stbi__jpeg_row_output* o = z->row_output;
+  stbi__resample res_comp[4];
+  int first = task * p->rows_per_task, last = first + p->rows_per_task, k, row;
+  if (last > p->row_count) last = p->row_count;
+  for (k = 0; k < o->decode_n; ++k) {
+    stbi__resample* r = &res_comp[k];
+    int line0, line1, cy = z->img_comp[k].y;
+    int step = (o->res_comp[k].vs >> 1) + p->first_row + first;
+    *r = o->res_comp[k];
+    r->linebuf = p->linebuf + (z->s->img_x + 3) * (task * o->decode_n + k);
+    r->ypos = step / r->vs;
+    r->ystep = step % r->vs;
+    line1 = r->ypos < cy ? r->ypos : cy - 1;
+    line0 = r->ypos == 0 ? 0 : r->ypos - 1 < cy ? r->ypos - 1 : cy - 1;
+    r->line0 = z->img_comp[k].data + z->img_comp[k].w2 * (line0 % z->img_comp[k].rows);
+    r->line1 = z->img_comp[k].data + z->img_comp[k].w2 * (line1 % z->img_comp[k].rows);
+  }
+  for (row = first; row < last; ++row)
+    stbi__jpeg_output_row(z, res_comp, o->decode_n, o->n, o->is_rgb, p->rows + p->row_stride * row);
+}
+
+static void stbi__jpeg_pipeline_task(void* context, int index)
+{
+  stbi__jpeg_pipeline* p = (stbi__jpeg_pipeline*)context;
+  if (p->decode_band >= 0 && index-- == 0) {
+    if (!stbi__jpeg_pipeline_decode(p, p->decode_band)) p->failed = 1;
+  }
+  else if (p->idct_band >= 0 && index < p->idct_tasks)
+    stbi__jpeg_pipeline_idct(p, index);
+  else
+    stbi__jpeg_pipeline_color(p, p->idct_band >= 0 ? index - p->idct_tasks : index);
+}
+
+// number of output rows from next_row on whose component rows have all been transformed
+static int stbi__jpeg_pipeline_ready_rows(stbi__jpeg* z, int limit)
+{
+  stbi__jpeg_row_output* o = z->row_output;
+  int row, k;
+  for (row = o->next_row; row < (int)z->s->img_y && row - o->next_row < limit; ++row) {
+    for (k = 0; k < o->decode_n; ++k) {
+      int ypos = ((o->res_comp[k].vs >> 1) + row) / o->res_comp[k].vs;
+      int needed = ypos < z->img_comp[k].y ? ypos : z->img_comp[k].y - 1;
+      if (needed >= o->decoded[k]) return row - o->next_row;
+    }
+  }
+  return row - o->next_row;
+}
+
+static void stbi__jpeg_free_pipeline(stbi__jpeg_pipeline* p)
+{
+  STBI_FREE(p->raw_coeff[0]);
+  STBI_FREE(p->raw_coeff[1]);
+  STBI_FREE(p->rows);
+  STBI_FREE(p->linebuf);
+}
+
+// decode a row-streamed baseline scan a band of MCU rows per step, each step running three stages at
+// once: the next band is entropy-decoded on one thread while this one is inverse-transformed a row of
+// MCUs per task and the output rows ready from the bands before are color-converted; the converted rows
+// are then handed to the callback in order
+static int stbi__jpeg_decode_pipelined(stbi__jpeg* z)
+{
+  stbi__jpeg_row_output* o = z->row_output;
+  stbi__jpeg_pipeline p;
+  int band, b, k, row, result = 1;
+  // one band of input rows covers this many output rows, plus the rows straddling its edges
+  int band_rows = (STBI__PIPELINE_MCU_ROWS + 2) * z->img_v_max * z->block_size;
+
+  memset(&p, 0, sizeof(p));
+  p.z = z;
+  p.band_count = (z->img_mcu_y + STBI__PIPELINE_MCU_ROWS - 1) / STBI__PIPELINE_MCU_ROWS;
+  p.max_rows = band_rows;
+  p.color_tasks = (band_rows + STBI__PIPELINE_OUTPUT_ROWS - 1) / STBI__PIPELINE_OUTPUT_ROWS;
+  for (b = 0; b < 2; ++b) {
+    size_t blocks = 0, offset = 0;
+    for (k = 0; k < z->scan_n; ++k)
+      blocks += (size_t)stbi__jpeg_band_width(z, z->order[k]) * z->img_comp[z->order[k]].v * STBI__PIPELINE_MCU_ROWS;
+    p.raw_coeff[b] = stbi__malloc_mad3((int)blocks, 64, sizeof(short), 15);
+    if (!p.raw_coeff[b]) break;
+    for (k = 0; k < z->scan_n; ++k) {
+      int n = z->order[k];
+      p.coeff[b][n] = (short*)(((size_t)p.raw_coeff[b] + 15) & ~15) + offset;
+      offset += (size_t)stbi__jpeg_band_width(z, n) * z->img_comp[n].v * STBI__PIPELINE_MCU_ROWS * 64;
+    }
+  }
+  p.row_stride = (size_t)o->n * z->s->img_x + 1;
+  p.rows = (stbi_uc*)stbi__malloc_mad2(o->n * z->s->img_x + 1, p.max_rows, 0);
+  p.linebuf = (stbi_uc*)stbi__malloc_mad3(p.color_tasks * o->decode_n, z->s->img_x + 3, 1, 0);
+  if (!p.raw_coeff[0] || !p.raw_coeff[1] || !p.rows || !p.linebuf) {
+    stbi__jpeg_free_pipeline(&p);
+    return stbi__err("outofmem", "Out of memory");
+  }
+
+  if (!stbi__jpeg_pipeline_decode(&p, 0)) result = 0;
+  for (band = 0; result && (band < p.band_count || o->next_row < (int)z->s->img_y); ++band) {
+    int tasks;
+    p.decode_band = band + 1 < p.band_count ? band + 1 : -1;
+    p.idct_band = band < p.band_count ? band : -1;
+    p.idct_tasks = z->img_mcu_y - band * STBI__PIPELINE_MCU_ROWS;
+    if (p.idct_tasks > STBI__PIPELINE_MCU_ROWS) p.idct_tasks = STBI__PIPELINE_MCU_ROWS;
+    p.first_row = o->next_row;
+    p.row_count = stbi__jpeg_pipeline_ready_rows(z, p.max_rows);
+    p.rows_per_task = (p.row_count + p.color_tasks - 1) / p.color_tasks;
+    if (p.rows_per_task < 1) p.rows_per_task = 1;
+    tasks = (p.decode_band >= 0) + (p.idct_band >= 0 ? p.idct_tasks : 0) + (p.row_count + p.rows_per_task - 1) / p.rows_per_task;
+    STBI_PARALLEL_FOR(tasks, stbi__jpeg_pipeline_task, &p);
+    if (p.failed) {
+      result = 0;
+      break;
+    }
+
+    for (row = 0; row < p.row_count; ++row) {
+      if (!o->callback(o->user, p.rows + p.row_stride * row, o->next_row, z->s->img_x, z->s->img_y)) {
+        result = stbi__err("aborted", "Load aborted by callback");
+        break;
+      }
+      ++o->next_row;
+    }
+    if (p.idct_band >= 0)
+      for (k = 0; k < z->scan_n; ++k)
+        o->decoded[z->order[k]] = (band * STBI__PIPELINE_MCU_ROWS + p.idct_tasks) * z->img_comp[z->order[k]].v * z->img_comp[z->order[k]].block_size;
+  }
+  if (p.failed)
+    result = stbi__err("bad huffman code", "Corrupt JPEG");
+  stbi__jpeg_free_pipeline(&p);
+  return result;
+}
+
+#endif // STBI_PARALLEL_FOR
+
+static int stbi__jpeg_load_rows(stbi__context* s, int* x, int* y, int* comp, int req_comp, int scale_shift, stbi_row_callback callback, void* user)
+{
+  int result = 0;
+  stbi__jpeg_row_output o;
+  stbi__jpeg* j = (stbi__jpeg*)stbi__malloc(sizeof(stbi__jpeg));
+  if (!j) return stbi__err("outofmem", "Out of memory");
+  j->s = s;
+  stbi__setup_jpeg(j);
+  j->row_output = &o;
+  j->block_size = 8 >> scale_shift;
+  o.callback = callback;
+  o.user = user;
+  o.req_comp = req_comp;
+  o.next_row = 0;
+  o.row = NULL;
+  s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+  if (stbi__decode_jpeg_image(j)) {
+    if (!j->img_comp[0].data) {
+      stbi__err("no SOS", "Corrupt JPEG");
+    }
+    else if (o.row || stbi__jpeg_setup_row_output(j)) {
+      result = stbi__jpeg_emit_rows(j, 1);
+      *x = s->img_x;
+      *y = s->img_y;
+      if (comp) *comp = s->img_n >= 3 ? 3 : 1;
+    }
+  }
+  stbi__cleanup_jpeg(j);
+  STBI_FREE(o.row);
+  STBI_FREE(j);
+  return result;
 }
 
 static void* stbi__jpeg_load(stbi__context* s, int* x, int* y, int* comp, int req_comp, stbi__result_info* ri)
@@ -4054,20 +5420,45 @@ static int stbi__jpeg_info(stbi__context* s, int* x, int* y, int* comp)
 //      - all input must be provided in an upfront buffer
 //      - all output is written to a single output buffer (can malloc/realloc)
 //    performance
-//      - fast huffman
+//      - fast huffman, with literal pairs and short extra bits resolved in the table
+//      - 64-bit bit buffer refilled a word at a time
+//      - word-at-a-time match copies
 
 #ifndef STBI_NO_ZLIB
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
+#define STBI__ZFAST_BITS  11 // accelerate all cases in default tables, and most short codes with their extra bits
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 #define STBI__ZNSYMS 288 // number of symbols in literal/length alphabet
 
+// alphabets a huffman table can decode
+#define STBI__ZCODELENGTHS 0
+#define STBI__ZLITLEN      1
+#define STBI__ZDISTANCE    2
+
+// fast table entries: value << 16 | extra bits << 12 | kind << 8 | bits used.
+// an entry with no extra bits has its extra bits, if any, already added to
+// the value. 0 means the code is longer than STBI__ZFAST_BITS.
+#define STBI__ZKIND_LITERAL  1 // the literal kinds are also the number of bytes they hold
+#define STBI__ZKIND_LITERAL2 2 // two literals, the first in the low byte
+#define STBI__ZKIND_LENGTH   3
+#define STBI__ZKIND_END      4
+#define STBI__ZKIND_DISTANCE 5
+#define STBI__ZKIND_SYMBOL   6 // code length alphabet symbol
+#define STBI__ZKIND_INVALID  7 // symbols the alphabet reserves
+
+#define stbi__zentry(kind, value, extra, bits) \
+  (((stbi__uint32)(value) << 16) | ((extra) << 12) | ((kind) << 8) | (bits))
+#define stbi__zentry_bits(e)  ((int)((e) & 255))
+#define stbi__zentry_kind(e)  ((int)((e) >> 8) & 15)
+#define stbi__zentry_extra(e) ((int)((e) >> 12) & 15)
+#define stbi__zentry_value(e) ((int)((e) >> 16))
+
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
 typedef struct
 {
-  stbi__uint16 fast[1 << STBI__ZFAST_BITS];
+  stbi__uint32 fast[1 << STBI__ZFAST_BITS];
   stbi__uint16 firstcode[16];
   int maxcode[17];
   stbi__uint16 firstsymbol[16];
@@ -4092,7 +5483,37 @@ stbi_inline static int stbi__bit_reverse(int v, int bits)
   return stbi__bitreverse16(v) >> (16 - bits);
 }
 
-static int stbi__zbuild_huffman(stbi__zhuffman* z, const stbi_uc* sizelist, int num)
+static const int stbi__zlength_base[31] = {
+   3,4,5,6,7,8,9,10,11,13,
+   15,17,19,23,27,31,35,43,51,59,
+   67,83,99,115,131,163,195,227,258,0,0 };
+
+static const int stbi__zlength_extra[31] =
+{ 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0,0,0 };
+
+static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
+257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577,0,0 };
+
+static const int stbi__zdist_extra[32] =
+{ 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+// the fast table entry for symbol sym of the given alphabet, with a code of the given length
+static stbi__uint32 stbi__zsymbol_entry(int alphabet, int sym, int bits)
+{
+  if (alphabet == STBI__ZLITLEN) {
+    if (sym < 256) return stbi__zentry(STBI__ZKIND_LITERAL, sym, 0, bits);
+    if (sym == 256) return stbi__zentry(STBI__ZKIND_END, 0, 0, bits);
+    if (sym < 286) return stbi__zentry(STBI__ZKIND_LENGTH, stbi__zlength_base[sym - 257], stbi__zlength_extra[sym - 257], bits);
+  }
+  else if (alphabet == STBI__ZDISTANCE) {
+    if (sym < 30) return stbi__zentry(STBI__ZKIND_DISTANCE, stbi__zdist_base[sym], stbi__zdist_extra[sym], bits);
+  }
+  else
+    return stbi__zentry(STBI__ZKIND_SYMBOL, sym, 0, bits);
+  return stbi__zentry(STBI__ZKIND_INVALID, 0, 0, bits);
+}
+
+static int stbi__zbuild_huffman(stbi__zhuffman* z, const stbi_uc* sizelist, int num, int alphabet)
 {
   int i, k = 0;
   int code, next_code[16], sizes[17];
@@ -4123,19 +5544,37 @@ static int stbi__zbuild_huffman(stbi__zhuffman* z, const stbi_uc* sizelist, int
     int s = sizelist[i];
     if (s) {
       int c = next_code[s] - z->firstcode[s] + z->firstsymbol[s];
-      stbi__uint16 fastv = (stbi__uint16)((s << 9) | i);
       z->size[c] = (stbi_uc)s;
       z->value[c] = (stbi__uint16)i;
       if (s <= STBI__ZFAST_BITS) {
+        stbi__uint32 e = stbi__zsymbol_entry(alphabet, i, s);
+        int extra = stbi__zentry_extra(e);
         int j = stbi__bit_reverse(next_code[s], s);
-        while (j < (1 << STBI__ZFAST_BITS)) {
-          z->fast[j] = fastv;
-          j += (1 << s);
+        if (extra && s + extra <= STBI__ZFAST_BITS) {
+          // the extra bits follow the code in the index, so resolve them here
+          for (; j < (1 << STBI__ZFAST_BITS); j += (1 << s))
+            z->fast[j] = stbi__zentry(stbi__zentry_kind(e), stbi__zentry_value(e) + ((j >> s) & ((1 << extra) - 1)), 0, s + extra);
+        }
+        else {
+          for (; j < (1 << STBI__ZFAST_BITS); j += (1 << s))
+            z->fast[j] = e;
         }
       }
       ++next_code[s];
     }
   }
+  if (alphabet == STBI__ZLITLEN) {
+    // where a literal's code leaves room in the index for a whole second literal,
+    // decode both at once. going down, j >> s is always still a single entry.
+    for (i = (1 << STBI__ZFAST_BITS) - 1; i >= 0; --i) {
+      stbi__uint32 e = z->fast[i], e2;
+      int s = stbi__zentry_bits(e);
+      if (stbi__zentry_kind(e) != STBI__ZKIND_LITERAL || s >= STBI__ZFAST_BITS) continue;
+      e2 = z->fast[i >> s];
+      if (stbi__zentry_kind(e2) == STBI__ZKIND_LITERAL && stbi__zentry_bits(e2) <= STBI__ZFAST_BITS - s)
+        z->fast[i] = stbi__zentry(STBI__ZKIND_LITERAL2, stbi__zentry_value(e) | (stbi__zentry_value(e2) << 8), 0, s + stbi__zentry_bits(e2));
+    }
+  }
   return 1;
 }
 
@@ -4143,25 +5582,34 @@ static int stbi__zbuild_huffman(stbi__zhuffman* z, const stbi_uc* sizelist, int
 //    because PNG allows splitting the zlib stream arbitrarily,
 //    and it's annoying structurally to have PNG call ZLIB call PNG,
 //    we require PNG read all the IDATs and combine them into a single
-//    memory buffer
+//    memory buffer. the row-at-a-time PNG loader is the exception: it
+//    feeds the input through refill and takes the output through flush.
 
 typedef struct
 {
   stbi_uc* zbuffer, * zbuffer_end;
   int num_bits;
-  stbi__uint32 code_buffer;
+  int num_padding; // zero bytes added to code_buffer past the end of the input
+  stbi__uint64 code_buffer; // bits above num_bits may hold input already, but never anything else
 
   char* zout;
   char* zout_start;
   char* zout_end;
   int   z_expandable;
 
+  // if set, called for more input once zbuffer runs out; returns 0 at the end of the input
+  int (*refill)(void* user, stbi_uc** start, stbi_uc** end);
+  // if set, output goes to flush in pieces and zout_start keeps only the window back-references reach
+  int (*flush)(void* user, stbi_uc const* data, int len);
+  void* stream_user;
+  char* zout_flushed;
+
   stbi__zhuffman z_length, z_distance;
 } stbi__zbuf;
 
 stbi_inline static int stbi__zeof(stbi__zbuf* z)
 {
-  return (z->zbuffer >= z->zbuffer_end);
+  return z->zbuffer >= z->zbuffer_end && !(z->refill && z->refill(z->stream_user, &z->zbuffer, &z->zbuffer_end));
 }
 
 stbi_inline static stbi_uc stbi__zget8(stbi__zbuf* z)
@@ -4169,26 +5617,62 @@ stbi_inline static stbi_uc stbi__zget8(stbi__zbuf* z)
   return stbi__zeof(z) ? 0 : *z->zbuffer++;
 }
 
-static void stbi__fill_bits(stbi__zbuf* z)
+// the last bytes of the input, one at a time, then zeros. fails once bits
+// of those zeros have been consumed, as no valid stream needs them.
+static int stbi__fill_bits_tail(stbi__zbuf* z)
 {
-  do {
-    if (z->code_buffer >= (1U << z->num_bits)) {
-      z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
-      return;
-    }
-    z->code_buffer |= (unsigned int)stbi__zget8(z) << z->num_bits;
+  int overrun = z->num_bits < z->num_padding * 8;
+  while (z->num_bits < 56) {
+    if (stbi__zeof(z))
+      ++z->num_padding;
+    else
+      z->code_buffer |= (stbi__uint64)*z->zbuffer++ << z->num_bits;
     z->num_bits += 8;
   }
-  while (z->num_bits <= 24);
+  if (overrun) return stbi__err("unexpected end", "Corrupt PNG");
+  return 1;
+}
+
+stbi_inline static stbi__uint64 stbi__zload64(stbi_uc const* p)
+{
+  stbi__uint64 w;
+#if defined(STBI__X86_TARGET) || defined(STBI__X64_TARGET)
+  memcpy(&w, p, 8);
+#else
+  int i;
+  w = 0;
+  for (i = 7; i >= 0; --i)
+    w = (w << 8) | p[i];
+#endif
+  return w;
+}
+
+// brings code_buffer up to at least 56 bits, enough for a whole length/distance pair
+stbi_inline static int stbi__fill_bits(stbi__zbuf* z)
+{
+  if (z->zbuffer_end - z->zbuffer >= 8) {
+    // load 8 bytes, and keep the whole ones that fit
+    z->code_buffer |= stbi__zload64(z->zbuffer) << z->num_bits;
+    z->zbuffer += (63 - z->num_bits) >> 3;
+    z->num_bits |= 56;
+    return 1;
+  }
+  return stbi__fill_bits_tail(z);
+}
+
+stbi_inline static void stbi__zconsume(stbi__zbuf* z, int n)
+{
+  z->code_buffer >>= n;
+  z->num_bits -= n;
 }
 
 stbi_inline static unsigned int stbi__zreceive(stbi__zbuf* z, int n)
 {
   unsigned int k;
+  // a failed fill reads zeros; the caller's next checked fill reports it
   if (z->num_bits < n) stbi__fill_bits(z);
-  k = z->code_buffer & ((1 << n) - 1);
-  z->code_buffer >>= n;
-  z->num_bits -= n;
+  k = (unsigned int)z->code_buffer & ((1 << n) - 1);
+  stbi__zconsume(z, n);
   return k;
 }
 
@@ -4197,7 +5681,7 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf* a, stbi__zhuffman* z)
   int b, s, k;
   // not resolved by fast table, so compute it the slow way
   // use jpeg approach, which requires MSbits at top
-  k = stbi__bit_reverse(a->code_buffer, 16);
+  k = stbi__bit_reverse((int)(a->code_buffer & 0xffff), 16);
   for (s = STBI__ZFAST_BITS + 1; ; ++s)
     if (k < z->maxcode[s])
       break;
@@ -4206,35 +5690,60 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf* a, stbi__zhuffman* z)
   b = (k >> (16 - s)) - z->firstcode[s] + z->firstsymbol[s];
   if (b >= STBI__ZNSYMS) return -1; // some data was corrupt somewhere!
   if (z->size[b] != s) return -1;  // was originally an assert, but report failure instead.
-  a->code_buffer >>= s;
-  a->num_bits -= s;
+  stbi__zconsume(a, s);
   return z->value[b];
 }
 
+// decodes one code length alphabet symbol
 stbi_inline static int stbi__zhuffman_decode(stbi__zbuf* a, stbi__zhuffman* z)
 {
-  int b, s;
+  stbi__uint32 e;
   if (a->num_bits < 16) {
-    if (stbi__zeof(a)) {
-      return -1;   /* report error for unexpected end of data. */
-    }
-    stbi__fill_bits(a);
+    if (!stbi__fill_bits(a)) return -1;
   }
-  b = z->fast[a->code_buffer & STBI__ZFAST_MASK];
-  if (b) {
-    s = b >> 9;
-    a->code_buffer >>= s;
-    a->num_bits -= s;
-    return b & 511;
+  e = z->fast[a->code_buffer & STBI__ZFAST_MASK];
+  if (e) {
+    stbi__zconsume(a, stbi__zentry_bits(e));
+    return stbi__zentry_value(e);
   }
   return stbi__zhuffman_decode_slowpath(a, z);
 }
 
+// a fast table entry for the next symbol, with its code consumed
+stbi_inline static stbi__uint32 stbi__zdecode_entry(stbi__zbuf* a, stbi__zhuffman* z, int alphabet)
+{
+  stbi__uint32 e = z->fast[a->code_buffer & STBI__ZFAST_MASK];
+  if (e) {
+    stbi__zconsume(a, stbi__zentry_bits(e));
+    return e;
+  }
+  else {
+    int sym = stbi__zhuffman_decode_slowpath(a, z);
+    if (sym < 0) return stbi__zentry(STBI__ZKIND_INVALID, 0, 0, 0);
+    return stbi__zsymbol_entry(alphabet, sym, 0);
+  }
+}
+
+#define STBI__ZWINDOW        32768
+// a streamed output buffer: the window plus room for any stored block
+#define STBI__ZSTREAM_OUT    (STBI__ZWINDOW + 131072)
+
 static int stbi__zexpand(stbi__zbuf* z, char* zout, int n)  // need to make room for n bytes
 {
   char* q;
   unsigned int cur, limit, old_limit;
   z->zout = zout;
+  if (z->flush) {
+    // hand over everything not flushed yet, then slide the window down to make room
+    int keep = (int)(zout - z->zout_start);
+    if (zout > z->zout_flushed && !z->flush(z->stream_user, (stbi_uc*)z->zout_flushed, (int)(zout - z->zout_flushed)))
+      return 0;
+    if (keep > STBI__ZWINDOW) keep = STBI__ZWINDOW;
+    memmove(z->zout_start, zout - keep, keep);
+    z->zout = z->zout_flushed = z->zout_start + keep;
+    if (z->zout_end - z->zout < n) return stbi__err("output buffer limit", "Corrupt PNG");
+    return 1;
+  }
   if (!z->z_expandable) return stbi__err("output buffer limit", "Corrupt PNG");
   cur = (unsigned int)(z->zout - z->zout_start);
   limit = old_limit = (unsigned)(z->zout_end - z->zout_start);
@@ -4252,60 +5761,240 @@ static int stbi__zexpand(stbi__zbuf* z, char* zout, int n)  // need to make room
   return 1;
 }
 
-static const int stbi__zlength_base[31] = {
-   3,4,5,6,7,8,9,10,11,13,
-   15,17,19,23,27,31,35,43,51,59,
-   67,83,99,115,131,163,195,227,258,0,0 };
+// output room the fast loop needs for any symbol, including the overrun of its copies
+#define STBI__ZFAST_OUT_MARGIN (258 + 16)
+
+// decodes symbols while there is a whole fill of input left and room for any symbol's output,
+// with the bit buffer in locals and no bounds checks. returns 1 at the end of the block, 0 on
+// an error, or -1 when the careful loop has to take over near the ends of the buffers.
+static int stbi__parse_huffman_fast(stbi__zbuf* a, char** pzout)
+{
+  stbi__uint64 code_buffer = a->code_buffer;
+  int num_bits = a->num_bits;
+  stbi_uc* zbuffer = a->zbuffer;
+  stbi_uc* zbuffer_limit = a->zbuffer_end - 8;
+  char* zout = *pzout;
+  char* zout_limit = a->zout_end - STBI__ZFAST_OUT_MARGIN;
+  const stbi__uint32* lfast = a->z_length.fast;
+  const stbi__uint32* dfast = a->z_distance.fast;
+  int result = -1;
+
+  while (zbuffer <= zbuffer_limit && zout <= zout_limit) {
+    stbi__uint32 e;
+    char* p;
+    int len, dist, extra;
+
+    code_buffer |= stbi__zload64(zbuffer) << num_bits;
+    zbuffer += (63 - num_bits) >> 3;
+    num_bits |= 56;
+
+    e = lfast[code_buffer & STBI__ZFAST_MASK];
+    if (e && stbi__zentry_kind(e) <= STBI__ZKIND_LITERAL2) {
+      // a fill leaves room for three fast-table codes, so take up to three runs of literals
+      zout[0] = (char)stbi__zentry_value(e);
+      zout[1] = (char)(stbi__zentry_value(e) >> 8);
+      zout += stbi__zentry_kind(e);
+      code_buffer >>= stbi__zentry_bits(e);
+      num_bits -= stbi__zentry_bits(e);
+      e = lfast[code_buffer & STBI__ZFAST_MASK];
+      if (e && stbi__zentry_kind(e) <= STBI__ZKIND_LITERAL2) {
+        zout[0] = (char)stbi__zentry_value(e);
+        zout[1] = (char)(stbi__zentry_value(e) >> 8);
+        zout += stbi__zentry_kind(e);
+        code_buffer >>= stbi__zentry_bits(e);
+        num_bits -= stbi__zentry_bits(e);
+        e = lfast[code_buffer & STBI__ZFAST_MASK];
+        if (e && stbi__zentry_kind(e) <= STBI__ZKIND_LITERAL2) {
+          zout[0] = (char)stbi__zentry_value(e);
+          zout[1] = (char)(stbi__zentry_value(e) >> 8);
+          zout += stbi__zentry_kind(e);
+          code_buffer >>= stbi__zentry_bits(e);
+          num_bits -= stbi__zentry_bits(e);
+        }
+      }
+      continue;
+    }
+    if (e) {
+      code_buffer >>= stbi__zentry_bits(e);
+      num_bits -= stbi__zentry_bits(e);
+    }
+    else {
+      int sym;
+      a->code_buffer = code_buffer;
+      a->num_bits = num_bits;
+      sym = stbi__zhuffman_decode_slowpath(a, &a->z_length);
+      code_buffer = a->code_buffer;
+      num_bits = a->num_bits;
+      e = sym < 0 ? 0 : stbi__zsymbol_entry(STBI__ZLITLEN, sym, 0);
+      if (stbi__zentry_kind(e) == STBI__ZKIND_LITERAL) {
+        *zout++ = (char)stbi__zentry_value(e);
+        continue;
+      }
+    }
+    if (stbi__zentry_kind(e) != STBI__ZKIND_LENGTH) {
+      if (stbi__zentry_kind(e) == STBI__ZKIND_END)
+        result = 1;
+      else
+        result = stbi__err("bad huffman code", "Corrupt PNG");
+      break;
+    }
+    extra = stbi__zentry_extra(e);
+    len = stbi__zentry_value(e) + (int)((unsigned int)code_buffer & ((1u << extra) - 1));
+    code_buffer >>= extra;
+    num_bits -= extra;
 
-static const int stbi__zlength_extra[31] =
-{ 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0,0,0 };
+    e = dfast[code_buffer & STBI__ZFAST_MASK];
+    if (e) {
+      code_buffer >>= stbi__zentry_bits(e);
+      num_bits -= stbi__zentry_bits(e);
+    }
+    else {
+      int sym;
+      a->code_buffer = code_buffer;
+      a->num_bits = num_bits;
+      sym = stbi__zhuffman_decode_slowpath(a, &a->z_distance);
+      code_buffer = a->code_buffer;
+      num_bits = a->num_bits;
+      e = sym < 0 ? 0 : stbi__zsymbol_entry(STBI__ZDISTANCE, sym, 0);
+    }
+    if (stbi__zentry_kind(e) != STBI__ZKIND_DISTANCE) {
+      result = stbi__err("bad huffman code", "Corrupt PNG");
+      break;
+    }
+    extra = stbi__zentry_extra(e);
+    dist = stbi__zentry_value(e) + (int)((unsigned int)code_buffer & ((1u << extra) - 1));
+    code_buffer >>= extra;
+    num_bits -= extra;
+    if (zout - a->zout_start < dist) {
+      result = stbi__err("bad dist", "Corrupt PNG");
+      break;
+    }
 
-static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
-257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577,0,0 };
+    // copy in whole words where the source is far enough behind, overrunning into the margin
+    p = zout - dist;
+    if (dist >= 16) {
+      char* end = zout + len;
+      do {
+        memcpy(zout, p, 16);
+        zout += 16;
+        p += 16;
+      } while (zout < end);
+      zout = end;
+    }
+    else if (dist >= 8) {
+      char* end = zout + len;
+      do {
+        memcpy(zout, p, 8);
+        zout += 8;
+        p += 8;
+      } while (zout < end);
+      zout = end;
+    }
+    else if (dist == 1) {
+      memset(zout, *p, len);
+      zout += len;
+    }
+    else {
+      // a short repeating pattern: lay down one word bytewise, then copy words from a
+      // whole number of periods back, far enough that they don't overlap
+      static const stbi_uc stride[8] = { 0, 0, 8, 9, 8, 10, 12, 14 };
+      char* end = zout + len;
+      int i;
+      for (i = 0; i < 8; ++i)
+        zout[i] = p[i];
+      for (zout += 8; zout < end; zout += 8)
+        memcpy(zout, zout - stride[dist], 8);
+      zout = end;
+    }
+  }
 
-static const int stbi__zdist_extra[32] =
-{ 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+  a->code_buffer = code_buffer;
+  a->num_bits = num_bits;
+  a->zbuffer = zbuffer;
+  *pzout = zout;
+  return result;
+}
 
 static int stbi__parse_huffman_block(stbi__zbuf* a)
 {
   char* zout = a->zout;
   for (;;) {
-    int z = stbi__zhuffman_decode(a, &a->z_length);
-    if (z < 256) {
-      if (z < 0) return stbi__err("bad huffman code", "Corrupt PNG"); // error in huffman codes
-      if (zout >= a->zout_end) {
-        if (!stbi__zexpand(a, zout, 1)) return 0;
-        zout = a->zout;
-      }
-      *zout++ = (char)z;
+    stbi__uint32 e;
+    stbi_uc* p;
+    int len, dist;
+
+    if (a->flush && a->zout_end - zout < STBI__ZFAST_OUT_MARGIN) {
+      if (!stbi__zexpand(a, zout, STBI__ZFAST_OUT_MARGIN)) return 0;
+      zout = a->zout;
     }
-    else {
-      stbi_uc* p;
-      int len, dist;
-      if (z == 256) {
+    if (a->zbuffer_end - a->zbuffer >= 8 && a->zout_end - zout >= STBI__ZFAST_OUT_MARGIN) {
+      int result = stbi__parse_huffman_fast(a, &zout);
+      if (result >= 0) {
         a->zout = zout;
-        return 1;
+        return result;
       }
-      z -= 257;
-      len = stbi__zlength_base[z];
-      if (stbi__zlength_extra[z]) len += stbi__zreceive(a, stbi__zlength_extra[z]);
-      z = stbi__zhuffman_decode(a, &a->z_distance);
-      if (z < 0) return stbi__err("bad huffman code", "Corrupt PNG");
-      dist = stbi__zdist_base[z];
-      if (stbi__zdist_extra[z]) dist += stbi__zreceive(a, stbi__zdist_extra[z]);
-      if (zout - a->zout_start < dist) return stbi__err("bad dist", "Corrupt PNG");
-      if (zout + len > a->zout_end) {
-        if (!stbi__zexpand(a, zout, len)) return 0;
+    }
+
+    // one symbol at a time near the ends of the buffers, or for a long code.
+    // one fill covers the longest length/distance pair.
+    if (!stbi__fill_bits(a)) return 0;
+    e = stbi__zdecode_entry(a, &a->z_length, STBI__ZLITLEN);
+    switch (stbi__zentry_kind(e)) {
+    case STBI__ZKIND_LITERAL:
+      if (zout >= a->zout_end) {
+        if (!stbi__zexpand(a, zout, 1)) return 0;
         zout = a->zout;
       }
-      p = (stbi_uc*)(zout - dist);
-      if (dist == 1) { // run of one byte; common in images.
-        stbi_uc v = *p;
-        if (len) { do *zout++ = v; while (--len); }
-      }
-      else {
-        if (len) { do *zout++ = *p++; while (--len); }
+      *zout++ = (char)stbi__zentry_value(e);
+      continue;
+    case STBI__ZKIND_LITERAL2:
+      if (a->zout_end - zout < 2) {
+        if (!stbi__zexpand(a, zout, 2)) return 0;
+        zout = a->zout;
       }
+      zout[0] = (char)stbi__zentry_value(e);
+      zout[1] = (char)(stbi__zentry_value(e) >> 8);
+      zout += 2;
+      continue;
+    case STBI__ZKIND_END:
+      a->zout = zout;
+      if (a->num_bits < a->num_padding * 8) return stbi__err("unexpected end", "Corrupt PNG");
+      return 1;
+    case STBI__ZKIND_LENGTH:
+      break;
+    default:
+      return stbi__err("bad huffman code", "Corrupt PNG"); // error in huffman codes
+    }
+
+    len = stbi__zentry_value(e);
+    if (stbi__zentry_extra(e)) len += stbi__zreceive(a, stbi__zentry_extra(e));
+    e = stbi__zdecode_entry(a, &a->z_distance, STBI__ZDISTANCE);
+    if (stbi__zentry_kind(e) != STBI__ZKIND_DISTANCE) return stbi__err("bad huffman code", "Corrupt PNG");
+    dist = stbi__zentry_value(e);
+    if (stbi__zentry_extra(e)) dist += stbi__zreceive(a, stbi__zentry_extra(e));
+    if (zout - a->zout_start < dist) return stbi__err("bad dist", "Corrupt PNG");
+    if (zout + len > a->zout_end) {
+      if (!stbi__zexpand(a, zout, len)) return 0;
+      zout = a->zout;
+    }
+    p = (stbi_uc*)(zout - dist);
+    if (dist == 1) { // run of one byte; common in images.
+      memset(zout, *p, len);
+      zout += len;
+    }
+    else if (dist >= 8 && a->zout_end - zout >= len + 8) {
+      // whole 8-byte words, overrunning the match into the free space after it.
+      // the source is always at least a word behind, so words never overlap.
+      char* end = zout + len;
+      do {
+        memcpy(zout, p, 8);
+        zout += 8;
+        p += 8;
+      } while (zout < end);
+      zout = end;
+    }
+    else {
+      do *zout++ = *p++; while (--len);
     }
   }
 }
@@ -4328,7 +6017,7 @@ static int stbi__compute_huffman_codes(stbi__zbuf* a)
     int s = stbi__zreceive(a, 3);
     codelength_sizes[length_dezigzag[i]] = (stbi_uc)s;
   }
-  if (!stbi__zbuild_huffman(&z_codelength, codelength_sizes, 19)) return 0;
+  if (!stbi__zbuild_huffman(&z_codelength, codelength_sizes, 19, STBI__ZCODELENGTHS)) return 0;
 
   n = 0;
   while (n < ntot) {
@@ -4358,37 +6047,56 @@ static int stbi__compute_huffman_codes(stbi__zbuf* a)
     }
   }
   if (n != ntot) return stbi__err("bad codelengths", "Corrupt PNG");
-  if (!stbi__zbuild_huffman(&a->z_length, lencodes, hlit)) return 0;
-  if (!stbi__zbuild_huffman(&a->z_distance, lencodes + hlit, hdist)) return 0;
+  if (!stbi__zbuild_huffman(&a->z_length, lencodes, hlit, STBI__ZLITLEN)) return 0;
+  if (!stbi__zbuild_huffman(&a->z_distance, lencodes + hlit, hdist, STBI__ZDISTANCE)) return 0;
   return 1;
 }
 
+// drops whatever the bit buffer holds once it has been drained to a byte boundary
+static void stbi__zclear_bits(stbi__zbuf* a)
+{
+  a->code_buffer = 0;
+  a->num_bits = 0;
+  a->num_padding = 0;
+}
+
 static int stbi__parse_uncompressed_block(stbi__zbuf* a)
 {
   stbi_uc header[4];
   int len, nlen, k;
   if (a->num_bits & 7)
     stbi__zreceive(a, a->num_bits & 7); // discard
- // drain the bit-packed data into header
-  k = 0;
-  while (a->num_bits > 0) {
-    header[k++] = (stbi_uc)(a->code_buffer & 255); // suppress MSVC run-time check
-    a->code_buffer >>= 8;
-    a->num_bits -= 8;
-  }
-  if (a->num_bits < 0) return stbi__err("zlib corrupt", "Corrupt PNG");
-  // now fill header the normal way
-  while (k < 4)
-    header[k++] = stbi__zget8(a);
+  if (a->num_bits < a->num_padding * 8) return stbi__err("zlib corrupt", "Corrupt PNG");
+  // the whole bytes still in the bit buffer come first, then the input. they are
+  // taken from the bit buffer rather than handed back, as the input they came
+  // from may already have been replaced by a refill
+  for (k = 0; k < 4; ++k) {
+    if (a->num_bits > a->num_padding * 8) {
+      header[k] = (stbi_uc)stbi__zreceive(a, 8);
+    }
+    else {
+      stbi__zclear_bits(a);
+      header[k] = stbi__zget8(a);
+    }
+  }
   len = header[1] * 256 + header[0];
   nlen = header[3] * 256 + header[2];
   if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt", "Corrupt PNG");
-  if (a->zbuffer + len > a->zbuffer_end) return stbi__err("read past buffer", "Corrupt PNG");
   if (a->zout + len > a->zout_end)
     if (!stbi__zexpand(a, a->zout, len)) return 0;
-  memcpy(a->zout, a->zbuffer, len);
-  a->zbuffer += len;
-  a->zout += len;
+  for (; len > 0 && a->num_bits > a->num_padding * 8; --len)
+    *a->zout++ = (char)stbi__zreceive(a, 8);
+  if (len > 0)
+    stbi__zclear_bits(a);
+  while (len > 0) {
+    if (stbi__zeof(a)) return stbi__err("read past buffer", "Corrupt PNG");
+    k = (int)(a->zbuffer_end - a->zbuffer);
+    if (k > len) k = len;
+    memcpy(a->zout, a->zbuffer, k);
+    a->zbuffer += k;
+    a->zout += k;
+    len -= k;
+  }
   return 1;
 }
 
@@ -4441,6 +6149,7 @@ static int stbi__parse_zlib(stbi__zbuf* a, int parse_header)
   if (parse_header)
     if (!stbi__parse_zlib_header(a)) return 0;
   a->num_bits = 0;
+  a->num_padding = 0;
   a->code_buffer = 0;
   do {
     final = stbi__zreceive(a, 1);
@@ -4454,8 +6163,8 @@ static int stbi__parse_zlib(stbi__zbuf* a, int parse_header)
     else {
       if (type == 1) {
         // use fixed code lengths
-        if (!stbi__zbuild_huffman(&a->z_length, stbi__zdefault_length, STBI__ZNSYMS)) return 0;
-        if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance, 32)) return 0;
+        if (!stbi__zbuild_huffman(&a->z_length, stbi__zdefault_length, STBI__ZNSYMS, STBI__ZLITLEN)) return 0;
+        if (!stbi__zbuild_huffman(&a->z_distance, stbi__zdefault_distance, 32, STBI__ZDISTANCE)) return 0;
       }
       else {
         if (!stbi__compute_huffman_codes(a)) return 0;
@@ -4473,10 +6182,29 @@ static int stbi__do_zlib(stbi__zbuf* a, char* obuf, int olen, int exp, int parse
   a->zout = obuf;
   a->zout_end = obuf + olen;
   a->z_expandable = exp;
+  a->refill = NULL;
+  a->flush = NULL;
 
   return stbi__parse_zlib(a, parse_header);
 }
 
+// inflates a stream whose input comes from a->refill and whose output goes to a->flush,
+// holding only the input buffer refill hands out and a window of output
+static int stbi__do_zlib_stream(stbi__zbuf* a, int parse_header)
+{
+  int result;
+  char* window = (char*)stbi__malloc(STBI__ZSTREAM_OUT);
+  if (!window) return stbi__err("outofmem", "Out of memory");
+  a->zout_start = a->zout = a->zout_flushed = window;
+  a->zout_end = window + STBI__ZSTREAM_OUT;
+  a->z_expandable = 0;
+  result = stbi__parse_zlib(a, parse_header);
+  if (result && a->zout > a->zout_flushed)
+    result = a->flush(a->stream_user, (stbi_uc*)a->zout_flushed, (int)(a->zout - a->zout_flushed));
+  STBI_FREE(window);
+  return result;
+}
+
 STBIDEF char* stbi_zlib_decode_malloc_guesssize(const char* buffer, int len, int initial_size, int* outlen)
 {
   stbi__zbuf a;
@@ -4595,6 +6323,8 @@ typedef struct
   stbi__context* s;
   stbi_uc* idata, * expanded, * out;
   int depth;
+  stbi_row_callback row_callback; // if set, non-interlaced images are streamed to it and out stays NULL
+  void* row_user;
 } stbi__png;
 
 
@@ -4631,6 +6361,188 @@ static int stbi__paeth(int a, int b, int c)
 
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
+// unfilter one scanline. raw starts at the row's filter byte; cur receives the row (for
+// depth < 8, just its packed bytes) and prior is the previous row at the same offset,
+// which is never read for the first row.
+static int stbi__png_unfilter_row(stbi_uc* cur, stbi_uc* prior, stbi_uc const* raw, int first_row, stbi__uint32 x, int img_n, int out_n, int depth, stbi__uint32 img_width_bytes)
+{
+  int bytes = (depth == 16 ? 2 : 1);
+  int output_bytes = out_n * bytes;
+  int filter_bytes = img_n * bytes;
+  int width = x;
+  stbi_uc* row = cur;
+  stbi__uint32 i;
+  int k;
+  int filter = *raw++;
+
+  if (filter > 4)
+    return stbi__err("invalid filter", "Corrupt PNG");
+
+  if (depth < 8) {
+    filter_bytes = 1;
+    width = img_width_bytes;
+  }
+
+  // if first row, use special filter that doesn't sample previous row
+  if (first_row) filter = first_row_filter[filter];
+
+  // handle first byte explicitly
+  for (k = 0; k < filter_bytes; ++k) {
+    switch (filter) {
+    case STBI__F_none: cur[k] = raw[k]; break;
+    case STBI__F_sub: cur[k] = raw[k]; break;
+    case STBI__F_up: cur[k] = STBI__BYTECAST(raw[k] + prior[k]); break;
+    case STBI__F_avg: cur[k] = STBI__BYTECAST(raw[k] + (prior[k] >> 1)); break;
+    case STBI__F_paeth: cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(0, prior[k], 0)); break;
+    case STBI__F_avg_first: cur[k] = raw[k]; break;
+    case STBI__F_paeth_first: cur[k] = raw[k]; break;
+    }
+  }
+
+  if (depth == 8) {
+    if (img_n != out_n)
+      cur[img_n] = 255; // first pixel
+    raw += img_n;
+    cur += out_n;
+    prior += out_n;
+  }
+  else if (depth == 16) {
+    if (img_n != out_n) {
+      cur[filter_bytes] = 255; // first pixel top byte
+      cur[filter_bytes + 1] = 255; // first pixel bottom byte
+    }
+    raw += filter_bytes;
+    cur += output_bytes;
+    prior += output_bytes;
+  }
+  else {
+    raw += 1;
+    cur += 1;
+    prior += 1;
+  }
+
+  // this is a little gross, so that we don't switch per-pixel or per-component
+  if (depth < 8 || img_n == out_n) {
+    int nk = (width - 1) * filter_bytes;
+#define STBI__CASE(f) \
+           case f:     \
+              for (k=0; k < nk; ++k)
+    switch (filter) {
+      // "none" filter turns into a memcpy here; make that explicit.
+    case STBI__F_none:         memcpy(cur, raw, nk); break;
+      STBI__CASE(STBI__F_sub) { cur[k] = STBI__BYTECAST(raw[k] + cur[k - filter_bytes]); } break;
+      STBI__CASE(STBI__F_up) { cur[k] = STBI__BYTECAST(raw[k] + prior[k]); } break;
+      STBI__CASE(STBI__F_avg) { cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k - filter_bytes]) >> 1)); } break;
+      STBI__CASE(STBI__F_paeth) { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k - filter_bytes], prior[k], prior[k - filter_bytes])); } break;
+      STBI__CASE(STBI__F_avg_first) { cur[k] = STBI__BYTECAST(raw[k] + (cur[k - filter_bytes] >> 1)); } break;
+      STBI__CASE(STBI__F_paeth_first) { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k - filter_bytes], 0, 0)); } break;
+    }
+#undef STBI__CASE
+  }
+  else {
+    STBI_ASSERT(img_n + 1 == out_n);
+#define STBI__CASE(f) \
+           case f:     \
+              for (i=x-1; i >= 1; --i, cur[filter_bytes]=255,raw+=filter_bytes,cur+=output_bytes,prior+=output_bytes) \
+                 for (k=0; k < filter_bytes; ++k)
+    switch (filter) {
+      STBI__CASE(STBI__F_none) { cur[k] = raw[k]; } break;
+      STBI__CASE(STBI__F_sub) { cur[k] = STBI__BYTECAST(raw[k] + cur[k - output_bytes]); } break;
+      STBI__CASE(STBI__F_up) { cur[k] = STBI__BYTECAST(raw[k] + prior[k]); } break;
+      STBI__CASE(STBI__F_avg) { cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k - output_bytes]) >> 1)); } break;
+      STBI__CASE(STBI__F_paeth) { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k - output_bytes], prior[k], prior[k - output_bytes])); } break;
+      STBI__CASE(STBI__F_avg_first) { cur[k] = STBI__BYTECAST(raw[k] + (cur[k - output_bytes] >> 1)); } break;
+      STBI__CASE(STBI__F_paeth_first) { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k - output_bytes], 0, 0)); } break;
+    }
+#undef STBI__CASE
+
+    // the loop above sets the high byte of the pixels' alpha, but for
+    // 16 bit png files we also need the low byte set. we'll do that here.
+    if (depth == 16) {
+      cur = row; // start at the beginning of the row again
+      for (i = 0; i < x; ++i, cur += output_bytes) {
+        cur[filter_bytes + 1] = 255;
+      }
+    }
+  }
+  return 1;
+}
+
+// unpack a row of 1/2/4-bit samples at 'in' into 8-bit samples at 'cur', inserting alpha = 255
+// when out_n has one more channel than the file. 'in' may be the tail of cur's own row.
+static void stbi__expand_png_row(stbi_uc* cur, stbi_uc const* in, stbi__uint32 x, int img_n, int out_n, int depth, int color)
+{
+  stbi_uc* row = cur;
+  int k;
+  // unpack 1/2/4-bit into a 8-bit buffer. allows us to keep the common 8-bit path optimal at minimal cost for 1/2/4-bit
+  // png guarante byte alignment, if width is not multiple of 8/4/2 we'll decode dummy trailing data that will be skipped in the later loop
+  stbi_uc scale = (color == 0) ? stbi__depth_scale_table[depth] : 1; // scale grayscale values to 0..255 range
+
+  // note that the final byte might overshoot and write more data than desired.
+  // we can allocate enough data that this never writes out of memory, but it
+  // could also overwrite the next scanline. can it overwrite non-empty data
+  // on the next scanline? yes, consider 1-pixel-wide scanlines with 1-bit-per-pixel.
+  // so we need to explicitly clamp the final ones
+
+  if (depth == 4) {
+    for (k = x * img_n; k >= 2; k -= 2, ++in) {
+      *cur++ = scale * ((*in >> 4));
+      *cur++ = scale * ((*in) & 0x0f);
+    }
+    if (k > 0) *cur++ = scale * ((*in >> 4));
+  }
+  else if (depth == 2) {
+    for (k = x * img_n; k >= 4; k -= 4, ++in) {
+      *cur++ = scale * ((*in >> 6));
+      *cur++ = scale * ((*in >> 4) & 0x03);
+      *cur++ = scale * ((*in >> 2) & 0x03);
+      *cur++ = scale * ((*in) & 0x03);
+    }
+    if (k > 0) *cur++ = scale * ((*in >> 6));
+    if (k > 1) *cur++ = scale * ((*in >> 4) & 0x03);
+    if (k > 2) *cur++ = scale * ((*in >> 2) & 0x03);
+  }
+  else if (depth == 1) {
+    for (k = x * img_n; k >= 8; k -= 8, ++in) {
+      *cur++ = scale * ((*in >> 7));
+      *cur++ = scale * ((*in >> 6) & 0x01);
+      *cur++ = scale * ((*in >> 5) & 0x01);
+      *cur++ = scale * ((*in >> 4) & 0x01);
+      *cur++ = scale * ((*in >> 3) & 0x01);
+      *cur++ = scale * ((*in >> 2) & 0x01);
+      *cur++ = scale * ((*in >> 1) & 0x01);
+      *cur++ = scale * ((*in) & 0x01);
+    }
+    if (k > 0) *cur++ = scale * ((*in >> 7));
+    if (k > 1) *cur++ = scale * ((*in >> 6) & 0x01);
+    if (k > 2) *cur++ = scale * ((*in >> 5) & 0x01);
+    if (k > 3) *cur++ = scale * ((*in >> 4) & 0x01);
+    if (k > 4) *cur++ = scale * ((*in >> 3) & 0x01);
+    if (k > 5) *cur++ = scale * ((*in >> 2) & 0x01);
+    if (k > 6) *cur++ = scale * ((*in >> 1) & 0x01);
+  }
+  if (img_n != out_n) {
+    int q;
+    // insert alpha = 255
+    cur = row;
+    if (img_n == 1) {
+      for (q = x - 1; q >= 0; --q) {
+        cur[q * 2 + 1] = 255;
+        cur[q * 2 + 0] = cur[q];
+      }
+    }
+    else {
+      STBI_ASSERT(img_n == 3);
+      for (q = x - 1; q >= 0; --q) {
+        cur[q * 4 + 3] = 255;
+        cur[q * 4 + 2] = cur[q * 3 + 2];
+        cur[q * 4 + 1] = cur[q * 3 + 1];
+        cur[q * 4 + 0] = cur[q * 3 + 0];
+      }
+    }
+  }
+}
+
 // create the png data from post-deflated data
 static int stbi__create_png_image_raw(stbi__png* a, stbi_uc* raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
 {
@@ -4638,12 +6550,9 @@ static int stbi__create_png_image_raw(stbi__png* a, stbi_uc* raw, stbi__uint32 r
   stbi__context* s = a->s;
   stbi__uint32 i, j, stride = x * out_n * bytes;
   stbi__uint32 img_len, img_width_bytes;
-  int k;
   int img_n = s->img_n; // copy it into a local for later
 
   int output_bytes = out_n * bytes;
-  int filter_bytes = img_n * bytes;
-  int width = x;
 
   STBI_ASSERT(out_n == s->img_n || out_n == s->img_n + 1);
   a->out = (stbi_uc*)stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
@@ -4657,183 +6566,24 @@ static int stbi__create_png_image_raw(stbi__png* a, stbi_uc* raw, stbi__uint32 r
   // but issue #276 reported a PNG in the wild that had extra data at the end (all zeros),
   // so just check for raw_len < img_len always.
   if (raw_len < img_len) return stbi__err("not enough pixels", "Corrupt PNG");
+  if (depth < 8 && img_width_bytes > x) return stbi__err("invalid width", "Corrupt PNG");
 
   for (j = 0; j < y; ++j) {
     stbi_uc* cur = a->out + stride * j;
-    stbi_uc* prior;
-    int filter = *raw++;
-
-    if (filter > 4)
-      return stbi__err("invalid filter", "Corrupt PNG");
-
-    if (depth < 8) {
-      if (img_width_bytes > x) return stbi__err("invalid width", "Corrupt PNG");
+    if (depth < 8)
       cur += x * out_n - img_width_bytes; // store output to the rightmost img_len bytes, so we can decode in place
-      filter_bytes = 1;
-      width = img_width_bytes;
-    }
-    prior = cur - stride; // bugfix: need to compute this after 'cur +=' computation above
-
-    // if first row, use special filter that doesn't sample previous row
-    if (j == 0) filter = first_row_filter[filter];
-
-    // handle first byte explicitly
-    for (k = 0; k < filter_bytes; ++k) {
-      switch (filter) {
-      case STBI__F_none: cur[k] = raw[k]; break;
-      case STBI__F_sub: cur[k] = raw[k]; break;
-      case STBI__F_up: cur[k] = STBI__BYTECAST(raw[k] + prior[k]); break;
-      case STBI__F_avg: cur[k] = STBI__BYTECAST(raw[k] + (prior[k] >> 1)); break;
-      case STBI__F_paeth: cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(0, prior[k], 0)); break;
-      case STBI__F_avg_first: cur[k] = raw[k]; break;
-      case STBI__F_paeth_first: cur[k] = raw[k]; break;
-      }
-    }
-
-    if (depth == 8) {
-      if (img_n != out_n)
-        cur[img_n] = 255; // first pixel
-      raw += img_n;
-      cur += out_n;
-      prior += out_n;
-    }
-    else if (depth == 16) {
-      if (img_n != out_n) {
-        cur[filter_bytes] = 255; // first pixel top byte
-        cur[filter_bytes + 1] = 255; // first pixel bottom byte
-      }
-      raw += filter_bytes;
-      cur += output_bytes;
-      prior += output_bytes;
-    }
-    else {
-      raw += 1;
-      cur += 1;
-      prior += 1;
-    }
-
-    // this is a little gross, so that we don't switch per-pixel or per-component
-    if (depth < 8 || img_n == out_n) {
-      int nk = (width - 1) * filter_bytes;
-#define STBI__CASE(f) \
-             case f:     \
-                for (k=0; k < nk; ++k)
-      switch (filter) {
-        // "none" filter turns into a memcpy here; make that explicit.
-      case STBI__F_none:         memcpy(cur, raw, nk); break;
-        STBI__CASE(STBI__F_sub) { cur[k] = STBI__BYTECAST(raw[k] + cur[k - filter_bytes]); } break;
-        STBI__CASE(STBI__F_up) { cur[k] = STBI__BYTECAST(raw[k] + prior[k]); } break;
-        STBI__CASE(STBI__F_avg) { cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k - filter_bytes]) >> 1)); } break;
-        STBI__CASE(STBI__F_paeth) { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k - filter_bytes], prior[k], prior[k - filter_bytes])); } break;
-        STBI__CASE(STBI__F_avg_first) { cur[k] = STBI__BYTECAST(raw[k] + (cur[k - filter_bytes] >> 1)); } break;
-        STBI__CASE(STBI__F_paeth_first) { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k - filter_bytes], 0, 0)); } break;
-      }
-#undef STBI__CASE
-      raw += nk;
-    }
-    else {
-      STBI_ASSERT(img_n + 1 == out_n);
-#define STBI__CASE(f) \
-             case f:     \
-                for (i=x-1; i >= 1; --i, cur[filter_bytes]=255,raw+=filter_bytes,cur+=output_bytes,prior+=output_bytes) \
-                   for (k=0; k < filter_bytes; ++k)
-      switch (filter) {
-        STBI__CASE(STBI__F_none) { cur[k] = raw[k]; } break;
-        STBI__CASE(STBI__F_sub) { cur[k] = STBI__BYTECAST(raw[k] + cur[k - output_bytes]); } break;
-        STBI__CASE(STBI__F_up) { cur[k] = STBI__BYTECAST(raw[k] + prior[k]); } break;
-        STBI__CASE(STBI__F_avg) { cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k - output_bytes]) >> 1)); } break;
-        STBI__CASE(STBI__F_paeth) { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k - output_bytes], prior[k], prior[k - output_bytes])); } break;
-        STBI__CASE(STBI__F_avg_first) { cur[k] = STBI__BYTECAST(raw[k] + (cur[k - output_bytes] >> 1)); } break;
-        STBI__CASE(STBI__F_paeth_first) { cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k - output_bytes], 0, 0)); } break;
-      }
-#undef STBI__CASE
-
-      // the loop above sets the high byte of the pixels' alpha, but for
-      // 16 bit png files we also need the low byte set. we'll do that here.
-      if (depth == 16) {
-        cur = a->out + stride * j; // start at the beginning of the row again
-        for (i = 0; i < x; ++i, cur += output_bytes) {
-          cur[filter_bytes + 1] = 255;
-        }
-      }
-    }
+    // prior is computed after the 'cur +=' above
+    if (!stbi__png_unfilter_row(cur, cur - stride, raw, j == 0, x, img_n, out_n, depth, img_width_bytes))
+      return 0;
+    raw += img_width_bytes + 1;
   }
 
   // we make a separate pass to expand bits to pixels; for performance,
   // this could run two scanlines behind the above code, so it won't
   // intefere with filtering but will still be in the cache.
   if (depth < 8) {
-    for (j = 0; j < y; ++j) {
-      stbi_uc* cur = a->out + stride * j;
-      stbi_uc* in = a->out + stride * j + x * out_n - img_width_bytes;
-      // unpack 1/2/4-bit into a 8-bit buffer. allows us to keep the common 8-bit path optimal at minimal cost for 1/2/4-bit
-      // png guarante byte alignment, if width is not multiple of 8/4/2 we'll decode dummy trailing data that will be skipped in the later loop
-      stbi_uc scale = (color == 0) ? stbi__depth_scale_table[depth] : 1; // scale grayscale values to 0..255 range
-
-      // note that the final byte might overshoot and write more data than desired.
-      // we can allocate enough data that this never writes out of memory, but it
-      // could also overwrite the next scanline. can it overwrite non-empty data
-      // on the next scanline? yes, consider 1-pixel-wide scanlines with 1-bit-per-pixel.
-      // so we need to explicitly clamp the final ones
-
-      if (depth == 4) {
-        for (k = x * img_n; k >= 2; k -= 2, ++in) {
-          *cur++ = scale * ((*in >> 4));
-          *cur++ = scale * ((*in) & 0x0f);
-        }
-        if (k > 0) *cur++ = scale * ((*in >> 4));
-      }
-      else if (depth == 2) {
-        for (k = x * img_n; k >= 4; k -= 4, ++in) {
-          *cur++ = scale * ((*in >> 6));
-          *cur++ = scale * ((*in >> 4) & 0x03);
-          *cur++ = scale * ((*in >> 2) & 0x03);
-          *cur++ = scale * ((*in) & 0x03);
-        }
-        if (k > 0) *cur++ = scale * ((*in >> 6));
-        if (k > 1) *cur++ = scale * ((*in >> 4) & 0x03);
-        if (k > 2) *cur++ = scale * ((*in >> 2) & 0x03);
-      }
-      else if (depth == 1) {
-        for (k = x * img_n; k >= 8; k -= 8, ++in) {
-          *cur++ = scale * ((*in >> 7));
-          *cur++ = scale * ((*in >> 6) & 0x01);
-          *cur++ = scale * ((*in >> 5) & 0x01);
-          *cur++ = scale * ((*in >> 4) & 0x01);
-          *cur++ = scale * ((*in >> 3) & 0x01);
-          *cur++ = scale * ((*in >> 2) & 0x01);
-          *cur++ = scale * ((*in >> 1) & 0x01);
-          *cur++ = scale * ((*in) & 0x01);
-        }
-        if (k > 0) *cur++ = scale * ((*in >> 7));
-        if (k > 1) *cur++ = scale * ((*in >> 6) & 0x01);
-        if (k > 2) *cur++ = scale * ((*in >> 5) & 0x01);
-        if (k > 3) *cur++ = scale * ((*in >> 4) & 0x01);
-        if (k > 4) *cur++ = scale * ((*in >> 3) & 0x01);
-        if (k > 5) *cur++ = scale * ((*in >> 2) & 0x01);
-        if (k > 6) *cur++ = scale * ((*in >> 1) & 0x01);
-      }
-      if (img_n != out_n) {
-        int q;
-        // insert alpha = 255
-        cur = a->out + stride * j;
-        if (img_n == 1) {
-          for (q = x - 1; q >= 0; --q) {
-            cur[q * 2 + 1] = 255;
-            cur[q * 2 + 0] = cur[q];
-          }
-        }
-        else {
-          STBI_ASSERT(img_n == 3);
-          for (q = x - 1; q >= 0; --q) {
-            cur[q * 4 + 3] = 255;
-            cur[q * 4 + 2] = cur[q * 3 + 2];
-            cur[q * 4 + 1] = cur[q * 3 + 1];
-            cur[q * 4 + 0] = cur[q * 3 + 0];
-          }
-        }
-      }
-    }
+    for (j = 0; j < y; ++j)
+      stbi__expand_png_row(a->out + stride * j, a->out + stride * j + x * out_n - img_width_bytes, x, img_n, out_n, depth, color);
   }
   else if (depth == 16) {
     // force the image data from big-endian to platform-native.
@@ -4896,11 +6646,9 @@ static int stbi__create_png_image(stbi__png* a, stbi_uc* image_data, stbi__uint3
   return 1;
 }
 
-static int stbi__compute_transparency(stbi__png* z, stbi_uc tc[3], int out_n)
+static int stbi__compute_transparency(stbi_uc* p, stbi__uint32 pixel_count, stbi_uc tc[3], int out_n)
 {
-  stbi__context* s = z->s;
-  stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-  stbi_uc* p = z->out;
+  stbi__uint32 i;
 
   // compute color-based transparency, assuming we've
   // already got 255 as the alpha value in the output
@@ -4922,11 +6670,9 @@ static int stbi__compute_transparency(stbi__png* z, stbi_uc tc[3], int out_n)
   return 1;
 }
 
-static int stbi__compute_transparency16(stbi__png* z, stbi__uint16 tc[3], int out_n)
+static int stbi__compute_transparency16(stbi__uint16* p, stbi__uint32 pixel_count, stbi__uint16 tc[3], int out_n)
 {
-  stbi__context* s = z->s;
-  stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-  stbi__uint16* p = (stbi__uint16*)z->out;
+  stbi__uint32 i;
 
   // compute color-based transparency, assuming we've
   // already got 65535 as the alpha value in the output
@@ -4948,17 +6694,9 @@ static int stbi__compute_transparency16(stbi__png* z, stbi__uint16 tc[3], int ou
   return 1;
 }
 
-static int stbi__expand_png_palette(stbi__png* a, stbi_uc* palette, int len, int pal_img_n)
+static void stbi__expand_png_palette_row(stbi_uc* p, stbi_uc const* orig, stbi__uint32 pixel_count, stbi_uc const* palette, int pal_img_n)
 {
-  stbi__uint32 i, pixel_count = a->s->img_x * a->s->img_y;
-  stbi_uc* p, * temp_out, * orig = a->out;
-
-  p = (stbi_uc*)stbi__malloc_mad2(pixel_count, pal_img_n, 0);
-  if (p == NULL) return stbi__err("outofmem", "Out of memory");
-
-  // between here and free(out) below, exitting would leak
-  temp_out = p;
-
+  stbi__uint32 i;
   if (pal_img_n == 3) {
     for (i = 0; i < pixel_count; ++i) {
       int n = orig[i] * 4;
@@ -4978,6 +6716,17 @@ static int stbi__expand_png_palette(stbi__png* a, stbi_uc* palette, int len, int
       p += 4;
     }
   }
+}
+
+static int stbi__expand_png_palette(stbi__png* a, stbi_uc* palette, int len, int pal_img_n)
+{
+  stbi__uint32 pixel_count = a->s->img_x * a->s->img_y;
+  stbi_uc* temp_out;
+
+  temp_out = (stbi_uc*)stbi__malloc_mad2(pixel_count, pal_img_n, 0);
+  if (temp_out == NULL) return stbi__err("outofmem", "Out of memory");
+
+  stbi__expand_png_palette_row(temp_out, a->out, pixel_count, palette, pal_img_n);
   STBI_FREE(a->out);
   a->out = temp_out;
 
@@ -5026,13 +6775,11 @@ STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_conve
                                 : stbi__de_iphone_flag_global)
 #endif // STBI_THREAD_LOCAL
 
-static void stbi__de_iphone(stbi__png* z)
+static void stbi__de_iphone(stbi_uc* p, stbi__uint32 pixel_count, int img_out_n)
 {
-  stbi__context* s = z->s;
-  stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-  stbi_uc* p = z->out;
+  stbi__uint32 i;
 
-  if (s->img_out_n == 3) {  // convert bgr to rgb
+  if (img_out_n == 3) {  // convert bgr to rgb
     for (i = 0; i < pixel_count; ++i) {
       stbi_uc t = p[0];
       p[0] = p[2];
@@ -5041,7 +6788,7 @@ static void stbi__de_iphone(stbi__png* z)
     }
   }
   else {
-    STBI_ASSERT(s->img_out_n == 4);
+    STBI_ASSERT(img_out_n == 4);
     if (stbi__unpremultiply_on_load) {
       // convert bgr to rgb and unpremultiply
       for (i = 0; i < pixel_count; ++i) {
@@ -5074,6 +6821,230 @@ static void stbi__de_iphone(stbi__png* z)
 
 #define STBI__PNG_TYPE(a,b,c,d)  (((unsigned) (a) << 24) + ((unsigned) (b) << 16) + ((unsigned) (c) << 8) + (unsigned) (d))
 
+#define STBI__PNG_INPUT_SIZE  16384
+
+// state for handing a non-interlaced image to z->row_callback one row at a time. the IDAT
+// chunks are read as the inflater asks for them, and the inflated rows are unfiltered through
+// a two-row buffer and expanded and converted to req_comp 8-bit channels on their own, so
+// neither the compressed nor the inflated image nor z->out is ever held whole.
+typedef struct
+{
+  stbi__png* z;
+
+  // input: the rest of the current IDAT chunk, then the chunk header that followed the last one
+  stbi__uint32 idat_left;
+  int has_next, truncated;
+  stbi__pngchunk next;
+  stbi_uc* input;
+
+  // rows: raw collects one filter byte plus img_width_bytes of inflated data
+  stbi__uint32 x, y, row, filled, img_width_bytes, packed_offset, stride;
+  int depth, color, img_n, out_n, pix_n, req_comp;
+  stbi_uc* raw, * filt, * px, * pal, * out;
+  stbi__uint16* out16;
+
+  stbi_uc* palette;
+  int pal_img_n, has_trans, de_iphone;
+  stbi_uc* tc;
+  stbi__uint16* tc16;
+} stbi__png_rows;
+
+static void stbi__png_rows_free(stbi__png_rows* r)
+{
+  STBI_FREE(r->input);
+  STBI_FREE(r->raw);
+  STBI_FREE(r->filt);
+  STBI_FREE(r->px);
+  STBI_FREE(r->pal);
+  STBI_FREE(r->out16);
+  STBI_FREE(r->out);
+}
+
+static int stbi__png_rows_init(stbi__png_rows* r, stbi__png* z, int req_comp, int color, stbi_uc* palette, int pal_img_n, int has_trans, stbi_uc tc[3], stbi__uint16 tc16[3], int de_iphone)
+{
+  stbi__context* s = z->s;
+  int bytes = (z->depth == 16 ? 2 : 1);
+  int copy;
+
+  memset(r, 0, sizeof(*r));
+  r->z = z;
+  r->x = s->img_x;
+  r->y = s->img_y;
+  r->depth = z->depth;
+  r->color = color;
+  r->img_n = s->img_n;
+  r->out_n = s->img_out_n;
+  r->pix_n = pal_img_n ? (req_comp >= 3 ? req_comp : pal_img_n) : s->img_out_n; // channels once the palette is applied
+  r->req_comp = req_comp;
+  r->palette = palette;
+  r->pal_img_n = pal_img_n;
+  r->has_trans = has_trans;
+  r->tc = tc;
+  r->tc16 = tc16;
+  r->de_iphone = de_iphone;
+
+  STBI_ASSERT(r->out_n == r->img_n || r->out_n == r->img_n + 1);
+  if (!stbi__mad3sizes_valid(r->img_n, r->x, r->depth, 7)) return stbi__err("too large", "Corrupt PNG");
+  r->img_width_bytes = (((r->img_n * r->x * r->depth) + 7) >> 3);
+  r->stride = r->x * r->out_n * bytes;
+  if (r->depth < 8) {
+    if (r->img_width_bytes > r->x) return stbi__err("invalid width", "Corrupt PNG");
+    r->packed_offset = r->x * r->out_n - r->img_width_bytes; // as in stbi__create_png_image_raw
+  }
+
+  // unfiltered rows are the next row's prior, so anything that rewrites pixels works on a copy
+  copy = r->depth != 8 || has_trans || de_iphone;
+  r->input = (stbi_uc*)stbi__malloc(STBI__PNG_INPUT_SIZE);
+  r->raw = (stbi_uc*)stbi__malloc_mad2(r->img_width_bytes, 1, 1);
+  r->filt = (stbi_uc*)stbi__malloc_mad3(2, r->x, r->out_n * bytes, 0);
+  if (copy)
+    r->px = (stbi_uc*)stbi__malloc_mad2(r->x, r->out_n * bytes, 0);
+  if (pal_img_n)
+    r->pal = (stbi_uc*)stbi__malloc_mad2(r->x, r->pix_n, 0);
+  if (r->depth == 16 && r->out_n != req_comp)
+    r->out16 = (stbi__uint16*)stbi__malloc_mad3(r->x, req_comp, 2, 0);
+  if (r->depth == 16 || r->pix_n != req_comp)
+    r->out = (stbi_uc*)stbi__malloc_mad2(r->x, req_comp, 0);
+  if (!r->input || !r->raw || !r->filt || (copy && !r->px) || (pal_img_n && !r->pal) ||
+      (r->depth == 16 && r->out_n != req_comp && !r->out16) || ((r->depth == 16 || r->pix_n != req_comp) && !r->out)) {
+    stbi__png_rows_free(r);
+    return stbi__err("outofmem", "Out of memory");
+  }
+  return 1;
+}
+
+// unfilters, expands and converts one row of inflated data, then hands it to the callback
+static int stbi__png_rows_emit(stbi__png_rows* r, stbi_uc const* raw)
+{
+  stbi__uint32 i, j = r->row;
+  stbi_uc* cur = r->filt + r->stride * (j & 1) + r->packed_offset;
+  stbi_uc* src = cur;
+  if (!stbi__png_unfilter_row(cur, r->filt + r->stride * (~j & 1) + r->packed_offset, raw, j == 0, r->x, r->img_n, r->out_n, r->depth, r->img_width_bytes))
+    return 0;
+
+  if (r->depth < 8) {
+    stbi__expand_png_row(r->px, cur, r->x, r->img_n, r->out_n, r->depth, r->color);
+    src = r->px;
+  }
+  else if (r->depth == 16) {
+    stbi__uint16* cur16 = (stbi__uint16*)r->px;
+    for (i = 0; i < r->x * r->out_n; ++i)
+      cur16[i] = (cur[i * 2] << 8) | cur[i * 2 + 1];
+    src = r->px;
+  }
+  else if (r->px) {
+    memcpy(r->px, cur, r->stride);
+    src = r->px;
+  }
+
+  if (r->has_trans) {
+    if (r->depth == 16)
+      stbi__compute_transparency16((stbi__uint16*)src, r->x, r->tc16, r->out_n);
+    else
+      stbi__compute_transparency(src, r->x, r->tc, r->out_n);
+  }
+  if (r->de_iphone)
+    stbi__de_iphone(src, r->x, r->out_n);
+  if (r->pal_img_n) {
+    stbi__expand_png_palette_row(r->pal, src, r->x, r->palette, r->pix_n);
+    src = r->pal;
+  }
+
+  if (r->depth == 16) {
+    // convert channels first, then keep the top half of each sample, as stbi_load does
+    stbi__uint16* src16 = (stbi__uint16*)src;
+    if (r->out_n != r->req_comp) {
+      if (!stbi__convert_format16_row(src16, r->out16, r->out_n, r->req_comp, r->x)) return 0;
+      src16 = r->out16;
+    }
+    for (i = 0; i < r->x * r->req_comp; ++i)
+      r->out[i] = (stbi_uc)((src16[i] >> 8) & 0xFF);
+    src = r->out;
+  }
+  else if (r->pix_n != r->req_comp) {
+    if (!stbi__convert_format_row(src, r->out, r->pix_n, r->req_comp, r->x)) return 0;
+    src = r->out;
+  }
+  ++r->row;
+  if (!r->z->row_callback(r->z->row_user, src, j, r->x, r->y))
+    return stbi__err("aborted", "Load aborted by callback");
+  return 1;
+}
+
+// zlib flush callback: splits the inflated data into rows
+static int stbi__png_rows_consume(void* user, stbi_uc const* data, int len)
+{
+  stbi__png_rows* r = (stbi__png_rows*)user;
+  stbi__uint32 row_bytes = r->img_width_bytes + 1;
+  while (len > 0 && r->row < r->y) { // data after the last row is ignored, as in stbi__create_png_image_raw
+    stbi_uc const* raw;
+    if (r->filled == 0 && (stbi__uint32)len >= row_bytes) {
+      raw = data;
+      data += row_bytes;
+      len -= row_bytes;
+    }
+    else {
+      stbi__uint32 n = row_bytes - r->filled;
+      if (n > (stbi__uint32)len) n = len;
+      memcpy(r->raw + r->filled, data, n);
+      r->filled += n;
+      data += n;
+      len -= n;
+      if (r->filled < row_bytes) break;
+      r->filled = 0;
+      raw = r->raw;
+    }
+    if (!stbi__png_rows_emit(r, raw)) return 0;
+  }
+  return 1;
+}
+
+// zlib refill callback: reads the current IDAT chunk in pieces, then moves on to the next
+// one. stops at the first chunk that is not an IDAT, leaving its header for the parser.
+static int stbi__png_rows_refill(void* user, stbi_uc** start, stbi_uc** end)
+{
+  stbi__png_rows* r = (stbi__png_rows*)user;
+  stbi__context* s = r->z->s;
+  stbi__uint32 n;
+  while (r->idat_left == 0) {
+    if (r->has_next) return 0;
+    stbi__get32be(s); // CRC of the IDAT just finished
+    r->next = stbi__get_chunk_header(s);
+    if (r->next.type != STBI__PNG_TYPE('I', 'D', 'A', 'T')) {
+      r->has_next = 1;
+      return 0;
+    }
+    r->idat_left = r->next.length;
+  }
+  n = r->idat_left < STBI__PNG_INPUT_SIZE ? r->idat_left : STBI__PNG_INPUT_SIZE;
+  if (!stbi__getn(s, r->input, n)) {
+    r->idat_left = 0;
+    r->has_next = r->truncated = 1;
+    return 0;
+  }
+  r->idat_left -= n;
+  *start = r->input;
+  *end = r->input + n;
+  return 1;
+}
+
+// inflates the IDAT chunks starting with one of idat_length bytes whose header has just been
+// read, handing rows to the callback as they come out
+static int stbi__png_rows_inflate(stbi__png_rows* r, stbi__uint32 idat_length, int parse_header)
+{
+  stbi__zbuf a;
+  r->idat_left = idat_length;
+  a.zbuffer = a.zbuffer_end = r->input;
+  a.refill = stbi__png_rows_refill;
+  a.flush = stbi__png_rows_consume;
+  a.stream_user = r;
+  if (!stbi__do_zlib_stream(&a, parse_header)) return 0;
+  if (r->truncated) return stbi__err("outofdata", "Corrupt PNG");
+  if (r->row < r->y) return stbi__err("not enough pixels", "Corrupt PNG");
+  return 1;
+}
+
+
 static int stbi__parse_png_file(stbi__png* z, int scan, int req_comp)
 {
   stbi_uc palette[1024], pal_img_n = 0;
@@ -5081,6 +7052,8 @@ static int stbi__parse_png_file(stbi__png* z, int scan, int req_comp)
   stbi__uint16 tc16[3];
   stbi__uint32 ioff = 0, idata_limit = 0, i, pal_len = 0;
   int first = 1, k, interlace = 0, color = 0, is_iphone = 0;
+  int streamed = 0, has_next = 0;
+  stbi__pngchunk next = { 0, 0 };
   stbi__context* s = z->s;
 
   z->expanded = NULL;
@@ -5092,7 +7065,9 @@ static int stbi__parse_png_file(stbi__png* z, int scan, int req_comp)
   if (scan == STBI__SCAN_type) return 1;
 
   for (;;) {
-    stbi__pngchunk c = stbi__get_chunk_header(s);
+    // the streaming inflater may have read the header of the chunk after the last IDAT already
+    stbi__pngchunk c = has_next ? next : stbi__get_chunk_header(s);
+    has_next = 0;
     switch (c.type) {
     case STBI__PNG_TYPE('C', 'g', 'B', 'I'):
       is_iphone = 1;
@@ -5146,7 +7121,7 @@ static int stbi__parse_png_file(stbi__png* z, int scan, int req_comp)
 
     case STBI__PNG_TYPE('t', 'R', 'N', 'S'): {
       if (first) return stbi__err("first not IHDR", "Corrupt PNG");
-      if (z->idata) return stbi__err("tRNS after IDAT", "Corrupt PNG");
+      if (z->idata || streamed) return stbi__err("tRNS after IDAT", "Corrupt PNG");
       if (pal_img_n) {
         if (scan == STBI__SCAN_header) { s->img_n = 4; return 1; }
         if (pal_len == 0) return stbi__err("tRNS before PLTE", "Corrupt PNG");
@@ -5173,6 +7148,35 @@ static int stbi__parse_png_file(stbi__png* z, int scan, int req_comp)
       if (first) return stbi__err("first not IHDR", "Corrupt PNG");
       if (pal_img_n && !pal_len) return stbi__err("no PLTE", "Corrupt PNG");
       if (scan == STBI__SCAN_header) { s->img_n = pal_img_n; return 1; }
+      if (streamed) {
+        // past the end of the zlib stream, so nothing the image needs
+        stbi__skip(s, c.length);
+        break;
+      }
+      if (z->row_callback && !interlace) {
+        // inflate straight from the file into rows; the rest of the IDATs are read on the way
+        stbi__png_rows rows;
+        int ok;
+        if ((req_comp == s->img_n + 1 && req_comp != 3 && !pal_img_n) || has_trans)
+          s->img_out_n = s->img_n + 1;
+        else
+          s->img_out_n = s->img_n;
+        if (!stbi__png_rows_init(&rows, z, req_comp, color, palette, pal_img_n, has_trans, tc, tc16,
+                                 is_iphone && stbi__de_iphone_flag && s->img_out_n > 2))
+          return 0;
+        ok = stbi__png_rows_inflate(&rows, c.length, !is_iphone);
+        stbi__png_rows_free(&rows);
+        if (!ok) return 0;
+        streamed = 1;
+        if (rows.has_next) {
+          // the last IDAT's CRC is read too
+          has_next = 1;
+          next = rows.next;
+          continue;
+        }
+        stbi__skip(s, rows.idat_left);
+        break;
+      }
       if ((int)(ioff + c.length) < (int)ioff) return 0;
       if (ioff + c.length > idata_limit) {
         stbi__uint32 idata_limit_old = idata_limit;
@@ -5193,34 +7197,36 @@ static int stbi__parse_png_file(stbi__png* z, int scan, int req_comp)
       stbi__uint32 raw_len, bpl;
       if (first) return stbi__err("first not IHDR", "Corrupt PNG");
       if (scan != STBI__SCAN_load) return 1;
-      if (z->idata == NULL) return stbi__err("no IDAT", "Corrupt PNG");
-      // initial guess for decoded data size to avoid unnecessary reallocs
-      bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
-      raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
-      z->expanded = (stbi_uc*)stbi_zlib_decode_malloc_guesssize_headerflag((char*)z->idata, ioff, raw_len, (int*)&raw_len, !is_iphone);
-      if (z->expanded == NULL) return 0; // zlib should set error
-      STBI_FREE(z->idata); z->idata = NULL;
-      if ((req_comp == s->img_n + 1 && req_comp != 3 && !pal_img_n) || has_trans)
-        s->img_out_n = s->img_n + 1;
-      else
-        s->img_out_n = s->img_n;
-      if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
-      if (has_trans) {
-        if (z->depth == 16) {
-          if (!stbi__compute_transparency16(z, tc16, s->img_out_n)) return 0;
-        }
-        else {
-          if (!stbi__compute_transparency(z, tc, s->img_out_n)) return 0;
+      if (!streamed) {
+        if (z->idata == NULL) return stbi__err("no IDAT", "Corrupt PNG");
+        // initial guess for decoded data size to avoid unnecessary reallocs
+        bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
+        raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
+        z->expanded = (stbi_uc*)stbi_zlib_decode_malloc_guesssize_headerflag((char*)z->idata, ioff, raw_len, (int*)&raw_len, !is_iphone);
+        if (z->expanded == NULL) return 0; // zlib should set error
+        STBI_FREE(z->idata); z->idata = NULL;
+        if ((req_comp == s->img_n + 1 && req_comp != 3 && !pal_img_n) || has_trans)
+          s->img_out_n = s->img_n + 1;
+        else
+          s->img_out_n = s->img_n;
+        if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
+        if (has_trans) {
+          if (z->depth == 16) {
+            if (!stbi__compute_transparency16((stbi__uint16*)z->out, s->img_x * s->img_y, tc16, s->img_out_n)) return 0;
+          }
+          else {
+            if (!stbi__compute_transparency(z->out, s->img_x * s->img_y, tc, s->img_out_n)) return 0;
+          }
         }
+        if (is_iphone && stbi__de_iphone_flag && s->img_out_n > 2)
+          stbi__de_iphone(z->out, s->img_x * s->img_y, s->img_out_n);
       }
-      if (is_iphone && stbi__de_iphone_flag && s->img_out_n > 2)
-        stbi__de_iphone(z);
       if (pal_img_n) {
         // pal_img_n == 3 or 4
         s->img_n = pal_img_n; // record the actual colors we had
         s->img_out_n = pal_img_n;
         if (req_comp >= 3) s->img_out_n = req_comp;
-        if (!stbi__expand_png_palette(z, palette, pal_len, s->img_out_n))
+        if (z->out && !stbi__expand_png_palette(z, palette, pal_len, s->img_out_n))
           return 0;
       }
       else if (has_trans) {
@@ -5291,9 +7297,77 @@ static void* stbi__png_load(stbi__context* s, int* x, int* y, int* comp, int req
 {
   stbi__png p;
   p.s = s;
+  p.row_callback = NULL;
   return stbi__do_png(&p, x, y, comp, req_comp, ri);
 }
 
+static int stbi__png_load_rows(stbi__context* s, int* x, int* y, int* comp, int req_comp, stbi_row_callback callback, void* user)
+{
+  stbi__png p;
+  stbi__uint32 i, j;
+  int parsed, result = 0;
+  stbi_uc* row = NULL;
+  stbi__uint16* row16 = NULL;
+  p.s = s;
+  p.row_callback = callback;
+  p.row_user = user;
+  parsed = stbi__parse_png_file(&p, STBI__SCAN_load, req_comp);
+  if (parsed && !p.out) {
+    // non-interlaced: every row already went to the callback from the unfilter loop
+    result = 1;
+    *x = s->img_x;
+    *y = s->img_y;
+    if (comp) *comp = s->img_n;
+  }
+  else if (parsed) {
+    // interlaced rows are only complete once the last pass is in, so these go out from the full image
+    int img_out_n = s->img_out_n;
+    size_t samples = (size_t)s->img_x * img_out_n;
+    if (p.depth == 16)
+      row16 = (stbi__uint16*)stbi__malloc_mad3(s->img_x, req_comp, 2, 0);
+    if (p.depth == 16 || img_out_n != req_comp)
+      row = (stbi_uc*)stbi__malloc_mad2(s->img_x, req_comp, 0);
+    if ((p.depth == 16 && !row16) || ((p.depth == 16 || img_out_n != req_comp) && !row)) {
+      stbi__err("outofmem", "Out of memory");
+    }
+    else {
+      result = 1;
+      for (j = 0; j < s->img_y && result; ++j) {
+        stbi_uc* out;
+        if (p.depth == 16) {
+          // convert channels first, then keep the top half of each sample, as stbi_load does
+          stbi__uint16* src = (stbi__uint16*)p.out + samples * j;
+          if (img_out_n != req_comp) {
+            if (!stbi__convert_format16_row(src, row16, img_out_n, req_comp, s->img_x)) { result = 0; break; }
+            src = row16;
+          }
+          for (i = 0; i < s->img_x * req_comp; ++i)
+            row[i] = (stbi_uc)((src[i] >> 8) & 0xFF);
+          out = row;
+        }
+        else if (img_out_n != req_comp) {
+          if (!stbi__convert_format_row(p.out + samples * j, row, img_out_n, req_comp, s->img_x)) { result = 0; break; }
+          out = row;
+        }
+        else {
+          out = p.out + samples * j;
+        }
+        if (!callback(user, out, j, s->img_x, s->img_y))
+          result = stbi__err("aborted", "Load aborted by callback");
+      }
+      *x = s->img_x;
+      *y = s->img_y;
+      if (comp) *comp = s->img_n;
+    }
+  }
+  STBI_FREE(row);
+  STBI_FREE(row16);
+  STBI_FREE(p.out);      p.out = NULL;
+  STBI_FREE(p.expanded); p.expanded = NULL;
+  STBI_FREE(p.idata);    p.idata = NULL;
+  return result;
+}
+
 static int stbi__png_test(stbi__context* s)
 {
   int r;
@@ -5318,6 +7392,7 @@ static int stbi__png_info(stbi__context* s, int* x, int* y, int* comp)
 {
   stbi__png p;
   p.s = s;
+  p.row_callback = NULL;
   return stbi__png_info_raw(&p, x, y, comp);
 }
 
@@ -5325,6 +7400,7 @@ static int stbi__png_is16(stbi__context* s)
 {
   stbi__png p;
   p.s = s;
+  p.row_callback = NULL;
   if (!stbi__png_info_raw(&p, NULL, NULL, NULL))
     return 0;
   if (p.depth != 16) {